@@ -18,11 +18,22 @@
  * (It may be possible to enter into command mode e.g. send +++ ,guess what socket the request came from, and close that socket, but its messy)
  * So this code builds HTTP 1.1 responses which have the content lengrh in the header. The browser then closes the connection after it has received the specified
  * content length.
+ * Browsers keep connections open for further requests (keep-alive) unless the request or response has a "Connection: close" header, so that a page and
+ * the files it uses (e.g. s.css) can be loaded over one connection. Requests which arrive while a response is being sent (pipelined requests) are
+ * left in the serial port buffer until the response has been sent, and the next request is parsed as soon as it arrives.
  *
  * The main complication with using HTTP 1.1, is that the page length (in bytes) needs to be determined in advance of the page being constructed.
- * So I used a 2 pass strategy.
- * Pass 1 builds the page, but just returns the length, which is then sent in the header
- * Pass 2 builds the page and at the same time sends it to the specified serial port.
+ * So at startup each page is split into segments, each of which is a piece of fixed text followed by a variable, and the length of the fixed text is saved.
+ * The page length is then the length of all the fixed text plus the length of the current value of each variable on the page, which is sent in the header,
+ * after which the page is sent one segment at a time.
+ *
+ * HTTP 1.1 browsers also accept "chunked" responses, where the page is sent in pieces, each preceded by its length, and ended by a zero length piece.
+ * If CHUNKED_RESPONSES is true, these are sent to browsers which make HTTP/1.1 requests, and the Content-length is only sent to HTTP/1.0 browsers.
+ * The page length isn't needed in advance, so pages can be any length.
+ *
+ * The values of the variables come from a snapshot of the inputs, which the sample task takes every SAMPLE_TASK_INTERVAL ms, so answering a request
+ * doesn't wait for any analogRead()s. There are two snapshots. The sample task fills the one that the response being sent isn't using, so the
+ * readings on a page all come from the same snapshot. Only the variables which the page uses are given values. These are found by compilePages().
  * 
  * Using this approach means that the page does not need to exist in RAM, which is a scarse respouse on the Arduinno, and long pages e.g. 10k could be used.
  * The only limit is the size of the program memory.
@@ -31,16 +42,40 @@
  *
  * The delimiter \a is used to signifiy the start and send of a substitution, and the number between the substitution delimiter is the index into an array of
  *  variables (which are strings). Hence \a1\a  means insert variable[1] here.
- * The buildPage() function handles the insertion and calculation of the now variable page length, as it is passed both the static page (in progmem) and also 
- * the variables array.
- * To save code duplication, the buildpage() function can also send the page data directly to the serial port, if the serial paramater is non-null.
+ * The compilePages() function finds the substitutions when the sketch starts, pageLength() calculates the now variable page length, and buildPage()
+ * sends the page with the variables inserted.
  *
  * The sketch parses the GET request to determine the requested page name, then determines if a matching name is in the pages array.
  * If a match to the requested page name is found, the correct page is returned.
- * If no match is found, the "index" page is returned
+ * If no match is found, a 404 Not Found response is returned. If no page name is given, the "index" page is returned
+ * get_pin.htm shows the analog input given by its pin parameter, e.g. pin=3 or pin=A3. A pin which isn't a number gets a 400 Bad Request response
+ * The pages array is kept in alphabetical order of page name, so that the page can be found by a binary search, which only needs
+ * a few comparisons even with dozens of pages. The order is checked when the sketch starts.
  * 
- * The sketch doesn't currently handle URL paramaters, the entire request path is considered to be the page name 
- * I'm currently working on a version which will handle GET request paramaters.
+ * The request is parsed a character at a time as it arrives, by parseRequestChar(). The method, page name, HTTP version and the values of the
+ * query string parameters listed in paramNames are saved in requestBuffer, and their positions are saved in the request structure, so that they can
+ * be used directly, without searching the request again. e.g. requestParam(PARAM_PIN) is the value of pin in get_pin.htm?pin=3
+ * The values of the request headers listed in headerNames are saved in the same way, and requestHeader(HEADER_CONNECTION) etc is their value.
+ * Other query string parameters and request headers are ignored. If the request line doesn't fit in requestBuffer, a 414 response is sent.
+ * The body of a request, e.g. of a POST which gets a 501 response, is skipped using its Content-Length, so that it isn't read as the next request.
+ * If the length of the body isn't known, the connection is closed and input is dropped until the module stops sending.
+ *
+ * Each page has an ETag, which is a hash of the page, so that browsers can ask if the page has changed (If-None-Match) instead of fetching it again,
+ * and are sent a short 304 Not Modified response if it hasn't. The hashes of the page data are calculated when the sketch starts. For pages with 
+ * variables, the current values of the variables are added to the hash, so the ETag changes when they do.
+ *
+ * Pages can also be sent gzip compressed, to browsers which say they accept it (Accept-Encoding: gzip). gzip_pages.py compresses the pages into
+ * gzip_pages.h, as lists of tokens which are runs of characters or copies of text from earlier in the page, so that the variables can still be inserted.
+ * buildGzipPage() turns the tokens into a deflate stream as the page is sent, allowing for the lengths of the variables. Run gzip_pages.py again
+ * after changing a page. Until then that page is sent uncompressed.
+ *
+ * The sketch is run by a simple cooperative scheduler in loop(). Each task is a function which is called at its own interval, and which
+ * does a small amount of work and returns, rather than waiting for something to happen.
+ * The tasks are
+ *   httpTask       Reads the request as it arrives, and sends the page a few bytes at a time, so the other tasks keep running while it is sent
+ *   sampleTask     Reads the analog inputs into the snapshot
+ *   heartbeatTask  Flashes the RX LED
+ *   statsTask      Prints the number of requests and samples to the debug serial port
  *
  * This code comes with no warranties. Use at your own risk etc.
  */
@@ -56,12 +91,134 @@
 #define STRLEN_OF_VARIABLES 16
 #define NUMBER_OF_PAGE_ARRAY_ELEMENTS 3
 
-typedef enum  RequestState
+// Total number of segments in all the pages. Each page has one more segment than the number of variable insertions in it
+#define MAX_PAGE_SEGMENTS 32
+#define NO_VARIABLE -1
+
+#define DEFAULT_PAGE_NAME "index.htm"// page sent when the request doesn't have a page name
+#define PAGE_NOT_FOUND -1
+
+// Space for the parts of the request line and the header values which are saved, including a null after each part
+#define REQUEST_BUFFER_SIZE 96
+
+// Query string parameters used by the pages. Each needs a name in paramNames
+#define PARAM_PIN 0
+#define NUMBER_OF_PARAMS 1
+#define INVALID_PIN -2// the pin parameter wasn't a number
+
+// Request headers used by the sketch. Each needs a name in headerNames
+#define HEADER_CONNECTION 0
+#define HEADER_IF_NONE_MATCH 1
+#define HEADER_ACCEPT_ENCODING 2
+#define HEADER_CONTENT_LENGTH 3
+#define HEADER_TRANSFER_ENCODING 4
+#define NUMBER_OF_HEADERS 5
+
+// How long the module must have sent nothing, after a request whose body length isn't known, before the next request is read
+#define DISCARD_IDLE_MILLIS 200
+
+// How long browsers can use their copy of a page without variables before asking if it has changed. Pages with variables are always checked
+#define STATIC_CACHE_SECONDS "300"
+
+// FNV-1a hash, used for the ETags of the pages
+#define HASH_START 2166136261UL
+#define HASH_PRIME 16777619UL
+
+// Task intervals in milliseconds. 0 means the task runs on every pass of loop()
+#define HTTP_TASK_INTERVAL 0
+#define SAMPLE_TASK_INTERVAL 10// how often the snapshot of the inputs is taken
+#define HEARTBEAT_TASK_INTERVAL 500
+#define STATS_TASK_INTERVAL 10000
+
+// Size of the buffer that output to the module is collected in, so it can be sent with one write() instead of a character at a time
+#define OUT_BUFFER_SIZE 64
+
+// Use chunked transfer encoding for HTTP/1.1 requests. Set to false to always send the Content-length
+#define CHUNKED_RESPONSES true
+#define CHUNK_HEADER_SIZE 4// space for the chunk length in hex (up to 2 digits) and \r\n, at the start of the output buffer
+#define CHUNK_TRAILER_SIZE 2// space for the \r\n after the chunk data
+
+// Compressed pages. Tokens from GZIP_COPY up are copies of earlier text, the ones below are runs of characters
+#define GZIP_COPY 128
+#define GZIP_HEADER_SIZE 10
+#define GZIP_MAX_CODE_BYTES 4// most bytes one token or character can add to the output
+
+#define NUMBER_OF_ANALOG_INPUTS 6
+
+typedef enum
 {
   waiting,
-  readingLine1,
-  readingJunk
-} ;
+  readingMethod,
+  readingPath,
+  readingParamName,
+  readingParamValue,
+  readingVersion,
+  readingHeaderName,
+  readingHeaderValue,
+  requestComplete
+} RequestState;
+
+// Position of part of the request in requestBuffer
+typedef struct
+{
+  unsigned char start;
+  unsigned char length;
+} Span;
+
+typedef struct
+{
+  Span method;
+  Span path;// page name, without the leading /
+  Span version;
+  Span params[NUMBER_OF_PARAMS];// values of the query string parameters. The start is 0 if the parameter isn't in the request
+  Span headers[NUMBER_OF_HEADERS];// values of the request headers. The start is 0 if the header isn't in the request
+  boolean tooLong;// the request line didn't fit in requestBuffer
+} Request;
+
+// Part of a page. Fixed text from the page data followed by an optional variable
+typedef struct
+{
+  char *text;// in PROGMEM
+  unsigned int length;// length of the text
+  signed char variable;// index of the variable after the text, or NO_VARIABLE
+} PageSegment;
+
+// Position in a page which is being sent
+typedef struct
+{
+  unsigned char segment;// segment being sent
+  unsigned char endSegment;// segment after the last segment of the page
+  unsigned int offset;// characters of the segment already sent. Those after the length of its text are from its variable
+  const unsigned char *gzipToken;// next token of the compressed copy of the page in PROGMEM, or 0 if the page is sent uncompressed
+  unsigned char gzipRun;// characters left in the current run token
+  unsigned long gzipBits;// bits of the deflate stream which don't make a whole byte yet
+  unsigned char gzipBitCount;
+  unsigned long gzipLength;// bytes of the compressed page so far
+  uint32_t crc;// CRC-32 of the uncompressed page so far
+  unsigned long size;// length of the uncompressed page so far
+} PageCursor;
+
+// Compressed copy of a page, made by gzip_pages.py
+typedef struct
+{
+  const char *data;// data of the page
+  uint32_t hash;// hash of the data the copy was made from, so that an out of date copy isn't used
+  const unsigned char *tokens;
+} GzipPage;
+
+// Readings taken by the sample task, which the variables are given their values from
+typedef struct
+{
+  unsigned long millis;// when the readings were taken
+  int analogValues[NUMBER_OF_ANALOG_INPUTS];
+} Snapshot;
+
+typedef struct
+{
+  void (*run)();
+  unsigned long interval;
+  unsigned long lastRun;
+} Task;
 
 
 // Data of the web pages and their page names, are stored in PROGMEM
@@ -110,327 +267,1288 @@ prog_char jsondata_json[] PROGMEM = "["
                                     "{\"name\": \"A4\",\"value\": \a5\a}"
                                     "]";
 
+// Body of error responses, either side of the status e.g. 404 Not Found
+prog_char error_htm_start[] PROGMEM = "<html><body><h3>";
+prog_char error_htm_end[] PROGMEM = "</h3></body></html>";
+
+// Names of the query string parameters, in the order of the PARAM_ defines
+prog_char param_pin[] PROGMEM = "pin";
+PROGMEM const char *paramNames[NUMBER_OF_PARAMS] =
+{
+  param_pin
+};
+
+// Names of the request headers, in the order of the HEADER_ defines. These are matched ignoring case
+prog_char header_connection[] PROGMEM = "Connection";
+prog_char header_if_none_match[] PROGMEM = "If-None-Match";
+prog_char header_accept_encoding[] PROGMEM = "Accept-Encoding";
+prog_char header_content_length[] PROGMEM = "Content-Length";
+prog_char header_transfer_encoding[] PROGMEM = "Transfer-Encoding";
+PROGMEM const char *headerNames[NUMBER_OF_HEADERS] =
+{
+  header_connection,
+  header_if_none_match,
+  header_accept_encoding,
+  header_content_length,
+  header_transfer_encoding
+};
+
 // Various useful mimetypes
 prog_char mimetype_text_html[] PROGMEM =  "text/html";
 prog_char mimetype_text_css[] PROGMEM =  "text/css";
 prog_char mimetype_application_json[] PROGMEM =  "application/json";
 
 // Code to make array of page(s) data
+// Note. This must be in alphabetical order of page name (as sorted by strcmp), because findPage() uses a binary search
 PROGMEM const char *pages[][NUMBER_OF_PAGE_ARRAY_ELEMENTS] =
 {   
-  {index_pageName,index_htm,mimetype_text_html},
   {getpin_pageName,getpin_htm,mimetype_text_html},
-  {style_pageName,style_css,mimetype_text_css},
-  {jsondata_pagename,jsondata_json,mimetype_application_json}
+  {index_pageName,index_htm,mimetype_text_html},
+  {jsondata_pagename,jsondata_json,mimetype_application_json},
+  {style_pageName,style_css,mimetype_text_css}
+};
+#define NUMBER_OF_PAGES (sizeof(pages)/sizeof(pages[0]))
+
+#include "gzip_pages.h"
+
+// gzip header for deflate data, with no file name or time
+PROGMEM const unsigned char gzipHeader[GZIP_HEADER_SIZE] = {0x1f,0x8b,8,0,0,0,0,0,0,0xff};
+
+// Deflate length codes 257 to 285 and distance codes 0 to 29 start at these values. The lengths are less 3, so that they fit in a byte
+PROGMEM const unsigned char deflateLengthBase[29] = {0,1,2,3,4,5,6,7,8,10,12,14,16,20,24,28,32,40,48,56,64,80,96,112,128,160,192,224,255};
+PROGMEM const unsigned int deflateDistanceBase[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+
+// CRC-32 of each 4 bit value, so the CRC can be worked out 4 bits at a time
+PROGMEM const uint32_t crcTable[16] =
+{
+  0x00000000UL,0x1db71064UL,0x3b6e20c8UL,0x26d930acUL,0x76dc4190UL,0x6b6b51f4UL,0x4db26158UL,0x5005713cUL,
+  0xedb88320UL,0xf00f9344UL,0xd6d6a3e8UL,0xcb61b38cUL,0x9b64c2b0UL,0x86d3d2d4UL,0xa00ae278UL,0xbdbdf21cUL
 };
 
+// Segments of all the pages, built by compilePages() when the sketch starts
+PageSegment pageSegments[MAX_PAGE_SEGMENTS];
+unsigned char pageFirstSegment[NUMBER_OF_PAGES+1];// the segments of page n are from pageFirstSegment[n] up to pageFirstSegment[n+1]
+unsigned int pageTextLength[NUMBER_OF_PAGES];// total length of the fixed text of each page
+uint32_t pageHash[NUMBER_OF_PAGES];// hash of the data and mimetype of each page
+unsigned int pageVariables[NUMBER_OF_PAGES];// bit n is set if the page uses variables[n]
+const unsigned char *pageGzip[NUMBER_OF_PAGES];// tokens of the compressed copy of each page, or 0 if it doesn't have one
+
 int RXLED = 17;  // The RX LED has a defined Arduino pin
 boolean flashState;
-long lastMillis;
+
+// State of the http task
 RequestState requestState=waiting;
+char requestBuffer[REQUEST_BUFFER_SIZE];
+unsigned char requestLength;
+unsigned char partStart;// start in requestBuffer of the part of the request being read
+signed char currentParam;// index of the query string parameter being read, or -1 if it isn't one in paramNames
+signed char currentHeader;// index of the request header being read, or -1 if it isn't one in headerNames
+unsigned char headerLineLength;
+Request request;
+boolean responseInProgress;
+boolean keepAlive;// the browser will send more requests on the same connection
+boolean http11;// the request was HTTP/1.1 rather than HTTP/1.0
+unsigned long bodyRemaining;// bytes of the body of the request which haven't been skipped yet
+boolean discardInput;// the end of the request body isn't known, so input is dropped until the module goes quiet
+unsigned long lastDiscardMillis;// when input was last dropped
+char variables[NUMBER_OF_VARIABLES][STRLEN_OF_VARIABLES];// Variables for insertion into the page being sent
+unsigned char variableLengths[NUMBER_OF_VARIABLES];
+PageCursor responseCursor;
+char outBuffer[OUT_BUFFER_SIZE];
+int outLength;
+boolean outChunked;// each flush of the output buffer is sent as one chunk
+int requestedPin=-1;// pin number from the query string, or -1
+
+// Readings taken by the sample task. The response being sent uses responseSnapshot, and the next response will use latestSnapshot
+Snapshot snapshots[2];
+Snapshot *latestSnapshot=&snapshots[0];
+Snapshot *responseSnapshot=&snapshots[0];
+
+// Counters reported by the stats task
+unsigned long requestCount;
+unsigned long pipelinedCount;// requests which arrived before the previous response had been sent
+unsigned long sampleCount;
+unsigned long longestTaskMillis;
 
 /*
- * This function has 2 uses
- * 1. Read the page data from PROGMEM and "Variables" in a ram array, and combine then and output to the module (connection to the module)
- * 2. If no stream is specified, the module only calculates the length of the page (total number of characters.
+ * Splits the data of every page into segments, so that the pages don't need to be searched for variable insertions each time they are sent.
  *
- * Note. The function always calculates page length, regardless of whether it is outputting the page to the module
- * Also note. The function uses the ASCII escape character '\a' to denote start and end of variable insertion 
+ * Note. The function uses the ASCII escape character '\a' to denote start and end of variable insertion 
  * '\a' was used because its outside of the normal printable character range, but any unused ASCII character could be used
  * I initially was going to used '\x01' i.e ASCII code 1, however using hex code numbers didn't work as the compilor 
  * interpreted the variable number after code e.g. \0x011  as being 0x011 not 0x01 followed by a 1 
  * so using an escape sequence like \a worked better.
  * You could use other delimiters, but if these are more than one byte long the code gets more complex e.g "<?var 1 ?>"
  */
-
-int buildPage(int pageIndex,char variables[NUMBER_OF_VARIABLES][STRLEN_OF_VARIABLES],Stream *oStream=((Stream *)0))
+void compilePages()
 {
   char c;
-  int l=0;
-  boolean processingVariableName=false;
-  char varIndex[4];
-  char *varIndexPtr;
-  char *page = (char*)pgm_read_word(&(pages[pageIndex][PAGE_DATA_INDEX]));//(char *)pages[pageIndex][1];
+  char *page;
+  int segment=0;
+  PageSegment *seg;
   
-  do
+  for(unsigned int pageIndex=0;pageIndex<NUMBER_OF_PAGES;pageIndex++)
   {
-    c =  pgm_read_byte_near(page++);  
+    page = (char*)pgm_read_word(&(pages[pageIndex][PAGE_DATA_INDEX]));//(char *)pages[pageIndex][1];
+    pageFirstSegment[pageIndex]=segment;
+    pageTextLength[pageIndex]=0;
+    pageVariables[pageIndex]=0;
     
-    if (!processingVariableName && c!='\a')
+    do
     {
-      l++;
-      if (oStream)
+      if (segment==MAX_PAGE_SEGMENTS)
       {
-        oStream->print(c);
+        Serial.println(F("Too many page segments. Increase MAX_PAGE_SEGMENTS"));// Debug message
+        break;
       }
-    }
- 
-    if (processingVariableName && c!='\a')
-    {
-      *varIndexPtr++=c;// save the index number
-    }  
-   
-    if (c=='\a')
-    {
-      if (!processingVariableName)
+      seg=&pageSegments[segment++];
+      seg->text=page;
+      seg->variable=NO_VARIABLE;
+      
+      // Find the end of the text, which is either the start of a variable insertion or the end of the page
+      while((c = pgm_read_byte_near(page++))!=0 && c!='\a')
       {
-        // Start of processing a variable insertion
-        varIndexPtr = varIndex;
       }
-      else
+      seg->length=page-1-seg->text;
+      pageTextLength[pageIndex]+=seg->length;
+      
+      if (c=='\a')
       {
-        // end of variable insertion found
-        *varIndexPtr=0;// terminate the string
-        l+=strlen(variables[atoi(varIndex)]);
-        if (oStream)
+        // Read the variable index up to the closing delimiter
+        seg->variable=0;
+        while((c = pgm_read_byte_near(page++))!='\a')
         {
-          oStream->print(variables[atoi(varIndex)]);
-        } 
+          seg->variable=seg->variable*10+c-'0';
+        }
+        pageVariables[pageIndex]|=1U<<seg->variable;
       }
-      processingVariableName=!processingVariableName;
-    }
-
-  } while (c!=0);
-  return --l;// deduct last null char
+    } while (c!=0);
+    
+    page = (char*)pgm_read_word(&(pages[pageIndex][PAGE_DATA_INDEX]));
+    pageHash[pageIndex]=hashBytes(HASH_START,page,strlen_P(page),true);
+    pageGzip[pageIndex]=findGzipPage(page,pageHash[pageIndex]);
+    page = (char*)pgm_read_word(&(pages[pageIndex][PAGE_MIMETYPE_INDEX]));
+    pageHash[pageIndex]=hashBytes(pageHash[pageIndex],page,strlen_P(page),true);
+  }
+  pageFirstSegment[NUMBER_OF_PAGES]=segment;
 }
 
-// Returns true if it finds the field (variable) otherwise returns false
-// if True the returnBuffer contains the text of the field data
-boolean searchQueryStringFor(char *queryString,char * variable, char *returnBuffer)
+uint32_t hashBytes(uint32_t hash,const char *data,int length,boolean inProgmem)
 {
-char *endPtr, *startPtr = strstr(queryString,variable);
+  while(length--)
+  {
+    hash ^= (unsigned char)(inProgmem ? pgm_read_byte_near(data) : *data);
+    hash *= HASH_PRIME;
+    data++;
+  }
+  return hash;
+}
 
-  if (startPtr)
+// Returns the tokens of the compressed copy of the page data, or 0 if there isn't one or it was made from different data
+const unsigned char *findGzipPage(const char *data,uint32_t hash)
+{
+  for(unsigned int i=0;i<NUMBER_OF_GZIP_PAGES;i++)
   {
-    startPtr = strstr(startPtr,"=");
-    if (!startPtr)
-    {
-      return false;// Bad data (no = sign)
-    }
-    
-    endPtr=strstr(++startPtr,"&");
-    if (endPtr)
+    if ((const char*)pgm_read_word(&gzipPages[i].data)==data)
     {
-      strncpy(returnBuffer,startPtr,endPtr-startPtr-1);
-      *(returnBuffer + (endPtr-startPtr-1))=0;// terminate the string
+      if (pgm_read_dword(&gzipPages[i].hash)==hash)
+      {
+        return (const unsigned char*)pgm_read_word(&gzipPages[i].tokens);
+      }
+      Serial.println(F("Compressed page is out of date. Run gzip_pages.py"));// Debug message
     }
-    else
+  }
+  return 0;
+}
+
+// Returns true if the page has any variable insertions
+boolean pageHasVariables(int pageIndex)
+{
+  return pageVariables[pageIndex]!=0;
+}
+
+// Returns the hash of the page, with the current values of the variables inserted
+uint32_t pageETag(int pageIndex)
+{
+  uint32_t hash=pageHash[pageIndex];
+  
+  for(int segment=pageFirstSegment[pageIndex];segment<pageFirstSegment[pageIndex+1];segment++)
+  {
+    if (pageSegments[segment].variable!=NO_VARIABLE)
     {
-      strcpy(returnBuffer,startPtr);
+      // Include the null so that e.g. values 1,23 and 12,3 have different hashes
+      hash=hashBytes(hash,variables[pageSegments[segment].variable],variableLengths[pageSegments[segment].variable]+1,false);
     }
-    return true;
   }
-  else
+  return hash;
+}
+
+// Returns the length of the page, with the current values of the variables inserted
+int pageLength(int pageIndex)
+{
+  int l=pageTextLength[pageIndex];
+  
+  for(int segment=pageFirstSegment[pageIndex];segment<pageFirstSegment[pageIndex+1];segment++)
   {
-    return false;
+    if (pageSegments[segment].variable!=NO_VARIABLE)
+    {
+      l+=variableLengths[pageSegments[segment].variable];
+    }
   }
+  return l;
 }
 
 /*
- * Function to determine what page is required
- * populate appropriate variables array
+ * Sends the page data, with the variables inserted, to the module via the output buffer.
+ * It starts from the position in the cursor, and stops after maxChars characters or at the end of the page, leaving the cursor where it stopped.
+ * This allows the page to be sent a few characters at a time. The number of characters is returned, which is less than maxChars at the end of the page.
  */
-void sendPageResponse(char *requestLine1,Stream *serialPort)
+int buildPage(PageCursor *cursor,Stream *oStream,int maxChars)
 {
-  char * pch;
-  char * queryString;
-
-  char variables[NUMBER_OF_VARIABLES][STRLEN_OF_VARIABLES];// Create some variables for insertion into the page
-  prog_char *str=(prog_char *)0;// make str a null pointer as we test if its been set later.
-  int foundPage=0;// Default to first page in the list if we don't find the actual page name by searching the page names array
-
-// Setup all the variables that will be used on the page (Note make sure your array is big enough in the #define 
-  sprintf(variables[0],"%ld",millis());// Put the value of the Millis in variable [0]
-  sprintf(variables[1],"%d",analogRead(A0));// Put the value of analog 1 into variable [1]
-  sprintf(variables[2],"%d",analogRead(A1));// etc
-  sprintf(variables[3],"%d",analogRead(A2));//  etc
-  sprintf(variables[4],"%d",analogRead(A3));//   etc
-  sprintf(variables[5],"%d",analogRead(A4));//    etc
-  sprintf(variables[6],"%d",analogRead(A5));//     etc 
-  
-  strtok (requestLine1," /");// find the first " /"
-  pch = strtok (NULL, " ")+1;// get the text from after the last strtok to the next space, strip off the first character (this may result in a null string)
+  int l=0;
+  int n;
+  PageSegment *seg;
   
-  queryString = strstr(pch,"?");// See if there are any GET contains a "query string"
-  if (queryString)
+  while (l<maxChars && cursor->segment<cursor->endSegment)
   {
-    char varBuf[8];// Allocate a small buffer when searching for query string fields
-    *queryString++=0;
-    // Process query
-    if (searchQueryStringFor(queryString,"pin",varBuf))
+    seg=&pageSegments[cursor->segment];
+    if (cursor->offset < seg->length)
     {
-      int pin=atoi(varBuf);
-      sprintf(variables[0],"%d",analogRead(atoi(varBuf)));
+      // Fixed text
+      n=min(seg->length-cursor->offset,(unsigned int)(maxChars-l));
+      outWriteP(oStream,seg->text+cursor->offset,n);
     }
-  }
-  
-  if (*pch!=0)
-  {
-    //   Serial.println(pch);// Debug which page has been requested
-    // Iterate through the pages list to find a name that matches
-    for(int page=0;page < sizeof(pages)/(sizeof(PROGMEM const char *)*NUMBER_OF_PAGE_ARRAY_ELEMENTS);page++)
+    else if (seg->variable!=NO_VARIABLE && cursor->offset-seg->length < variableLengths[seg->variable])
     {
-      if (strcmp_P(pch,(char*)pgm_read_word(&(pages[page][PAGE_NAME_INDEX])))==0)
-      {
-        foundPage=page;
-        break;
-      }
+      // Variable
+      n=min(variableLengths[seg->variable]-(cursor->offset-seg->length),(unsigned int)(maxChars-l));
+      outWrite(oStream,variables[seg->variable]+cursor->offset-seg->length,n);
+    }
+    else
+    {
+      cursor->segment++;
+      cursor->offset=0;
+      continue;
     }
+    cursor->offset+=n;
+    l+=n;
   }
+  return l;
+}
 
-
-// Send the response back to the module
-  serialPort->println(F("HTTP/1.1 200 OK"));
-  serialPort->print(F("Content-type: "));
-  printP(serialPort,(char*)pgm_read_word(&(pages[foundPage][PAGE_MIMETYPE_INDEX])));
-  serialPort->println();
-  serialPort->print(F("Content-length: "));
-  serialPort->println(buildPage(foundPage,variables),DEC);// pre build the page so we know its overall length including the variable substitution
-  serialPort->println();
-  buildPage(foundPage,variables,serialPort);// Send the actual page data including variable substitution
-  Serial.print("Senresponse");
-}
-
-// Helper function. sends a PROGMEM String to the serial port (Used to send the mimetype)
-void printP(Stream *serialPort,char * str)
-{
-char c;
-   while((c = pgm_read_byte(str++)))
-   {
-     serialPort->write(c);
-   }
+void startPage(PageCursor *cursor,int pageIndex)
+{
+  cursor->segment = pageFirstSegment[pageIndex];
+  cursor->endSegment = pageFirstSegment[pageIndex+1];
+  cursor->offset = 0;
+  cursor->gzipToken = 0;
 }
+
 /*
- * Function to fill (passed) receive buffer with data from the module until either the buffer is full or the pattern is matched
- * Note. Currently this function doesn't timeout.
+ * Compressed page functions. The tokens made by gzip_pages.py are turned into one deflate block using the fixed Huffman codes, between a gzip
+ * header and trailer. The bits are collected in the cursor, and each whole byte is added to the output buffer. If oStream is 0 the bytes are
+ * only counted, which is how the length of a compressed page is found.
  */
-boolean waitPattern(char *receiveBuffer, int receiveBufferLen, char *thePattern,Stream *inStream)
+void startGzipPage(PageCursor *cursor,Stream *oStream,const unsigned char *tokens)
 {
-char *patternPos = thePattern;
-char c;
+  cursor->gzipToken=tokens;
+  cursor->gzipRun=0;
+  cursor->gzipBits=0;
+  cursor->gzipBitCount=0;
+  cursor->gzipLength=GZIP_HEADER_SIZE;
+  cursor->crc=0xffffffffUL;
+  cursor->size=0;
+  if (oStream)
+  {
+    outWriteP(oStream,(const char*)gzipHeader,GZIP_HEADER_SIZE);
+  }
+  gzipBits(cursor,oStream,3,3);// last block, fixed Huffman codes
+}
 
-    receiveBufferLen--;// Allow space for zero termination
-    
-    while(*patternPos!=0 && receiveBufferLen>0)
+/*
+ * Sends the compressed page from the position in the cursor, in the same way as buildPage(), stopping before it could add more than maxBytes bytes.
+ * The gzip trailer is added at the end of the page. Returns true if there is more of the page to send.
+ */
+boolean buildGzipPage(PageCursor *cursor,Stream *oStream,unsigned int maxBytes)
+{
+  unsigned long endLength=cursor->gzipLength+maxBytes;
+  PageSegment *seg;
+  unsigned char token;
+  unsigned int distance;
+  char c;
+  
+  while (cursor->gzipLength+GZIP_MAX_CODE_BYTES<=endLength && cursor->segment<cursor->endSegment)
+  {
+    seg=&pageSegments[cursor->segment];
+    if (cursor->offset < seg->length)
     {
-      if  (inStream->available() && receiveBufferLen-->0)
+      if (cursor->gzipRun==0)
       {
-        c=inStream->read();
-        if (receiveBuffer)
-        {
-          *receiveBuffer++=c;
-        }
-        if (c==*patternPos)
-        {
-          patternPos++;
-        }
-        else
+        token=pgm_read_byte_near(cursor->gzipToken++);
+        if (token>=GZIP_COPY)
         {
-          patternPos = thePattern;// reset the pattern position pointer back to the start of the pattern
+          // Copy of earlier text
+          distance=pgm_read_byte_near(cursor->gzipToken) | ((unsigned int)pgm_read_byte_near(cursor->gzipToken+1)<<8);
+          cursor->gzipToken+=2;
+          gzipCopy(cursor,oStream,token-GZIP_COPY+3,gzipDistance(cursor,distance));
+          gzipAdvance(cursor,seg->text+cursor->offset,token-GZIP_COPY+3,true);
+          continue;
         }
+        cursor->gzipRun=token+1;
       }
-      
-      handleFlashLED();
+      // Fixed text, sent a character at a time
+      gzipLiteral(cursor,oStream,pgm_read_byte_near(seg->text+cursor->offset));
+      gzipAdvance(cursor,seg->text+cursor->offset,1,true);
+      cursor->gzipRun--;
     }
-    
-    if (*patternPos==0 && receiveBuffer)
+    else if (seg->variable!=NO_VARIABLE && cursor->offset-seg->length < variableLengths[seg->variable])
     {
-      *receiveBuffer=0;// terminate receive buffer
-      return true; // found the pattern
+      // Variable
+      c=variables[seg->variable][cursor->offset-seg->length];
+      gzipLiteral(cursor,oStream,c);
+      gzipAdvance(cursor,&c,1,false);
     }
     else
     {
-      return false;// did not find before we ran out of input buffer
+      cursor->segment++;
+      cursor->offset=0;
     }
+  }
+  if (cursor->segment<cursor->endSegment)
+  {
+    return true;
+  }
+  endGzipPage(cursor,oStream);
+  return false;
 }
 
-void handleFlashLED()
+// Ends the deflate block, and adds the CRC and length of the uncompressed page
+void endGzipPage(PageCursor *cursor,Stream *oStream)
 {
-     if (millis() - lastMillis > 500)
-     {
-        lastMillis=millis();
-        flashState = !flashState;
-        digitalWrite(RXLED, flashState);   // set the LED on
-/*
-#if defined(USART1_RX_vect)
-Serial.println("USART1_RX_vect");
-#endif
-*/
-     }
+  gzipCode(cursor,oStream,0,7);// end of block
+  gzipBits(cursor,oStream,0,(8-cursor->gzipBitCount)&7);// up to a whole byte
+  cursor->crc=~cursor->crc;
+  for(int i=0;i<32;i+=8)
+  {
+    gzipBits(cursor,oStream,(cursor->crc>>i)&0xff,8);
+  }
+  for(int i=0;i<32;i+=8)
+  {
+    gzipBits(cursor,oStream,(cursor->size>>i)&0xff,8);
+  }
 }
 
+// Returns the length of the compressed page, with the current values of the variables inserted, by building it without sending it
+unsigned long gzipPageLength(int pageIndex)
+{
+  PageCursor cursor;
+  
+  startPage(&cursor,pageIndex);
+  startGzipPage(&cursor,0,pageGzip[pageIndex]);
+  while(buildGzipPage(&cursor,0,OUT_BUFFER_SIZE))
+  {
+  }
+  return cursor.gzipLength;
+}
 
+// Adds characters of the page which have been sent to the CRC and length of the page, and moves the cursor past them
+void gzipAdvance(PageCursor *cursor,const char *data,int length,boolean inProgmem)
+{
+  cursor->crc=crcBytes(cursor->crc,data,length,inProgmem);
+  cursor->size+=length;
+  cursor->offset+=length;
+}
 
+// Returns how far back a copy is in the page as it is sent, by adding the lengths of the variables between the copy and where it is copied from
+unsigned int gzipDistance(PageCursor *cursor,unsigned int distance)
+{
+  unsigned char segment=cursor->segment;
+  unsigned int back=cursor->offset;
+  unsigned int sentDistance=distance;
+  
+  while(distance>back)
+  {
+    segment--;
+    back+=pageSegments[segment].length;
+    sentDistance+=variableLengths[pageSegments[segment].variable];// every segment before the last one has a variable
+  }
+  return sentDistance;
+}
 
-void setup() 
+void gzipLiteral(PageCursor *cursor,Stream *oStream,unsigned char c)
 {
-char buf[64];// Assume the HTTP request doesnt have any single line greater than 63 including the \r\n
+  if (c<144)
+  {
+    gzipCode(cursor,oStream,0x30+c,8);
+  }
+  else
+  {
+    gzipCode(cursor,oStream,0x190+c-144,9);
+  }
+}
 
-// initialize both serial ports:
-  Serial.begin(115200);// Debug to PC
-  Serial1.begin(115200);// This is serial port for the module
-   Serial1.flush();
-  pinMode(RXLED, OUTPUT);  // Set RX LED as an output
-  flashState=LOW;
-  digitalWrite(RXLED, flashState);   // set the LED on
+void gzipCopy(PageCursor *cursor,Stream *oStream,unsigned char length,unsigned int distance)
+{
+  int code=28;
+  unsigned int base;
   
-  pinMode(2,OUTPUT);
-  digitalWrite(2,LOW);
-  delay(10);
-  digitalWrite(2,HIGH);
-  lastMillis=millis();
+  while((base=pgm_read_byte_near(&deflateLengthBase[code]))>(unsigned int)(length-3))
+  {
+    code--;
+  }
+  if (code<23)
+  {
+    gzipCode(cursor,oStream,code+1,7);// length codes 257 to 279
+  }
+  else
+  {
+    gzipCode(cursor,oStream,0xc0+code-23,8);// length codes 280 to 285
+  }
+  if (code>=8 && code<28)
+  {
+    gzipBits(cursor,oStream,length-3-base,(code-4)/4);
+  }
   
+  code=29;
+  while((base=pgm_read_word(&deflateDistanceBase[code]))>distance)
+  {
+    code--;
+  }
+  gzipCode(cursor,oStream,code,5);
+  if (code>=4)
+  {
+    gzipBits(cursor,oStream,distance-base,code/2-1);
+  }
+}
 
+// Huffman codes are sent from their most significant bit, unlike other values
+void gzipCode(PageCursor *cursor,Stream *oStream,unsigned int code,unsigned char count)
+{
+  unsigned int reversed=0;
   
+  for(unsigned char i=0;i<count;i++)
+  {
+    reversed=(reversed<<1)|(code&1);
+    code>>=1;
+  }
+  gzipBits(cursor,oStream,reversed,count);
+}
 
-  Serial.println(F("Starting web server"));// Debug message
-
-   while(1)
-   {
-    
-     if (waitPattern(buf,sizeof(buf),"\r\n",&Serial1))// Assume that the request is a GET and its the first bit of data we receive
-     {
-      // Serial.print(F("Got buffer "));// Debug message
-      // Serial.print(buf);// Debug message
-      // Serial.print(F("Flushing "));// Debug message
-        // Check if this is a GET request
-        
-        waitPattern((char *)0,999999,"\r\n\r\n",&Serial1);// purge all other incomming data from the browser until \r\n\r\n
-        
-        if (!strncmp(buf,"GET",3))
-        {
-          // Yes. Its a GET
-        //  Serial.print("GET");
-         //   Serial.println(buf);
-           
-
-            // flush the rest of the input buffer
-            while(Serial1.available() && true)
-            {
-              Serial1.read();
-            }
-            Serial1.flush(); // flush both input an output. Mainly flushing the input, in case the module has not finished sending all data from the browser (client) before we finish sending the page back. (Probably not needed)
-
-            sendPageResponse(buf,&Serial1);// Send response specific to the GET reuest
+void gzipBits(PageCursor *cursor,Stream *oStream,unsigned int bits,unsigned char count)
+{
+  char c;
+  
+  cursor->gzipBits|=(unsigned long)bits<<cursor->gzipBitCount;
+  cursor->gzipBitCount+=count;
+  while(cursor->gzipBitCount>=8)
+  {
+    if (oStream)
+    {
+      c=cursor->gzipBits;
+      outWrite(oStream,&c,1);
+    }
+    cursor->gzipLength++;
+    cursor->gzipBits>>=8;
+    cursor->gzipBitCount-=8;
+  }
+}
 
+uint32_t crcBytes(uint32_t crc,const char *data,int length,boolean inProgmem)
+{
+  while(length--)
+  {
+    crc ^= (unsigned char)(inProgmem ? pgm_read_byte_near(data) : *data);
+    crc = pgm_read_dword(&crcTable[crc&0x0f]) ^ (crc>>4);
+    crc = pgm_read_dword(&crcTable[crc&0x0f]) ^ (crc>>4);
+    data++;
+  }
+  return crc;
+}
 
-        }
-     }  
-   }
+// Returns the index in the pages array of the page with the given name, or PAGE_NOT_FOUND
+int findPage(const char *pageName)
+{
+  int low=0;
+  int high=NUMBER_OF_PAGES-1;
+  int middle;
+  int comparison;
+  
+  while(low<=high)
+  {
+    middle=(low+high)/2;
+    comparison=strcmp_P(pageName,(char*)pgm_read_word(&(pages[middle][PAGE_NAME_INDEX])));
+    if (comparison==0)
+    {
+      return middle;
+    }
+    if (comparison<0)
+    {
+      high=middle-1;
+    }
+    else
+    {
+      low=middle+1;
+    }
+  }
+  return PAGE_NOT_FOUND;
+}
 
+// Checks that the pages array is in alphabetical order of page name, as findPage() can't find pages which are out of order
+void checkPageOrder()
+{
+  char previousName[32];
+  
+  for(unsigned int page=1;page<NUMBER_OF_PAGES;page++)
+  {
+    strncpy_P(previousName,(char*)pgm_read_word(&(pages[page-1][PAGE_NAME_INDEX])),sizeof(previousName));
+    previousName[sizeof(previousName)-1]=0;
+    if (strcmp_P(previousName,(char*)pgm_read_word(&(pages[page][PAGE_NAME_INDEX])))>=0)
+    {
+      Serial.print(F("Pages are not in alphabetical order at "));// Debug message
+      Serial.println(previousName);
+    }
+  }
 }
 
-void serialEvent1()
+// Sets the value of one of the variables used on the pages, from the snapshot the response is using
+void formatVariable(int index)
 {
-  Serial.println("serial1Event");
+  if (index==0)
+  {
+    if (requestedPin==-1)
+    {
+      sprintf(variables[0],"%ld",responseSnapshot->millis);// Put the value of the Millis in variable [0]
+    }
+    else if (requestedPin>=0 && requestedPin<NUMBER_OF_ANALOG_INPUTS)
+    {
+      sprintf(variables[0],"%d",responseSnapshot->analogValues[requestedPin]);// The pin from the query string
+    }
+    else
+    {
+      variables[0][0]=0;// not one of the inputs in the snapshot
+    }
+  }
+  else
+  {
+    sprintf(variables[index],"%d",responseSnapshot->analogValues[index-1]);// Put the value of analog 1 into variable [1] etc
+  }
+  variableLengths[index]=strlen(variables[index]);
 }
-void serialEvent()
+
+// Adds the status line of the response, and the Connection header if the connection isn't going to be kept open as normal for the HTTP version
+void outPrintStatus(Stream *serialPort,char *status)
 {
-  Serial.print("serialEvent");
+  outPrintP(serialPort,PSTR("HTTP/1.1 "));
+  outPrintP(serialPort,status);
+  outPrintP(serialPort,PSTR("\r\n"));
+  if (!keepAlive)
+  {
+    outPrintP(serialPort,PSTR("Connection: close\r\n"));
+  }
+  else if (!http11)
+  {
+    outPrintP(serialPort,PSTR("Connection: keep-alive\r\n"));
+  }
 }
 
-void loop() {
-  // Everything is done in setup ! Its probably faster !
+void outPrintCacheHeaders(Stream *serialPort,char *etag,boolean hasVariables)
+{
+  outPrintP(serialPort,PSTR("ETag: "));
+  outWrite(serialPort,etag,strlen(etag));
+  if (hasVariables)
+  {
+    outPrintP(serialPort,PSTR("\r\nCache-Control: no-cache\r\n"));
+  }
+  else
+  {
+    outPrintP(serialPort,PSTR("\r\nCache-Control: max-age=" STATIC_CACHE_SECONDS "\r\n"));
+  }
 }
 
+/*
+ * Sends a response with no page, just the status line e.g. 404 Not Found
+ * status is in PROGMEM
+ */
+void sendErrorResponse(char *status,Stream *serialPort)
+{
+  outPrintStatus(serialPort,status);
+  outPrintP(serialPort,PSTR("Content-type: text/html\r\nContent-length: "));
+  outPrintNumber(serialPort,strlen_P(error_htm_start)+strlen_P(status)+strlen_P(error_htm_end));
+  outPrintP(serialPort,PSTR("\r\n\r\n"));
+  outPrintP(serialPort,error_htm_start);
+  outPrintP(serialPort,status);
+  outPrintP(serialPort,error_htm_end);
+  responseCursor.segment=responseCursor.endSegment=0;// nothing more to send after the output buffer
+}
 
+/*
+ * Returns the analog input number given by the pin query string parameter, which can be e.g. 3, A3, a3 or 17 (the pin number of A3),
+ * or INVALID_PIN if it isn't a number
+ */
+int parsePin(const char *text)
+{
+  int pin=0;
+  boolean analog = (*text=='A' || *text=='a');
+  
+  if (analog)
+  {
+    text++;
+  }
+  if (*text==0 || strlen(text)>3)
+  {
+    return INVALID_PIN;
+  }
+  for(;*text;text++)
+  {
+    if (*text<'0' || *text>'9')
+    {
+      return INVALID_PIN;
+    }
+    pin=pin*10+(*text-'0');
+  }
+  if (!analog && pin>=A0)
+  {
+    pin-=A0;
+  }
+  return pin;
+}
+
+/*
+ * Sets up the body of the request, which isn't used, to be skipped before the next request is read. Returns false if the length of the body
+ * isn't known e.g. it is sent with Transfer-Encoding: chunked, in which case input is dropped until the module stops sending
+ */
+boolean setBodyLength()
+{
+  char *contentLength=requestHeader(HEADER_CONTENT_LENGTH);
+  char *p;
+  
+  bodyRemaining=0;
+  if (requestHeader(HEADER_TRANSFER_ENCODING))
+  {
+    discardInput=true;
+  }
+  else if (contentLength)
+  {
+    for(p=contentLength;*p>='0' && *p<='9' && bodyRemaining<100000000UL;p++)
+    {
+      bodyRemaining=bodyRemaining*10+(*p-'0');
+    }
+    if (p==contentLength || *p!=0)
+    {
+      bodyRemaining=0;
+      discardInput=true;// not a number, or too big
+    }
+  }
+  lastDiscardMillis=millis();
+  return !discardInput;
+}
+
+/*
+ * Function to determine what page is required
+ * populate appropriate variables array
+ * and send the header. The page itself is sent by sendResponseSlice()
+ */
+void sendPageResponse(Stream *serialPort)
+{
+  const char *pageName=requestPart(request.path);
+  char *pin=requestParam(PARAM_PIN);
+  char *connection=requestHeader(HEADER_CONNECTION);
+  char *ifNoneMatch=requestHeader(HEADER_IF_NONE_MATCH);
+  char *acceptEncoding=requestHeader(HEADER_ACCEPT_ENCODING);
+  char etag[11];
+  uint32_t hash;
+  int foundPage;
+  boolean chunked;
+  boolean hasVariables;
+  boolean gzip;
+  
+  // HTTP/1.1 connections are kept open unless the browser says otherwise. HTTP/1.0 connections are closed unless the browser asks for keep-alive
+  http11=!strcmp(requestPart(request.version),"HTTP/1.1");
+  if (http11)
+  {
+    keepAlive = !(connection && !strncasecmp(connection,"close",5));
+  }
+  else
+  {
+    keepAlive = connection && !strncasecmp(connection,"keep-alive",10);
+  }
+  if (!setBodyLength())
+  {
+    keepAlive=false;// the next request can't be found, so the browser is asked to use a new connection
+  }
+  chunked=CHUNKED_RESPONSES && http11;// HTTP/1.0 browsers don't understand chunked responses
+  responseCursor.gzipToken=0;
+  
+  requestCount++;
+  if (request.tooLong)
+  {
+    sendErrorResponse(PSTR("414 Request-URI Too Long"),serialPort);
+    return;
+  }
+  if (strcmp(requestPart(request.method),"GET"))
+  {
+    sendErrorResponse(PSTR("501 Not Implemented"),serialPort);
+    return;
+  }
+  
+  requestedPin = pin ? parsePin(pin) : -1;
+  if (requestedPin==INVALID_PIN)
+  {
+    sendErrorResponse(PSTR("400 Bad Request"),serialPort);
+    return;
+  }
+  responseSnapshot=latestSnapshot;
+  if (*pageName==0)
+  {
+    pageName=DEFAULT_PAGE_NAME;
+  }
+  //   Serial.println(pageName);// Debug which page has been requested
+  foundPage=findPage(pageName);
+  if (foundPage==PAGE_NOT_FOUND)
+  {
+    sendErrorResponse(PSTR("404 Not Found"),serialPort);
+    return;
+  }
+
+  hasVariables=pageHasVariables(foundPage);
+  gzip=pageGzip[foundPage] && acceptEncoding && strstr(acceptEncoding,"gzip");
+  // Setup all the variables that will be used on the page, as the ETag, the length of the page and the copies in a compressed page depend on them.
+  // They all come from responseSnapshot, so they have the same values as if they were given them as the page is sent
+  for(int i=0;i<NUMBER_OF_VARIABLES;i++)
+  {
+    if (pageVariables[foundPage] & (1U<<i))
+    {
+      formatVariable(i);
+    }
+  }
+  
+  hash=pageETag(foundPage);
+  if (gzip)
+  {
+    hash=hashBytes(hash,"gzip",4,false);// the compressed page needs a different ETag
+  }
+  sprintf(etag,"\"%08lx\"",(unsigned long)hash);
+  if (ifNoneMatch && (!strcmp(ifNoneMatch,"*") || strstr(ifNoneMatch,etag)))
+  {
+    // The browser already has this version of the page
+    outPrintStatus(serialPort,PSTR("304 Not Modified"));
+    outPrintCacheHeaders(serialPort,etag,hasVariables);
+    if (pageGzip[foundPage])
+    {
+      outPrintP(serialPort,PSTR("Vary: Accept-Encoding\r\n"));
+    }
+    outPrintP(serialPort,PSTR("\r\n"));
+    responseCursor.segment=responseCursor.endSegment=0;// nothing more to send after the output buffer
+    return;
+  }
+
+// Send the response back to the module
+  outPrintStatus(serialPort,PSTR("200 OK"));
+  outPrintCacheHeaders(serialPort,etag,hasVariables);
+  if (pageGzip[foundPage])
+  {
+    outPrintP(serialPort,PSTR("Vary: Accept-Encoding\r\n"));// caches must not send the compressed page to browsers which didn't ask for it
+  }
+  outPrintP(serialPort,PSTR("Content-type: "));
+  outPrintP(serialPort,(char*)pgm_read_word(&(pages[foundPage][PAGE_MIMETYPE_INDEX])));
+  if (gzip)
+  {
+    outPrintP(serialPort,PSTR("\r\nContent-Encoding: gzip"));
+  }
+  if (chunked)
+  {
+    outPrintP(serialPort,PSTR("\r\nTransfer-Encoding: chunked\r\n\r\n"));
+    outFlush(serialPort);// The header isn't part of the first chunk
+    outChunked=true;
+    outLength=CHUNK_HEADER_SIZE;
+  }
+  else
+  {
+    outPrintP(serialPort,PSTR("\r\nContent-length: "));
+    outPrintNumber(serialPort,gzip ? gzipPageLength(foundPage) : pageLength(foundPage));// the overall length of the page including the variable substitution
+    outPrintP(serialPort,PSTR("\r\n\r\n"));
+  }
+  startPage(&responseCursor,foundPage);// The actual page data including variable substitution is sent by sendResponseSlice(), along with the header
+  if (gzip)
+  {
+    startGzipPage(&responseCursor,serialPort,pageGzip[foundPage]);
+  }
+}
+
+// Sends the next output buffer full of the page. Returns false once the whole page has been sent
+boolean sendResponseSlice(Stream *serialPort)
+{
+  int space=outSpace();
+  boolean more;
+  
+  if (responseCursor.gzipToken)
+  {
+    more=buildGzipPage(&responseCursor,serialPort,space);
+  }
+  else
+  {
+    more=buildPage(&responseCursor,serialPort,space)==space;
+  }
+  outFlush(serialPort);
+  if (!more && outChunked)
+  {
+    outChunked=false;
+    outLength=0;
+    outPrintP(serialPort,PSTR("0\r\n\r\n"));// zero length chunk at the end of the page
+    outFlush(serialPort);
+  }
+  return more;
+}
+
+/*
+ * Output buffer functions. Data for the module is copied into outBuffer, using memcpy_P for data in PROGMEM, 
+ * and is sent with a single write() when the buffer is full or outFlush() is called.
+ * When sending chunks, the start and end of the buffer are kept free for the chunk length and the \r\n after the chunk.
+ */
+int outSpace()
+{
+  return (outChunked ? OUT_BUFFER_SIZE-CHUNK_TRAILER_SIZE : OUT_BUFFER_SIZE) - outLength;
+}
+
+void outCopy(Stream *serialPort,const char *data,int length,boolean inProgmem)
+{
+  int n;
+  
+  while(length>0)
+  {
+    n=min(length,outSpace());
+    if (inProgmem)
+    {
+      memcpy_P(outBuffer+outLength,data,n);
+    }
+    else
+    {
+      memcpy(outBuffer+outLength,data,n);
+    }
+    outLength+=n;
+    data+=n;
+    length-=n;
+    if (outSpace()==0)
+    {
+      outFlush(serialPort);
+    }
+  }
+}
+
+void outWrite(Stream *serialPort,const char *data,int length)
+{
+  outCopy(serialPort,data,length,false);
+}
+
+void outWriteP(Stream *serialPort,const char *data,int length)
+{
+  outCopy(serialPort,data,length,true);
+}
+
+// Helper function. Adds a PROGMEM String to the output (Used to send the header and the mimetype)
+void outPrintP(Stream *serialPort,const char *str)
+{
+  outCopy(serialPort,str,strlen_P(str),true);
+}
+
+void outPrintNumber(Stream *serialPort,long number)
+{
+  char buf[12];
+  
+  ltoa(number,buf,10);
+  outCopy(serialPort,buf,strlen(buf),false);
+}
+
+void outFlush(Stream *serialPort)
+{
+  char *start=outBuffer;
+  int n;
+  
+  if (outChunked)
+  {
+    n=outLength-CHUNK_HEADER_SIZE;
+    if (n==0)
+    {
+      return;// a zero length chunk would end the page
+    }
+    // Put the length in hex immediately before the data, and the \r\n after it
+    start+=CHUNK_HEADER_SIZE;
+    *--start='\n';
+    *--start='\r';
+    do
+    {
+      *--start="0123456789abcdef"[n&0x0f];
+      n>>=4;
+    } while (n);
+    outBuffer[outLength++]='\r';
+    outBuffer[outLength++]='\n';
+  }
+  if (outLength)
+  {
+    serialPort->write((uint8_t *)start,outLength-(start-outBuffer));
+  }
+  outLength=outChunked ? CHUNK_HEADER_SIZE : 0;
+}
+/*
+ * Request parser functions
+ * The parts of the request line are saved in requestBuffer one after another, each followed by a null, so they can be used as strings.
+ * Query string parameter names are only kept until they have been looked up in paramNames, and the values of unknown parameters aren't kept,
+ * so a long query string only takes up as much space as the values that are used. Request headers are handled in the same way.
+ */
+void startRequest()
+{
+  memset(&request,0,sizeof(request));
+  requestLength=0;
+  partStart=0;
+}
+
+// Adds a character to the part of the request being read. Returns false if the buffer is full, in which case the character is dropped
+boolean saveRequestChar(char c)
+{
+  if (requestLength < REQUEST_BUFFER_SIZE-1)
+  {
+    requestBuffer[requestLength++]=c;
+    return true;
+  }
+  return false;
+}
+
+// Adds a character to the request line. If it doesn't fit, the request is marked as too long
+void saveRequestLineChar(char c)
+{
+  if (!saveRequestChar(c))
+  {
+    request.tooLong=true;
+  }
+}
+
+// Null terminates the part of the request being read, and returns its position. The next part starts after the null
+Span endRequestPart()
+{
+  Span span;
+  
+  span.start=partStart;
+  span.length=requestLength-partStart;
+  requestBuffer[requestLength]=0;
+  if (requestLength < REQUEST_BUFFER_SIZE-1)
+  {
+    requestLength++;
+  }
+  partStart=requestLength;
+  return span;
+}
+
+// Looks up the name which has been read in a PROGMEM array of names, then drops it from the buffer. Returns its index in the array, or -1
+int endName(const char **names,int numberOfNames)
+{
+  int found=-1;
+  
+  requestBuffer[requestLength]=0;
+  for(int i=0;i<numberOfNames;i++)
+  {
+    if (!strcasecmp_P(requestBuffer+partStart,(char*)pgm_read_word(&names[i])))
+    {
+      found=i;
+      break;
+    }
+  }
+  requestLength=partStart;
+  return found;
+}
+
+// Keeps the value which has been read in the spans array if its name was found, or drops it from the buffer if not
+void endValue(Span *spans,int index)
+{
+  Span span=endRequestPart();
+  
+  if (index==-1)
+  {
+    requestLength=partStart=span.start;
+  }
+  else
+  {
+    spans[index]=span;
+  }
+}
+
+// Ends the part of the request line being read, at a space, & or the end of the line
+void endRequestLinePart()
+{
+  switch(requestState)
+  {
+    case readingMethod:
+      request.method=endRequestPart();
+      break;
+    case readingPath:
+      request.path=endRequestPart();
+      break;
+    case readingParamName:
+      currentParam=endName(paramNames,NUMBER_OF_PARAMS);// parameter without a value
+      // fall through
+    case readingParamValue:
+      endValue(request.params,currentParam);
+      break;
+    case readingVersion:
+      request.version=endRequestPart();
+      break;
+    default:
+      break;
+  }
+}
+
+/*
+ * Parses the next character of the request. Returns true when the blank line at the end of the request headers is reached, after which
+ * the state is requestComplete, and the parser must not be called again until the state has been set back to waiting.
+ * Lines can end with \r\n or \n. Null characters are dropped, as they would end the part they were in early.
+ */
+boolean parseRequestChar(char c)
+{
+  if (c=='\r' || c==0)
+  {
+    return false;
+  }
+  if (c=='\n' && requestState>=readingMethod && requestState<=readingVersion)
+  {
+    // End of the request line. Anything not read yet e.g. a missing HTTP version, is left empty
+    endRequestLinePart();
+    headerLineLength=0;
+    requestState=readingHeaderName;
+    return false;
+  }
+  
+  switch(requestState)
+  {
+    case waiting:
+      if (c=='\n')
+      {
+        return false;// blank lines before the request are ignored
+      }
+      startRequest();
+      requestState=readingMethod;
+      // fall through
+    case readingMethod:
+      if (c==' ')
+      {
+        endRequestLinePart();
+        requestState=readingPath;
+      }
+      else
+      {
+        saveRequestLineChar(c);
+      }
+      break;
+    case readingPath:
+      if (c=='?' || c==' ')
+      {
+        endRequestLinePart();
+        requestState = (c=='?') ? readingParamName : readingVersion;
+      }
+      else if (c!='/' || requestLength!=partStart)
+      {
+        saveRequestLineChar(c);// The leading / isn't saved, so the path is the page name
+      }
+      break;
+    case readingParamName:
+    case readingParamValue:
+      if (c=='&' || c==' ')
+      {
+        endRequestLinePart();
+        requestState = (c=='&') ? readingParamName : readingVersion;
+      }
+      else if (c=='=' && requestState==readingParamName)
+      {
+        currentParam=endName(paramNames,NUMBER_OF_PARAMS);
+        requestState=readingParamValue;
+      }
+      else
+      {
+        saveRequestLineChar(c);
+      }
+      break;
+    case readingVersion:
+      saveRequestLineChar(c);
+      break;
+    case readingHeaderName:
+      if (c=='\n')
+      {
+        requestLength=partStart;// drop the line if it didn't have a :
+        if (headerLineLength==0)
+        {
+          requestState=requestComplete;
+          return true;// blank line
+        }
+        headerLineLength=0;
+      }
+      else if (c==':')
+      {
+        currentHeader=endName(headerNames,NUMBER_OF_HEADERS);
+        requestState=readingHeaderValue;
+      }
+      else
+      {
+        headerLineLength++;
+        saveRequestChar(c);// A name which doesn't fit won't be found
+      }
+      break;
+    case readingHeaderValue:
+      if (c=='\n')
+      {
+        endValue(request.headers,currentHeader);
+        headerLineLength=0;
+        requestState=readingHeaderName;
+      }
+      else if (currentHeader!=-1 && (c!=' ' || requestLength!=partStart))
+      {
+        saveRequestChar(c);// Values which don't fit are cut short. Spaces after the : are skipped
+      }
+      break;
+    default:
+      break;
+  }
+  return false;
+}
+
+// Returns part of the request as a string. A part which wasn't in the request e.g. the version of "GET /", is empty, rather than
+// the method at the start of requestBuffer
+char *requestPart(Span span)
+{
+  return span.length ? requestBuffer+span.start : (char *)"";
+}
+
+// Returns the value of a query string parameter, or null if it wasn't in the request
+char *requestParam(int param)
+{
+  return request.params[param].start ? requestPart(request.params[param]) : (char *)0;
+}
+
+// Returns the value of a request header, or null if it wasn't in the request
+char *requestHeader(int header)
+{
+  return request.headers[header].start ? requestPart(request.headers[header]) : (char *)0;
+}
+
+/*
+ * Task which reads the request from the module as it arrives, and sends the response a slice at a time.
+ * The next request is read while the response is being sent, but isn't answered until the response has been sent. Anything after it is left in the
+ * serial port buffer until then.
+ */
+void httpTask()
+{
+  if (responseInProgress)
+  {
+    responseInProgress=sendResponseSlice(&Serial1);
+  }
+  
+  while(requestState!=requestComplete && Serial1.available())
+  {
+    char c=Serial1.read();
+    
+    if (bodyRemaining)
+    {
+      bodyRemaining--;// the body of the last request
+    }
+    else if (discardInput)
+    {
+      lastDiscardMillis=millis();
+    }
+    else if (parseRequestChar(c) && responseInProgress)
+    {
+      pipelinedCount++;
+    }
+  }
+  if (discardInput && millis()-lastDiscardMillis >= DISCARD_IDLE_MILLIS)
+  {
+    discardInput=false;
+  }
+  
+  if (requestState==requestComplete && !responseInProgress)
+  {
+    sendPageResponse(&Serial1);// Send response specific to the reuest
+    requestState=waiting;// the request has been used, so the next one can be read
+    responseInProgress=true;
+  }
+}
+
+// Task which reads all the analog inputs into the snapshot which the response being sent isn't using, then makes it the latest snapshot
+void sampleTask()
+{
+  Snapshot *snapshot = (responseSnapshot==&snapshots[0]) ? &snapshots[1] : &snapshots[0];
+  
+  snapshot->millis=millis();
+  for(int i=0;i<NUMBER_OF_ANALOG_INPUTS;i++)
+  {
+    snapshot->analogValues[i]=analogRead(A0+i);
+  }
+  latestSnapshot=snapshot;
+  sampleCount++;
+}
+
+void heartbeatTask()
+{
+  flashState = !flashState;
+  digitalWrite(RXLED, flashState);   // set the LED on
+}
+
+void statsTask()
+{
+  Serial.print(F("Requests "));
+  Serial.print(requestCount);
+  Serial.print(F(", pipelined "));
+  Serial.print(pipelinedCount);
+  Serial.print(F(", samples/sec "));
+  Serial.print(sampleCount*1000/STATS_TASK_INTERVAL);
+  Serial.print(F(", longest task "));
+  Serial.print(longestTaskMillis);
+  Serial.println(F("ms"));
+  sampleCount=0;
+  longestTaskMillis=0;
+}
+
+Task tasks[] =
+{
+  {httpTask,HTTP_TASK_INTERVAL,0},
+  {sampleTask,SAMPLE_TASK_INTERVAL,0},
+  {heartbeatTask,HEARTBEAT_TASK_INTERVAL,0},
+  {statsTask,STATS_TASK_INTERVAL,0}
+};
+
+void setup() 
+{
+// initialize both serial ports:
+  Serial.begin(115200);// Debug to PC
+  Serial1.begin(115200);// This is serial port for the module
+   Serial1.flush();
+  pinMode(RXLED, OUTPUT);  // Set RX LED as an output
+  flashState=LOW;
+  digitalWrite(RXLED, flashState);   // set the LED on
+  
+  pinMode(2,OUTPUT);
+  digitalWrite(2,LOW);
+  delay(10);
+  digitalWrite(2,HIGH);
+
+  compilePages();
+  checkPageOrder();
+  sampleTask();// so there are readings for the first request
+  Serial.println(F("Starting web server"));// Debug message
+}
+
+// Runs each task which is due. A task's next run is timed from when its last run was due, so it keeps to its interval on average
+void loop() 
+{
+  unsigned long now;
+  
+  for(unsigned int i=0;i<sizeof(tasks)/sizeof(Task);i++)
+  {
+    now=millis();
+    if (now - tasks[i].lastRun >= tasks[i].interval)
+    {
+      tasks[i].lastRun = (tasks[i].interval && now - tasks[i].lastRun < 2*tasks[i].interval) ? tasks[i].lastRun+tasks[i].interval : now;
+      tasks[i].run();
+      if (millis()-now > longestTaskMillis)
+      {
+        longestTaskMillis=millis()-now;
+      }
+    }
+  }
+}
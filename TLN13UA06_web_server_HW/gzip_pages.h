@@ -0,0 +1,30 @@
+// Compressed copies of the pages of TLN13UA06_web_server_HW.ino, made by gzip_pages.py. Don't edit this file, run gzip_pages.py again after
+// changing any of the pages.
+// Each page is a list of tokens, which buildGzipPage() turns into a deflate stream. 0-127 is a run of that number plus one
+// characters of the page. 128-255 is a copy of that number less 125 characters, from earlier in the page, and is followed by how
+// far back they are, not counting the variables, in two bytes (low byte first).
+
+// index.htm, about 219 bytes sent as 165
+prog_uchar index_htm_gzip[] PROGMEM =
+{
+  0x0f,0x84,0x06,0x00,0x05,0x83,0x07,0x00,0x03,0x80,0x13,0x00,0x0c,0x80,0x1c,0x00,
+  0x00,0x82,0x14,0x00,0x0b,0x21,0x00,0x80,0x55,0x00,0x82,0x24,0x00,0x00,0x8e,0x41,
+  0x00,0x00,0x80,0x41,0x00,0x8e,0x15,0x00,0x00,0x80,0x15,0x00,0x8e,0x15,0x00,0x00,
+  0x80,0x15,0x00,0x83,0x15,0x00,0x00,0x82,0x9b,0x00
+};
+
+// jsondata.htm, about 181 bytes sent as 102
+prog_uchar jsondata_json_gzip[] PROGMEM =
+{
+  0x19,0x81,0x14,0x00,0x01,0x87,0x1f,0x00,0x01,0x88,0x19,0x00,0x8a,0x19,0x00,0x00,
+  0x88,0x19,0x00,0x8a,0x19,0x00,0x00,0x88,0x19,0x00,0x8a,0x19,0x00,0x00,0x88,0x19,
+  0x00,0x8a,0x19,0x00,0x00,0x88,0x19,0x00,0x01
+};
+
+// Data of each page that has a compressed copy, the hash of the data it was made from, and the copy
+PROGMEM const GzipPage gzipPages[] =
+{
+  {index_htm,0x364928d1UL,index_htm_gzip},
+  {jsondata_json,0x71ac35b4UL,jsondata_json_gzip}
+};
+#define NUMBER_OF_GZIP_PAGES (sizeof(gzipPages)/sizeof(gzipPages[0]))
@@ -0,0 +1,207 @@
+#!/usr/bin/env python
+"""
+Makes gzip_pages.h, the compressed copies of the pages of TLN13UA06_web_server_HW.ino
+
+By Roger Clark
+
+Run this after changing any of the pages, from the sketch folder:   python gzip_pages.py
+The sketch ignores the compressed copy of a page which has been changed since, and sends it uncompressed instead.
+
+The pages can't simply be gzipped, because the variables are only known when the page is sent. So each page is compressed
+into a list of tokens, which are either a run of characters from the page, or a copy of characters from earlier in the page.
+The sketch turns the tokens into a deflate stream (RFC 1951) using the fixed Huffman codes as the page is sent, putting the
+characters of the variables in as they come, and adding their lengths to the distances of copies which reach back past them.
+
+Tokens are never split by a variable, and copies are never taken from text which has a variable in it, so the tokens
+are the same whatever the values of the variables. Pages which don't get any smaller when compressed are left out.
+"""
+
+import os
+import re
+import sys
+
+SKETCH = 'TLN13UA06_web_server_HW.ino'
+OUTPUT = 'gzip_pages.h'
+
+MAX_RUN = 128             # characters in a run token 0-127
+MAX_COPY = 130            # characters in a copy token 128-255
+MAX_DISTANCE = 32768      # furthest back a deflate stream can copy from
+VARIABLE_MAX_LENGTH = 15  # STRLEN_OF_VARIABLES in the sketch, less the null
+VARIABLE_LENGTH = 4       # typical variable length, used to choose the tokens and estimate the compressed length
+HASH_START = 2166136261   # FNV-1a, as hashBytes() in the sketch
+HASH_PRIME = 16777619
+
+# Deflate length and distance codes
+LENGTH_BASE = [3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258]
+LENGTH_EXTRA = [0] * 8 + [1] * 4 + [2] * 4 + [3] * 4 + [4] * 4 + [5] * 4 + [0]
+DISTANCE_BASE = [1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577]
+DISTANCE_EXTRA = [max(0, code // 2 - 1) for code in range(30)]
+
+ESCAPES = {'a': 7, 'b': 8, 't': 9, 'n': 10, 'v': 11, 'f': 12, 'r': 13, '"': 34, "'": 39, '\\': 92, '?': 63}
+
+
+def c_string(literal):
+    """Returns the bytes of a C string literal, including its quotes"""
+    data = bytearray()
+    i = 1
+    while i < len(literal) - 1:
+        if literal[i] == '\\':
+            m = re.match(r'[0-7]{1,3}|x[0-9a-fA-F]+', literal[i + 1:])
+            if m:
+                digits = m.group(0)
+                data.append(int(digits[1:], 16) if digits[0] == 'x' else int(digits, 8))
+                i += 1 + len(digits)
+            else:
+                data.append(ESCAPES[literal[i + 1]])
+                i += 2
+        else:
+            data.append(ord(literal[i]))
+            i += 1
+    return bytes(data)
+
+
+def read_sketch(source):
+    """Returns the prog_char strings of the sketch by name, and the (page name, page data) pairs of the pages array"""
+    tokens = re.compile(r'"(?:\\.|[^"\\])*"|//[^\n]*|/\*.*?\*/|\s+|.', re.S)
+    strings = {}
+    for m in re.finditer(r'prog_char\s+(\w+)\[\]\s*PROGMEM\s*=', source):
+        data = b''
+        for t in tokens.finditer(source, m.end()):
+            text = t.group(0)
+            if text.startswith('"'):
+                data += c_string(text)
+            elif text == ';':
+                break
+            elif not (text.isspace() or text.startswith('//') or text.startswith('/*')):
+                raise ValueError('%s is not a string' % m.group(1))
+        strings[m.group(1)] = data
+    table = re.search(r'\*pages\[\]\[NUMBER_OF_PAGE_ARRAY_ELEMENTS\]\s*=\s*\{(.*?)\};', source, re.S)
+    pages = [(strings[name].decode('latin-1'), data)
+             for name, data in re.findall(r'\{\s*(\w+)\s*,\s*(\w+)\s*,\s*\w+\s*\}', table.group(1))]
+    return strings, pages
+
+
+def fnv_hash(data):
+    h = HASH_START
+    for c in bytearray(data):
+        h = ((h ^ c) * HASH_PRIME) & 0xffffffff
+    return h
+
+
+def literal_bits(c):
+    return 8 if c < 144 else 9
+
+
+def copy_bits(length, distance):
+    code = max(i for i in range(29) if LENGTH_BASE[i] <= length)
+    d = max(i for i in range(30) if DISTANCE_BASE[i] <= distance)
+    return (7 if code < 23 else 8) + LENGTH_EXTRA[code] + 5 + DISTANCE_EXTRA[d]
+
+
+def compress(data):
+    """
+    Splits the page data into segments as compilePages() does, and chooses the tokens which give the fewest bits.
+    Returns the tokens as bytes, and the estimated lengths of the page uncompressed and compressed
+    """
+    parts = re.split(b'\x07([0-9]+)\x07', data)
+    texts = parts[0::2]
+    variables = len(parts) // 2
+    template = bytearray(b''.join(texts))
+    n = len(template)
+    segment = []
+    segment_end = []
+    for i, text in enumerate(texts):
+        segment += [i] * len(text)
+        segment_end += [len(segment)] * len(text)
+
+    # Cheapest way to send the rest of the page from each position, working back from the end
+    cost = [0] * (n + 1)
+    choice = [0] * (n + 1)
+    earlier = {}
+    for i in range(n):
+        earlier.setdefault(bytes(template[i:i + 3]), []).append(i)
+    for i in range(n - 1, -1, -1):
+        cost[i] = literal_bits(template[i]) + cost[i + 1]
+        choice[i] = 1
+        for j in reversed(earlier.get(bytes(template[i:i + 3]), [])):
+            if j >= i:
+                continue
+            between = segment[i] - segment[j]  # variables between the copy and where it comes from
+            if i - j + between * VARIABLE_MAX_LENGTH > MAX_DISTANCE:
+                break
+            limit = min(MAX_COPY, segment_end[i] - i, segment_end[j] - j)
+            length = 0
+            while length < limit and template[j + length] == template[i + length]:
+                length += 1
+            for l in range(3, length + 1):
+                bits = copy_bits(l, i - j + between * VARIABLE_LENGTH) + cost[i + l]
+                if bits < cost[i]:
+                    cost[i] = bits
+                    choice[i] = (l, i - j)
+
+    tokens = bytearray()
+    run = 0
+    i = 0
+    while i < n:
+        if choice[i] == 1:
+            if run and (run == MAX_RUN or segment[i] != segment[i - 1]):
+                tokens.append(run - 1)
+                run = 0
+            run += 1
+            i += 1
+        else:
+            if run:
+                tokens.append(run - 1)
+                run = 0
+            length, distance = choice[i]
+            tokens += bytearray([length - 3 + 128, distance & 0xff, distance >> 8])
+            i += length
+    if run:
+        tokens.append(run - 1)
+
+    # Block header, tokens, variables and end of block, plus the gzip header and trailer
+    bits = 3 + cost[0] + variables * VARIABLE_LENGTH * 8 + 7
+    return bytes(tokens), n + variables * VARIABLE_LENGTH, (bits + 7) // 8 + 18
+
+
+def main():
+    folder = os.path.dirname(os.path.abspath(__file__))
+    with open(os.path.join(folder, SKETCH)) as f:
+        strings, pages = read_sketch(f.read())
+
+    out = ['// Compressed copies of the pages of ' + SKETCH + ', made by gzip_pages.py. Don\'t edit this file, run gzip_pages.py again after',
+           '// changing any of the pages.',
+           '// Each page is a list of tokens, which buildGzipPage() turns into a deflate stream. 0-127 is a run of that number plus one',
+           '// characters of the page. 128-255 is a copy of that number less 125 characters, from earlier in the page, and is followed by how',
+           '// far back they are, not counting the variables, in two bytes (low byte first).',
+           '']
+    entries = []
+    for page_name, name in pages:
+        data = strings[name]
+        tokens, length, compressed = compress(data)
+        print('%-16s %5d bytes, %5d compressed%s' % (page_name, length, compressed, '' if compressed < length else ', left out'))
+        if compressed >= length:
+            continue
+        out.append('// %s, about %d bytes sent as %d' % (page_name, length, compressed))
+        out.append('prog_uchar %s_gzip[] PROGMEM =' % name)
+        out.append('{')
+        for i in range(0, len(tokens), 16):
+            out.append('  ' + ','.join('0x%02x' % c for c in bytearray(tokens[i:i + 16])) + ',')
+        out[-1] = out[-1][:-1]
+        out.append('};')
+        out.append('')
+        entries.append('  {%s,0x%08lxUL,%s_gzip}' % (name, fnv_hash(data), name))
+
+    out.append('// Data of each page that has a compressed copy, the hash of the data it was made from, and the copy')
+    out.append('PROGMEM const GzipPage gzipPages[] =')
+    out.append('{')
+    out.append(',\n'.join(entries) if entries else '  {0,0,0}// none of the pages are smaller compressed')
+    out.append('};')
+    out.append('#define NUMBER_OF_GZIP_PAGES (sizeof(gzipPages)/sizeof(gzipPages[0]))')
+    with open(os.path.join(folder, OUTPUT), 'w') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,89 @@
+/*
+ * Benchmark of sending pages to the module
+ *
+ * By Roger Clark
+ *
+ * Requests each page from the whole sketch through Serial1, which stands in for the module, and counts the bytes of each response
+ * and the calls to Serial1's write() which sent them. Each write() call is a virtual call, and on the board, a call into the serial
+ * port's transmit code. The speed is how fast loop() turns the page into bytes on this PC, timed over the loop() runs which sent
+ * something, so it doesn't include the time the sketch spends waiting for the next task to be due.
+ *
+ * The checksum of the first response to each request can be compared between versions of the sketch, e.g. built with SKETCH= in the
+ * Makefile, to see that the bytes sent didn't change. Time only moves on between loop() runs, but a page showing millis() still differs if
+ * the versions take a different number of loop() runs to answer.
+ */
+#include "host.h"
+#include "sketch.cpp"
+
+#define REQUESTS_PER_PAGE 2000
+#define IDLE_LOOPS 50// loop() runs without output after which the response is taken to be complete
+
+struct PageResult
+{
+  unsigned long bytes;
+  unsigned long writeCalls;
+  double seconds;
+  unsigned long checksum;
+};
+
+// Sends one request, and runs loop() until the response stops
+void fetch(const char *text,PageResult *result)
+{
+  Serial1.input.erase(0,Serial1.inputPos);
+  Serial1.inputPos=0;
+  Serial1.input+=text;
+  Serial1.output.clear();
+  unsigned long startCalls=Serial1.writeCalls;
+
+  for(int idle=0;idle<IDLE_LOOPS;)
+  {
+    size_t before=Serial1.output.size();
+    double start=hostSeconds();
+    loop();
+    if (Serial1.output.size()!=before)
+    {
+      result->seconds+=hostSeconds()-start;
+      idle=0;
+    }
+    else
+    {
+      idle++;
+    }
+    hostAdvance(1000);
+  }
+  result->bytes+=Serial1.output.size();
+  result->writeCalls+=Serial1.writeCalls-startCalls;
+  for(size_t i=0;i<Serial1.output.size();i++)
+  {
+    result->checksum=result->checksum*31+(unsigned char)Serial1.output[i];
+  }
+}
+
+void measure(const char *page)
+{
+  char text[64];
+  PageResult result;
+
+  sprintf(text,"GET /%s HTTP/1.0\r\n\r\n",page);
+  memset(&result,0,sizeof(result));
+  fetch(text,&result);// the first response, for its checksum. The readings don't change, as analogRead() always returns the same
+  unsigned long checksum=result.checksum;
+  memset(&result,0,sizeof(result));
+  for(int i=0;i<REQUESTS_PER_PAGE;i++)
+  {
+    fetch(text,&result);
+  }
+  printf("  %-14s %5lu bytes per response, checksum %08lx, %6.3f write() calls per byte, %7.1f MB/s\n",page,result.bytes/REQUESTS_PER_PAGE,
+    checksum&0xffffffffUL,(double)result.writeCalls/result.bytes,result.bytes/result.seconds/1e6);
+  hostCheck(result.bytes>0,"the page was sent");
+}
+
+int main()
+{
+  hostTimeStep=0;
+  setup();
+  measure("index.htm");
+  measure("jsondata.htm");
+  measure("s.css");
+  return hostFailures()!=0;
+}
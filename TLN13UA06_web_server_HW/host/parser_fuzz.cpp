@@ -0,0 +1,232 @@
+/*
+ * Fuzz test and throughput of the web server's request parser
+ *
+ * By Roger Clark
+ *
+ * Feeds parseRequestChar() with requests made from random pieces of real ones, random bytes, and request lines and headers longer
+ * than requestBuffer, and checks after every character that everything the parser keeps is inside requestBuffer, and at the end of
+ * each request that each part it found is a terminated string of the length it recorded. Some requests are also sent to the whole
+ * sketch through Serial1, to check that each gets a response.
+ * Build with the sanitizers (see the Makefile) to catch anything these checks miss.
+ *
+ * Then measures how fast the parser gets through a stream of typical browser requests, on this PC.
+ */
+#include "host.h"
+#include "sketch.cpp"
+
+#define FUZZ_REQUESTS 200000
+#define SKETCH_REQUESTS 2000
+#define THROUGHPUT_BYTES (16L*1024*1024)
+
+static const char *pieces[] =
+{
+  "GET ","POST ","HEAD ","/","/index.htm","/get_pin.htm","/s.css","/jsondata.htm","?","&","=","pin","pin=3","pin=A3","spin=4","pinx=5",
+  " HTTP/1.1"," HTTP/1.0","\r\n","\n","\r",":"," ","Connection: close","Connection: keep-alive","If-None-Match: \"12345678\"",
+  "Accept-Encoding: gzip, deflate","Content-Length: 3","Transfer-Encoding: chunked","Host: 192.168.1.10","X-Unknown-Header: value",
+  "%20","\x00","\xff","\a"
+};
+#define NUMBER_OF_PIECES (sizeof(pieces)/sizeof(pieces[0]))
+
+unsigned long violations;
+
+void violation(const char *what,const std::string &text)
+{
+  if (violations++<10)
+  {
+    printf("  %s, after \"",what);
+    for(size_t i=0;i<text.size() && i<200;i++)
+    {
+      printf(isprint((unsigned char)text[i]) ? "%c" : "\\x%02x",(unsigned char)text[i]);
+    }
+    printf("\"\n");
+  }
+}
+
+boolean spanOk(Span span,boolean complete)
+{
+  if (span.start+span.length>=REQUEST_BUFFER_SIZE)
+  {
+    return false;
+  }
+  return !complete || strlen(requestPart(span))==span.length;
+}
+
+// Checks the parser's state. The parts are only terminated strings once the request is complete
+void checkState(const std::string &text)
+{
+  boolean complete=(requestState==requestComplete);
+
+  if (requestLength>=REQUEST_BUFFER_SIZE || partStart>requestLength)
+  {
+    violation("position outside requestBuffer",text);
+  }
+  if (!spanOk(request.method,complete) || !spanOk(request.path,complete) || !spanOk(request.version,complete))
+  {
+    violation("bad request line span",text);
+  }
+  for(int i=0;i<NUMBER_OF_PARAMS;i++)
+  {
+    if (request.params[i].start && !spanOk(request.params[i],complete))
+    {
+      violation("bad parameter span",text);
+    }
+  }
+  for(int i=0;i<NUMBER_OF_HEADERS;i++)
+  {
+    if (request.headers[i].start && !spanOk(request.headers[i],complete))
+    {
+      violation("bad header span",text);
+    }
+  }
+}
+
+std::string randomRequest()
+{
+  std::string text;
+  int kind=random(10);
+
+  if (kind==0)
+  {
+    for(int i=random(300);i>0;i--)
+    {
+      text+=(char)random(256);
+    }
+  }
+  else if (kind==1)
+  {
+    text="GET /"+std::string(random(50,400),'a')+"?pin="+std::string(random(200),'9')+" HTTP/1.1\r\n";
+  }
+  else if (kind==2)
+  {
+    text="GET /index.htm HTTP/1.1\r\nIf-None-Match: "+std::string(random(50,400),'x')+"\r\n"+std::string(random(200),'H')+": v\r\n";
+  }
+  else
+  {
+    for(int i=random(1,30);i>0;i--)
+    {
+      text+=pieces[random(NUMBER_OF_PIECES)];
+    }
+  }
+  return text+"\r\n\r\n";
+}
+
+void fuzzParser()
+{
+  unsigned long requests=0;
+
+  requestState=waiting;
+  for(long n=0;n<FUZZ_REQUESTS;n++)
+  {
+    std::string text=randomRequest();
+    for(size_t i=0;i<text.size();i++)
+    {
+      boolean complete=parseRequestChar(text[i]);
+      checkState(text.substr(0,i+1));
+      if (complete)
+      {
+        requests++;
+        requestState=waiting;
+      }
+    }
+  }
+  printf("  %d random requests, %lu complete requests parsed, %lu violations\n",FUZZ_REQUESTS,requests,violations);
+  hostCheck(violations==0,"the parser stayed inside requestBuffer and terminated every part");
+}
+
+// Parses one request, and returns the value of the pin parameter, or "-" if it isn't there
+std::string pinParam(const char *text)
+{
+  requestState=waiting;
+  while(*text)
+  {
+    parseRequestChar(*text++);
+  }
+  char *pin=requestParam(PARAM_PIN);
+  return pin ? std::string(pin) : std::string("-");
+}
+
+void parameters()
+{
+  hostCheck(pinParam("GET /get_pin.htm?pin=3 HTTP/1.1\r\n\r\n")=="3","pin=3");
+  hostCheck(pinParam("GET /get_pin.htm?spin=3 HTTP/1.1\r\n\r\n")=="-","spin isn't pin");
+  hostCheck(pinParam("GET /get_pin.htm?spin=4&pin=5&pinx=6 HTTP/1.1\r\n\r\n")=="5","pin among other parameters");
+  hostCheck(pinParam("GET /get_pin.htm?pin HTTP/1.1\r\n\r\n")=="","pin without a value");
+  pinParam(("GET /"+std::string(200,'a')+" HTTP/1.1\r\n\r\n").c_str());
+  hostCheck(request.tooLong,"a request line longer than the buffer is marked as too long");
+}
+
+// Random requests through Serial1 and the http task, each of which must get a response
+void fuzzSketch()
+{
+  unsigned long responses=0;
+
+  setup();
+  for(int n=0;n<SKETCH_REQUESTS;n++)
+  {
+    std::string text=randomRequest();
+    // A request the sketch will answer, as a random one may only end a body, or say the connection is closing
+    Serial1.input+=text+"GET /s.css HTTP/1.0\r\n\r\n";
+    Serial1.output.clear();
+    for(int i=0;i<2000 && (Serial1.available() || responseInProgress || requestState==requestComplete);i++)
+    {
+      loop();
+      hostAdvance(100);
+    }
+    hostAdvance(DISCARD_IDLE_MILLIS*1000UL);// so input dropped after a body of unknown length starts being read again
+    for(int i=0;i<10;i++)
+    {
+      loop();
+    }
+    if (Serial1.output.compare(0,7,"HTTP/1.")==0)
+    {
+      responses++;
+    }
+    Serial1.input.clear();
+    Serial1.inputPos=0;
+  }
+  printf("  %d random requests through Serial1, %lu got a response\n",SKETCH_REQUESTS,responses);
+  hostCheck(responses==SKETCH_REQUESTS,"every request got a response");
+}
+
+void throughput()
+{
+  static const char *browserRequests[] =
+  {
+    "GET /index.htm HTTP/1.1\r\nHost: 192.168.1.10\r\nConnection: keep-alive\r\nAccept: text/html,application/xhtml+xml\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\nAccept-Encoding: gzip, deflate\r\nAccept-Language: en-GB,en;q=0.9\r\n\r\n",
+    "GET /get_pin.htm?pin=A3 HTTP/1.1\r\nHost: 192.168.1.10\r\nConnection: keep-alive\r\nIf-None-Match: \"5d41402a\"\r\n\r\n",
+    "GET /s.css HTTP/1.1\r\nHost: 192.168.1.10\r\nAccept: text/css,*/*;q=0.1\r\nReferer: http://192.168.1.10/get_pin.htm\r\n\r\n"
+  };
+  std::string stream;
+  unsigned long requests=0;
+
+  while((long)stream.size()<THROUGHPUT_BYTES)
+  {
+    stream+=browserRequests[stream.size()%3];
+  }
+  requestState=waiting;
+  double start=hostSeconds();
+  for(size_t i=0;i<stream.size();i++)
+  {
+    if (parseRequestChar(stream[i]))
+    {
+      requests++;
+      requestState=waiting;
+    }
+  }
+  double seconds=hostSeconds()-start;
+  printf("  %lu bytes, %lu requests in %.3f s: %.1f MB/s, %.1f ns/byte, %.0f requests/s\n",(unsigned long)stream.size(),requests,seconds,
+    stream.size()/seconds/1e6,seconds*1e9/stream.size(),requests/seconds);
+}
+
+int main()
+{
+  printf("fuzzing the parser\n");
+  fuzzParser();
+  parameters();
+  printf("fuzzing the sketch\n");
+  fuzzSketch();
+  printf("throughput\n");
+  throughput();
+  return hostFailures()!=0;
+}
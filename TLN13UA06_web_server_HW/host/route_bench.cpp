@@ -0,0 +1,150 @@
+/*
+ * Benchmark of finding the requested page in the pages array
+ *
+ * By Roger Clark
+ *
+ * Compares the linear search the sketch used to do, which compared the name with each page name in turn, with the binary search in
+ * findPage(), on tables of 4 to 256 page names in alphabetical order. Both are copies of the sketch's code, run on a table of names
+ * rather than the pages array. Reports the strcmp_P() calls per lookup, which is what the time on the board depends on, and lookups
+ * per second on this PC, for names which are in the table and names which aren't.
+ *
+ * First checks that the binary search copy finds the same pages as findPage() in the sketch, for the sketch's own pages.
+ */
+#include "host.h"
+#include "sketch.cpp"
+#include <algorithm>
+
+#define MAX_ROUTES 256
+#define LOOKUPS 400000L
+
+unsigned long comparisons;
+
+int countedStrcmp_P(const char *s1,const char *s2)
+{
+  comparisons++;
+  return strcmp_P(s1,s2);
+}
+
+// The lookup from before the pages were sorted
+int linearFind(const char **names,int numberOfNames,const char *pageName)
+{
+  for(int page=0;page<numberOfNames;page++)
+  {
+    if (countedStrcmp_P(pageName,(char*)pgm_read_word(&names[page]))==0)
+    {
+      return page;
+    }
+  }
+  return PAGE_NOT_FOUND;
+}
+
+// findPage(), on a table of names
+int binaryFind(const char **names,int numberOfNames,const char *pageName)
+{
+  int low=0;
+  int high=numberOfNames-1;
+  int middle;
+  int comparison;
+
+  while(low<=high)
+  {
+    middle=(low+high)/2;
+    comparison=countedStrcmp_P(pageName,(char*)pgm_read_word(&names[middle]));
+    if (comparison==0)
+    {
+      return middle;
+    }
+    if (comparison<0)
+    {
+      high=middle-1;
+    }
+    else
+    {
+      low=middle+1;
+    }
+  }
+  return PAGE_NOT_FOUND;
+}
+
+typedef int (*FindFunction)(const char **names,int numberOfNames,const char *pageName);
+
+bool nameLess(const std::string &a,const std::string &b)
+{
+  return strcmp(a.c_str(),b.c_str())<0;
+}
+
+// Page names like those of a sketch with many endpoints, many of which start the same way
+std::vector<std::string> makeNames(int count,const char *suffix)
+{
+  static const char *stems[] = { "pin","config","index","json/pin","s","status" };
+  static const char *extensions[] = { "htm","json","css" };
+  std::vector<std::string> names;
+  char name[32];
+
+  for(int i=0;i<count;i++)
+  {
+    sprintf(name,"%s%d.%s%s",stems[i%6],i/6,extensions[i%3],suffix);
+    names.push_back(name);
+  }
+  return names;
+}
+
+// Returns true if the names in the table were all found, and the others weren't
+boolean measure(const char *what,FindFunction find,const char **table,int count,const std::vector<std::string> &lookFor,boolean hits)
+{
+  unsigned long found=0;
+
+  comparisons=0;
+  double start=hostSeconds();
+  for(long i=0;i<LOOKUPS;i++)
+  {
+    if (find(table,count,lookFor[i%count].c_str())!=PAGE_NOT_FOUND)
+    {
+      found++;
+    }
+  }
+  double seconds=hostSeconds()-start;
+  printf("  %-6s %-6s %5.1f strcmp_P() per lookup %10.0f lookups/s\n",what,hits ? "hits" : "misses",(double)comparisons/LOOKUPS,LOOKUPS/seconds);
+  return found==(hits ? (unsigned long)LOOKUPS : 0);
+}
+
+void sketchPages()
+{
+  boolean ok=true;
+  const char *names[NUMBER_OF_PAGES];
+
+  for(unsigned int page=0;page<NUMBER_OF_PAGES;page++)
+  {
+    names[page]=(const char *)pgm_read_word(&(pages[page][PAGE_NAME_INDEX]));
+    if (findPage(names[page])!=(int)page || binaryFind(names,page+1,names[page])!=(int)page || linearFind(names,page+1,names[page])!=(int)page)
+    {
+      ok=false;
+    }
+  }
+  ok=ok && findPage("missing.htm")==PAGE_NOT_FOUND && findPage("")==PAGE_NOT_FOUND && binaryFind(names,NUMBER_OF_PAGES,"")==PAGE_NOT_FOUND;
+  hostCheck(ok,"the copies find the sketch's pages where findPage() does");
+}
+
+int main()
+{
+  sketchPages();
+  for(int count=4;count<=MAX_ROUTES;count*=2)
+  {
+    std::vector<std::string> names=makeNames(count,"");
+    std::vector<std::string> missing=makeNames(count,"x");
+    std::sort(names.begin(),names.end(),nameLess);
+    const char *table[MAX_ROUTES];
+    for(int i=0;i<count;i++)
+    {
+      table[i]=names[i].c_str();
+    }
+
+    printf("%d pages\n",count);
+    boolean ok=measure("linear",linearFind,table,count,names,true);
+    ok=measure("linear",linearFind,table,count,missing,false) && ok;
+    ok=measure("binary",binaryFind,table,count,names,true) && ok;
+    ok=measure("binary",binaryFind,table,count,missing,false) && ok;
+    hostCheck(ok,"every name in the table was found, and none of the others");
+  }
+  return hostFailures()!=0;
+}
@@ -0,0 +1,47 @@
+#!/usr/bin/env python
+"""
+Makes a C++ file from a sketch, as the Arduino IDE does, so that it can be built on a PC by the Makefile in this folder.
+
+By Roger Clark
+
+    python sketch.py <sketch.ino> <output.cpp>
+
+Arduino.h is included at the start, and prototypes of the functions are put before the first function, so that functions can
+be called before they are defined. Functions with default arguments are left out, as their prototype would repeat the defaults.
+"""
+
+import re
+import sys
+
+FUNCTION = re.compile(r'^([A-Za-z_][\w \t\*]*?\b(\w+)[ \t]*\(([^;{)]*)\))[ \t]*\n?\{', re.M)
+KEYWORDS = ('if', 'while', 'for', 'switch', 'return', 'else')
+
+
+def make_cpp(source, name):
+    prototypes = []
+    first = None
+    for match in FUNCTION.finditer(source):
+        if match.group(2) in KEYWORDS or match.group(1).split()[0] in KEYWORDS:
+            continue
+        if first is None:
+            first = match.start()
+        if '=' not in match.group(3):
+            prototypes.append(match.group(1) + ';')
+    if first is None:
+        first = len(source)
+    line = source.count('\n', 0, first) + 1
+    return ('#include "Arduino.h"\n#line 1 "%s"\n%s\n%s\n#line %d "%s"\n%s' %
+            (name, source[:first], '\n'.join(prototypes), line, name, source[first:]))
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    with open(sys.argv[1]) as f:
+        source = f.read()
+    with open(sys.argv[2], 'w') as f:
+        f.write(make_cpp(source, sys.argv[1]))
+
+
+if __name__ == '__main__':
+    main()
@@ -37,30 +37,170 @@
  *
  */
 #include "UARTWifi.h"
+#include "UARTWifiSmtpSession.h"
+#include <stdarg.h>
 
 #define DEBUG_LEVEL 0
 #define INTER_COMMAND_DELAY 50
-#define SOCKET_RECEIVE_RETRY_TIME 250
+// Adaptive polling used by socketReceiveWait(). The retry time starts at the minimum and doubles each time no data was received, up to the maximum
+#define SOCKET_RECEIVE_MIN_RETRY_TIME 10
+#define SOCKET_RECEIVE_MAX_RETRY_TIME 500
+#define SOCKET_RECEIVE_DEADLINE 30000
+// Backoff used by socketSendStream() while the module's buffer is full. The retry time starts at the minimum and doubles each time nothing was accepted
+#define SOCKET_SEND_MIN_RETRY_TIME 10
+#define SOCKET_SEND_MAX_RETRY_TIME 500
+
+// Readiness state machine, see beginReset(). The probe and link query delays start at the minimum and double after each failure
+#define RESET_PULSE_TIME 50
+// A module in transparent mode only answers +++ after the guard time, and a +++ sent before then restarts the escape sequence
+#define READY_PROBE_TIMEOUT (UARTWIFI_ESCAPE_GUARD_TIME+250)
+#define READY_PROBE_MIN_DELAY 50
+#define READY_PROBE_MAX_DELAY 1000
+#define READY_LINK_QUERY_TIMEOUT 1000
+#define READY_LINK_MIN_DELAY 100
+#define READY_LINK_MAX_DELAY 1000
+
+#if UARTWIFI_STATS
+// Names of the command types, in UARTWIFI_CMD_ order. A command is of a type if it starts with the name followed by = or \r
+static const char STATS_COMMAND_NAMES[UARTWIFI_CMD_TYPES][9] PROGMEM =
+{
+	"+++","AT+","AT+SKCT","AT+SKSTT","AT+SKCLS","AT+SKRCV","AT+SKSND","AT+SKSDF","AT+LKSTT","AT+ENTM","AT+ATRM","other"
+};
+
+static unsigned char statsCommandType(const char *text)
+{
+	if (*text=='+')
+	{
+		return UARTWIFI_CMD_ESCAPE;
+	}
+	for(unsigned char type=UARTWIFI_CMD_AT;type<UARTWIFI_CMD_OTHER;type++)
+	{
+		int length=strlen_P(STATS_COMMAND_NAMES[type]);
+		if (strncmp_P(text,STATS_COMMAND_NAMES[type],length)==0 && (text[length]=='=' || text[length]=='\r'))
+		{
+			return type;
+		}
+	}
+	return UARTWIFI_CMD_OTHER;
+}
+#endif
+
+// Bulk transfers. Data is written in blocks of this size, with any received data read between the blocks
+#define BULK_WRITE_BLOCK_SIZE 16
+#define BULK_READ_BUFFER_SIZE 32
+// What the module sends when it leaves transparent mode. The + isn't repeated, so a partial match can only restart at the first character
+static const char ESCAPE_REPLY[] PROGMEM = "+OK\r\n\r\n";
+
+/*
+ * AT command shapes, used by formatCommand(). %s inserts a string from RAM and %d an int.
+ * Each command is built in a single pass into one buffer, and then sent to the module with a single write()
+ */
+static const char CMD_SOCKET_CREATE[] PROGMEM = "AT+SKCT=%s,%s,%s,%s\r";
+static const char CMD_SOCKET_STATE[] PROGMEM = "AT+SKSTT=%d\r";
+static const char CMD_SOCKET_CLOSE[] PROGMEM = "AT+SKCLS=%d\r";
+static const char CMD_SOCKET_RECEIVE[] PROGMEM = "AT+SKRCV=%d,%d\r";
+static const char CMD_SOCKET_SEND[] PROGMEM = "AT+SKSND=%d,%d\r";
+static const char CMD_SET_DEFAULT_SOCKET[] PROGMEM = "AT+SKSDF=%d\r";
+
+// States of the command at the head of the queue
+#define COMMAND_STATE_IDLE 0
+#define COMMAND_STATE_WAITING_RESPONSE 1
+#define COMMAND_STATE_RECEIVING_DATA 2
+
+// Used by the blocking methods to collect the result of the command they queued
+typedef struct
+{
+	volatile boolean	done;
+	int					status;
+	char				*responseBuf;
+	int					responseBufSize;
+} BlockingResult;
+
+/*
+ * Minimal formatter for the command shapes above. Much smaller than sprintf, as it only handles %s and %d.
+ * Returns the length of the command, or -1 if it doesn't fit in bufferSize (including the null terminator)
+ */
+static int formatCommand(char *buffer,int bufferSize,const char *format,...)
+{
+	va_list args;
+	char *p = buffer;
+	char *end = buffer+bufferSize-1;// leave space for the null terminator
+	char c;
+
+	va_start(args,format);
+	while ((c = pgm_read_byte(format++)))
+	{
+		const char *insert;
+		char number[sizeof(int)*3+2];// enough for the digits, sign and null terminator of the widest int
+		if (c=='%')
+		{
+			c = pgm_read_byte(format++);
+			insert = (c=='d') ? itoa(va_arg(args,int),number,10) : va_arg(args,const char *);
+		}
+		else
+		{
+			number[0]=c;
+			number[1]=0;
+			insert=number;
+		}
+		while (*insert)
+		{
+			if (p>=end)
+			{
+				va_end(args);
+				*p=0;
+				return -1;
+			}
+			*p++ = *insert++;
+		}
+	}
+	va_end(args);
+	*p=0;
+	return p-buffer;
+}
 
 // Constructor
-UARTWifi::UARTWifi(Stream *serial,int resetPin,int rtsPin)
+UARTWifi::UARTWifi(Stream *serial,int resetPin,int rtsPin) : _framer("\r\n\r\n")
 {
 	this->_serial=serial;
 	this->_resetPin=resetPin;
 	this->_rtsPin=rtsPin;
+	this->_queueHead=0;
+	this->_queueCount=0;
+	this->_commandState=COMMAND_STATE_IDLE;
+	this->_inFlight=0;
+	this->_pipelineDepth=1;
+	this->_dataReadyPin=-1;
+	this->_ctsPin=-1;
+	this->_sendStallMillis=UARTWIFI_SEND_STALL_TIMEOUT;
+	setReceivePolling(SOCKET_RECEIVE_MIN_RETRY_TIME,SOCKET_RECEIVE_MAX_RETRY_TIME,SOCKET_RECEIVE_DEADLINE);
+	this->_lastCommandTime=0;
+	this->_readyState=UARTWIFI_READY_IDLE;
+	this->_readyInterrupt=-1;
+	memset(&_readyStats,0,sizeof(_readyStats));
+	resetStats();
+	this->_framer.begin(_gResponseBuf,sizeof(_gResponseBuf));
+	parseUARTWifiResponse(_framer.frame(),&_response);
 }
 
-void UARTWifi::debounce(int pin,boolean desiredValue,int delayMS)
+// Waits until two samples delayMS apart both read desiredValue. Returns false if that hasn't happened within timeoutMillis
+boolean UARTWifi::debounce(int pin,boolean desiredValue,int delayMS,long timeoutMillis)
 {
+unsigned long startTime = millis();
 boolean sample1;
 boolean	sample2 = digitalRead(pin);
 
 	do
 	{
+		if ((long)(millis()-startTime) >= timeoutMillis)
+		{
+			return false;
+		}
 		sample1=sample2;
 		delay(delayMS);
 		sample2=digitalRead(pin);
-	} while (sample1!=desiredValue && sample2!=desiredValue);
+	} while (sample1!=desiredValue || sample2!=desiredValue);
+	return true;
 }
 /*
  * resetModule() 
@@ -73,32 +213,35 @@ boolean	sample2 = digitalRead(pin);
  * e.g. 100nF between rts and GND.
  * Sometimes, increasing the debounce delay can overcome the noice problems.
  *
- *
+ * Returns 0, or UARTWIFI_TIMEOUT if the module wasn't ready within timeoutMillis.
+ * beginReset() is usually faster, as it doesn't rely only on RTS
  */
-void UARTWifi::resetModuleUsingRTS() 
+int UARTWifi::resetModuleUsingRTS(long timeoutMillis) 
 {
 	delay(100);// Wait 100ms for Arduino to settle etc.
 	pinMode(_rtsPin, INPUT); // read the value of the RTS pin
 	pinMode(_resetPin, OUTPUT); // control the Reset pin. Note this needs to be connected via a resistor divider network of 1k / 2k as the module is 3.3V
 
+	unsigned long startTime = millis();
+
 	//  Wait for the RTS pin to be low. If its not low, the module is not in an operational state.
-	//	i.e it may have a glitch caused by the upload or power-up etc
-	debounce(_rtsPin,0,1);
+	//	i.e it may have a glitch caused by the upload or power-up etc. The reset should sort that out, so carry on anyway
+	debounce(_rtsPin,0,1,timeoutMillis);
 	
 	digitalWrite(_resetPin,LOW);// Put module into reset
 	
 	// RTS will go low when module is in reset. So wait for it to go low.
-	debounce(_rtsPin,0,1);
+	debounce(_rtsPin,0,1,timeoutMillis-(long)(millis()-startTime));
 	
 	digitalWrite(_resetPin,HIGH);  // Take module out of reset
 
 	// RTS stays low some time after reset. Low normally means that device is ready, 
 	// but this is a false report just after a reset, so wait for it to go high
-	debounce(_rtsPin,1,1);
+	debounce(_rtsPin,1,1,timeoutMillis-(long)(millis()-startTime));
 
 	// Wait for RTS to go low again, which will indicate the the module is finally ready. 
 	// Note this may take some time as it depends on not only booting up, but also connection to access points if in STA mode.
-	debounce(_rtsPin,0,1);
+	return debounce(_rtsPin,0,1,timeoutMillis-(long)(millis()-startTime)) ? 0 : UARTWIFI_TIMEOUT;
 }
 
 void UARTWifi::resetModuleUsingDelay(int delayMS) 
@@ -113,518 +256,1380 @@ void UARTWifi::resetModuleUsingDelay(int delayMS)
 	delay(delayMS);//delay by user specified delay period
 }
 
-int UARTWifi::waitCommandComplete(char *responseBuf,int timeoutMillis)
+volatile boolean UARTWifi::_rtsFell=false;
+
+void UARTWifi::rtsInterrupt()
 {
-long timeoutTime = millis()+timeoutMillis;
-int status=false;
-int bytesReceived=0;
+	_rtsFell=true;
+}
 
-  while(millis()<timeoutTime && status==false)
-  {
-    if (_serial->available())
-    {
-      *responseBuf++ = _serial->read();
-      if (++bytesReceived>4) 
-      {
-        if (strncmp_P(responseBuf-4,PSTR("\r\n\r\n"),4)==0)
-        {
-          //Serial.println("Command complete");
-		  char *p = strstr_P(responseBuf,PSTR("\r\n\r\n"));
-		  *p=0;// terminate string at first matching char
-          status=true;
-        }
-      }  
-    }  
-  }
-  //*responseBuf=0;// terminate the buffer so it can be used as a string
-  return status;
+/*
+ * Uses an interrupt, rather than polling, to see nRTS going low, so that a short pulse isn't missed between calls to poll().
+ * Only one UARTWifi object can use an interrupt. -1 goes back to polling
+ */
+void UARTWifi::setReadyInterrupt(int interruptNum)
+{
+	if (_readyInterrupt>=0)
+	{
+		detachInterrupt(_readyInterrupt);
+	}
+	_readyInterrupt=interruptNum;
+	if (interruptNum>=0)
+	{
+		attachInterrupt(interruptNum,rtsInterrupt,FALLING);
+	}
 }
 
-int UARTWifi::waitDataPattern(char *responseBuf,char *pattern,int timeoutMillis)
+/*
+ * Starts resetting the module, without blocking. poll() then takes it through the readiness states, recording the time of each in readyStats().
+ * The reset pin is held low for RESET_PULSE_TIME, then +++ is sent until the module responds (which also puts it into command mode).
+ * Probes back off exponentially from READY_PROBE_MIN_DELAY, but nRTS going low, meaning the module says its ready, triggers one straight away.
+ * If waitForLink is true, AT+LKSTT is then sent, again backing off, until the network link is up.
+ * readyState() becomes UARTWIFI_READY, or UARTWIFI_READY_FAILED if that took longer than timeoutMillis.
+ * Any queued commands are abandoned, and their callbacks are called with UARTWIFI_RESET
+ */
+void UARTWifi::beginReset(boolean waitForLink,long timeoutMillis)
 {
-long timeoutTime = millis()+timeoutMillis;
-int status=false;
-int bytesReceived=0;
-int patternLength = strlen(pattern);
+	unsigned char queued=_queueCount;
 
-  while(millis()<timeoutTime && status==false)
-  {
-    if (_serial->available())
-    {
-      *responseBuf++ = _serial->read();
-      if (++bytesReceived>patternLength)
-      {
-       // Serial.print(*responseBuf);
-        if (strcmp(responseBuf-patternLength,pattern)==0)
-        {
-          status=true;
-        }
-      }  
-    }  
-  }
-  *responseBuf=0;// terminate the buffer so it can be used as a string
-  return status;
+	_inFlight=queued;
+	while (queued--)
+	{
+		completeCommand(UARTWIFI_RESET);
+	}
+
+	memset(&_readyStats,0,sizeof(_readyStats));
+	_readyStats.resetTime=millis();
+	_waitForLink=waitForLink;
+	_readyTimeoutMillis=timeoutMillis;
+
+	if (_rtsPin>=0)
+	{
+		pinMode(_rtsPin, INPUT);
+	}
+	pinMode(_resetPin, OUTPUT);
+	digitalWrite(_resetPin,LOW);// Put module into reset
+	setReadyState(UARTWIFI_READY_RESETTING);
 }
 
-int UARTWifi::enterCommandMode(int timeout)
+// Blocking version of beginReset(). Returns 0, or UARTWIFI_TIMEOUT
+int UARTWifi::resetUntilReady(boolean waitForLink,long timeoutMillis)
 {
-	_serial->print("+++");
-	return waitCommandComplete(_gResponseBuf,timeout);
+	beginReset(waitForLink,timeoutMillis);
+	while (_readyState!=UARTWIFI_READY && _readyState!=UARTWIFI_READY_FAILED)
+	{
+		poll();
+	}
+	return (_readyState==UARTWIFI_READY) ? 0 : UARTWIFI_TIMEOUT;
 }
 
-int UARTWifi::sendAT(int timeout)
+unsigned char UARTWifi::readyState()
 {
-	delay(INTER_COMMAND_DELAY);
-	_serial->print(F("AT+\r"));
-	return waitCommandComplete(_gResponseBuf,timeout);
+	return _readyState;
 }
 
-int UARTWifi::getResponseStatus(char *responseBuf)
+UARTWifiReadyStats *UARTWifi::readyStats()
 {
-  //Serial.print(F("getResponseStatus received "));
-  //Serial.print(responseBuf);
-  if (strncmp(responseBuf,"+OK",3)==0)
-  {
-    //Serial.println(F("getResponseStatus buffer Started with +OK"));
-    return 0;
-  }
-  else
-  {
-    if (strncmp(responseBuf,"+ERR=",5)==0)
-    {
-      //Serial.print(F("getResponseStatus  ERROR"));
-      //Serial.println(responseBuf);
-      return atoi(responseBuf+5);
-    }
-  }
+	return &_readyStats;
 }
 
-int UARTWifi::socketCreate(char *protocol,char *clientOrServer,char *host,char *portNumber,int *socketNumCreated)
+void UARTWifi::setReadyState(unsigned char state)
 {
-#if DEBUG_LEVEL > 0
-	Serial.println(F("socketCreate "));
-#endif
-	char responseBuf[16];
-	delay(INTER_COMMAND_DELAY);
-	_serial->print(F("AT+SKCT="));  
-	_serial->print(protocol);
-	_serial->print(F(","));
-	_serial->print(clientOrServer);
-	_serial->print(F(","));  
-	_serial->print(host);
-	_serial->print(F(","));  
-	_serial->print(portNumber);
-	_serial->print(F("\r"));  
-  
-	if (waitCommandComplete(responseBuf,5000))
-	{
-		int responseStatus = getResponseStatus(responseBuf);
-		if (responseStatus==0)
-		{
-		  // Note. Spec says that max ports is "supports 8 TCP client connections at most", so response should be single digit number
-		  // Normally the port num returned for new ports is 2, so largest number would be 9
-
-		  *(responseBuf+5)=0;// terminate the string  1 characters after the "+OK="
-		  
-//		  Serial.println(responseBuf);Serial.println(atoi(responseBuf+4));
-		  
-		  *socketNumCreated = atoi(responseBuf+4);
-		  return  responseStatus;
+	_readyState=state;
+	_readyStateTime=millis();
+	if (state==UARTWIFI_READY || state==UARTWIFI_READY_FAILED)
+	{
+		_readyStats.readyMillis=_readyStateTime-_readyStats.resetTime;
+	}
+}
+
+// Returns true, once, when nRTS goes low after the reset
+boolean UARTWifi::rtsSignalledReady()
+{
+	boolean ready=false;
+
+	if (_readyInterrupt>=0)
+	{
+		ready=_rtsFell;
+		_rtsFell=false;
+	}
+	else if (_rtsPin>=0)
+	{
+		// nRTS is low during the reset, and only goes high briefly before going low again when the module is ready
+		if (digitalRead(_rtsPin)==HIGH)
+		{
+			_rtsWasHigh=true;
 		}
-		else
+		else if (_rtsWasHigh)
 		{
-#if DEBUG_LEVEL > 0
-		Serial.println(F("ERROR in getResponseStatus in create socket"));
-#endif		
-		  return responseStatus;// return the error code
+			_rtsWasHigh=false;
+			ready=true;
 		}
 	}
-	else
+	if (ready && _readyStats.rtsMillis==0)
 	{
-		return -200;
+		_readyStats.rtsMillis=millis()-_readyStats.resetTime;
 	}
+	return ready;
 }
 
-int UARTWifi::socketGetConnectionState(char *buffer,int socketNum)
+// Called by poll() while beginReset() is in progress
+void UARTWifi::readyStep()
 {
-// ---------------WARNING Not fully tested code ---------------------------
+	unsigned long now=millis();
 
-char strSocket[3];
-	itoa ( socketNum, strSocket,10 );
-#if DEBUG_LEVEL > 0  
-	Serial.println(F("Sending AT+LKSTT"));
-#endif	
-	_serial->print(F("AT+SKSTT"));
-	_serial->print(strSocket);
-	_serial->print(F("\r"));  
-	if (waitCommandComplete(buffer,5000))
+	if ((now-_readyStats.resetTime) >= (unsigned long)_readyTimeoutMillis)
 	{
-		int responseStatus = getResponseStatus(buffer);
-		return 0;
+		setReadyState(UARTWIFI_READY_FAILED);// the callback of a probe which is still in flight ignores it
+		return;
 	}
-	else
+
+	switch(_readyState)
 	{
-		return -200;
+		case UARTWIFI_READY_RESETTING:
+			if ((now-_readyStateTime) >= RESET_PULSE_TIME)
+			{
+				digitalWrite(_resetPin,HIGH);  // Take module out of reset
+				_rtsFell=false;
+				_rtsWasHigh=false;
+				_readyDelayMillis=READY_PROBE_MIN_DELAY;
+				setReadyState(UARTWIFI_READY_BOOTING);
+			}
+			break;
+
+		case UARTWIFI_READY_BOOTING:
+			if (rtsSignalledReady() || (now-_readyStateTime) >= (unsigned long)_readyDelayMillis)
+			{
+				while (_serial->available())
+				{
+					_serial->read();// discard anything sent while the module was booting, or a late reply to the last probe, so it isn't taken as the response to this one
+				}
+				if (queueCommand("+++",READY_PROBE_TIMEOUT,probeComplete,this)>=0)
+				{
+					_readyStats.probes++;
+					setReadyState(UARTWIFI_READY_PROBING);
+				}
+			}
+			break;
+
+		case UARTWIFI_READY_LINK_WAIT:
+			if ((now-_readyStateTime) >= (unsigned long)_readyDelayMillis && queueCommand("AT+LKSTT\r",READY_LINK_QUERY_TIMEOUT,linkQueryComplete,this)>=0)
+			{
+				_readyStats.linkQueries++;
+				setReadyState(UARTWIFI_READY_LINK_QUERY);
+			}
+			break;
 	}
 }
 
-int UARTWifi::socketClose(int socketNum)
+void UARTWifi::probeComplete(int status,UARTWifiResponse *response,void *context)
 {
-#if DEBUG_LEVEL > 0  
-	Serial.print(F("socketClose "));
-	Serial.println(socketNum,DEC);
-#endif
-	char responseBuf[16];
-	char strSocket[2];
-	itoa ( socketNum, strSocket,10 );
-	delay(INTER_COMMAND_DELAY);
-	_serial->print(F("AT+SKCLS="));  
-	_serial->print(strSocket);  
-	_serial->print(F("\r"));  
-	waitCommandComplete(responseBuf,5000);
-	return getResponseStatus(responseBuf); 
+	UARTWifi *wifi = (UARTWifi *)context;
+
+	if (wifi->_readyState!=UARTWIFI_READY_PROBING)
+	{
+		return;
+	}
+	if (status!=UARTWIFI_TIMEOUT && status!=UARTWIFI_BAD_RESPONSE && status!=UARTWIFI_RESET)
+	{
+		wifi->_readyStats.bootMillis=millis()-wifi->_readyStats.resetTime;
+		wifi->_readyDelayMillis=0;// check the link straight away
+		wifi->setReadyState(wifi->_waitForLink ? UARTWIFI_READY_LINK_WAIT : UARTWIFI_READY);
+		return;
+	}
+	wifi->_readyDelayMillis*=2;
+	if (wifi->_readyDelayMillis>READY_PROBE_MAX_DELAY)
+	{
+		wifi->_readyDelayMillis=READY_PROBE_MAX_DELAY;
+	}
+	wifi->setReadyState(UARTWIFI_READY_BOOTING);
 }
 
-int UARTWifi::socketReceive(char *buffer,int buffSize,int socketNum)
+void UARTWifi::linkQueryComplete(int status,UARTWifiResponse *response,void *context)
 {
-  char tmpStr[8];
-
-#if LEVEL > 0 
-	Serial.println("socketReceive");
-#endif	
+	UARTWifi *wifi = (UARTWifi *)context;
 
-  delay(INTER_COMMAND_DELAY);
-  itoa ( socketNum, tmpStr,10 );
-  _serial->print(F("AT+SKRCV="));  
-  _serial->print(tmpStr);  
-  _serial->print(F(","));  
-  itoa ( buffSize, tmpStr,10 );
-  _serial->print(tmpStr);   
-  _serial->print(F("\r"));  
-  
-  if (waitCommandComplete(_gResponseBuf,10000)!=0)
-  {
-    int responseStatus = getResponseStatus(_gResponseBuf);
+	if (wifi->_readyState!=UARTWIFI_READY_LINK_QUERY)
+	{
+		return;
+	}
+	// Response is +OK=<status>,<ip>,... where status 1 is connected
+	if (status==0 && response->type==UARTWIFI_RESPONSE_OK_VALUE && response->value==1)
+	{
+		wifi->_readyStats.linkMillis=millis()-wifi->_readyStats.resetTime;
+		wifi->setReadyState(UARTWIFI_READY);
+		return;
+	}
+	wifi->_readyDelayMillis = wifi->_readyDelayMillis ? wifi->_readyDelayMillis*2 : READY_LINK_MIN_DELAY;
+	if (wifi->_readyDelayMillis>READY_LINK_MAX_DELAY)
+	{
+		wifi->_readyDelayMillis=READY_LINK_MAX_DELAY;
+	}
+	wifi->setReadyState(UARTWIFI_READY_LINK_WAIT);
+}
 
-    if (responseStatus==0)
-    {
-      char *p = strstr_P(_gResponseBuf,PSTR("\r\n\r\n"));
-      *p=0;// terminate string at first matching char
+/*
+ * Blocking reads of a complete response (terminated by \r\n\r\n) or of data up to and including a pattern.
+ * The response is null terminated, and is truncated if it doesn't fit in responseBufSize bytes.
+ */
+int UARTWifi::waitCommandComplete(char *responseBuf,int timeoutMillis,int responseBufSize)
+{
+unsigned long startTime = millis();
+UARTWifiFramer framer("\r\n\r\n");
 
-      int sizeToRead=atoi((_gResponseBuf+4));
-      int responseBufferSize=sizeToRead;
-      //Serial.print("Size to read is "); Serial.println(sizeToRead,DEC);
-      while(sizeToRead>0)
-      {
-        if (_serial->available())
-        {
-          *buffer++ = _serial->read();
-#if DEBUG_LEVEL > 1		  
-          Serial.print(F("."));
-#endif 
-          sizeToRead--;
-        }
-      }
-     *buffer=0;// Terminate buffer for debugging   
-     return  responseBufferSize;
-    }
-    else
-    {
-#if DEBUG_LEVEL > 0	
-      Serial.println(F("Error. Incorrect buffer size."));
-#endif	  
-      return responseStatus;
-    }
-  }
-  else
+  framer.begin(responseBuf,responseBufSize);
+  while((millis()-startTime) < (unsigned long)timeoutMillis)
   {
-    return -200;
+    if (_serial->available() && framer.push(_serial->read()))
+    {
+      framer.frame();// terminate string at the start of the \r\n\r\n
+      return true;
+    }  
   }
+  return false;
 }
 
-int UARTWifi::socketSend(char *buffer,int buffSize,int socketNum)
+int UARTWifi::waitDataPattern(char *responseBuf,char *pattern,int timeoutMillis,int responseBufSize)
 {
-  char tmpStr[8];
+unsigned long startTime = millis();
+UARTWifiFramer framer(pattern);
 
-#if DEBUG_LEVEL > 0  
-  Serial.println(F("socketSend..."));
-#endif  
-  delay(INTER_COMMAND_DELAY);
-  itoa ( socketNum, tmpStr,10 );
-  _serial->print(F("AT+SKSND="));  
-  _serial->print(tmpStr);  
-  _serial->print(F(","));  
-  itoa ( buffSize, tmpStr,10 );
-  _serial->print(tmpStr);   _serial->print(F("\r"));  
-  
-  if (waitCommandComplete(_gResponseBuf,5000)!=0)
+  framer.begin(responseBuf,responseBufSize);
+  while((millis()-startTime) < (unsigned long)timeoutMillis)
   {
-    int responseStatus = getResponseStatus(_gResponseBuf);
-    if (responseStatus!=buffSize)
-    {
-      char *p = strstr_P(_gResponseBuf,PSTR("\r\n\r\n"));
-      *p=0;// terminate string at first matching char
-      int sizeToSend=atoi((_gResponseBuf+4));
-      //Serial.print("Size to send is "); Serial.println(sizeToSend,DEC);
-      delay(INTER_COMMAND_DELAY);
-      _serial->print(buffer);
-    }
-    else
+    if (_serial->available() && framer.push(_serial->read()))
     {
-#if DEBUG_LEVEL > 0	
-      Serial.println(F("Error. Send Incorrect buffer size."));
-#endif	  
-      return responseStatus;
-    }
-  }
-  else
-  {
-    return -200;
+      return true;// buffer is terminated after the pattern
+    }  
   }
+  return false;
 }
 
-int UARTWifi::setDefaultSocket(int socketNum)
+/*
+ * Asynchronous command engine
+ *
+ * Commands are added to a small queue and are sent to the module one at a time by poll(), which also consumes
+ * whatever response bytes are available, without waiting for any more to arrive.
+ * When the module's response is complete, or the command times out, the command's callback is called and the next
+ * command in the queue is sent, once INTER_COMMAND_DELAY has elapsed.
+ *
+ * All the blocking methods e.g. socketCreate() are built on top of this, by queuing their command and then calling poll()
+ * until it has completed.
+ */
+UARTWifiCommand *UARTWifi::queueEntry(const char *command,int timeoutMillis,UARTWifiCallback callback,void *context)
 {
-	char tmpBuf[3];
-	delay(INTER_COMMAND_DELAY);
-	_serial->print(F("AT+SKSDF="));
-	itoa(socketNum,tmpBuf,10);
-	_serial->print(tmpBuf);
-	_serial->print(F("\r"));
-	if (waitCommandComplete(_gResponseBuf,5000))
+	int length = strlen(command);
+	if (_queueCount>=UARTWIFI_COMMAND_QUEUE_SIZE || length>=UARTWIFI_COMMAND_LENGTH)
 	{
-		return getResponseStatus(_gResponseBuf);
+		return 0;
 	}
-	else
+	UARTWifiCommand *entry = &_queue[(_queueHead+_queueCount)%UARTWIFI_COMMAND_QUEUE_SIZE];
+	memcpy(entry->text,command,length+1);
+	entry->length=length;
+	entry->timeoutMillis=timeoutMillis;
+	entry->dataDirection=UARTWIFI_DATA_NONE;
+	entry->data=0;
+	entry->dataSize=0;
+	entry->ring=0;
+	entry->callback=callback;
+	entry->context=context;
+	_queueCount++;
+	return entry;
+}
+
+// Returns the number of commands queued (including this one), or -1 if the queue is full or the command is too long
+int UARTWifi::queueCommand(const char *command,int timeoutMillis,UARTWifiCallback callback,void *context)
+{
+	if (!queueEntry(command,timeoutMillis,callback,context))
 	{
-#if DEBUG_LEVEL > 0		
-		Serial.println(F("Timeout trying to set default socket"));
-#endif		
-		return -200;
+		return -1;
 	}
+	return _queueCount;
 }
-int UARTWifi::getNetworkStatus(char *buffer)
+
+// Queues an AT+SKRCV. Up to buffSize bytes of the data which follows the response are stored in buffer
+int UARTWifi::queueSocketReceive(char *buffer,int buffSize,int socketNum,UARTWifiCallback callback,void *context)
 {
-#if DEBUG_LEVEL > 0  
-	Serial.println(F("Sending AT+LKSTT"));
-#endif	
-	_serial->print(F("AT+LKSTT\r"));  
-	if (waitCommandComplete(buffer,5000))
+	char command[24];
+	if (formatCommand(command,sizeof(command),CMD_SOCKET_RECEIVE,socketNum,buffSize)<0)
 	{
-		return 0;
+		return -1;
 	}
-	else
+	UARTWifiCommand *entry = queueEntry(command,10000,callback,context);
+	if (!entry)
 	{
-		return -200;
+		return -1;
 	}
+	entry->dataDirection=UARTWIFI_DATA_RECEIVE;
+	entry->data=buffer;
+	entry->dataSize=buffSize;
+	return _queueCount;
 }
 
-int UARTWifi::enterTransparentMode()
+// Queues an AT+SKRCV for as many bytes as there is space for in the ring buffer. The data is put straight into the ring buffer
+int UARTWifi::queueSocketReceive(UARTWifiRingBuffer *ring,int socketNum,UARTWifiCallback callback,void *context)
 {
-	delay(INTER_COMMAND_DELAY);
-	_serial->print(F("AT+ENTM\r"));
+	int queued = queueSocketReceive((char *)0,ring->space(),socketNum,callback,context);
+	if (queued>0)
+	{
+		_queue[(_queueHead+_queueCount-1)%UARTWIFI_COMMAND_QUEUE_SIZE].ring=ring;
+	}
+	return queued;
+}
 
-	if (waitCommandComplete(_gResponseBuf,5000))
+// Queues an AT+SKSND. The contents of buffer are sent when the module responds with the number of bytes it will accept
+int UARTWifi::queueSocketSend(char *buffer,int buffSize,int socketNum,UARTWifiCallback callback,void *context)
+{
+	char command[24];
+	if (formatCommand(command,sizeof(command),CMD_SOCKET_SEND,socketNum,buffSize)<0)
 	{
-		return getResponseStatus(_gResponseBuf);
+		return -1;
 	}
-	else
+	UARTWifiCommand *entry = queueEntry(command,5000,callback,context);
+	if (!entry)
 	{
-		return -200;
+		return -1;
 	}
+	entry->dataDirection=UARTWIFI_DATA_SEND;
+	entry->data=buffer;
+	entry->dataSize=buffSize;
+	return _queueCount;
 }
 
-void UARTWifi::waitForNetworkToConnect()
+// Queues an AT+SKCT. If the socket is created, the response passed to the callback is +OK=<socket number>
+int UARTWifi::queueSocketCreate(const char *protocol,const char *clientOrServer,const char *host,const char *portNumber,UARTWifiCallback callback,void *context)
 {
-  while(true)
-  {
-      getNetworkStatus(_gResponseBuf);
-      char *p = strstr_P(_gResponseBuf,PSTR("\r\n\r\n"));
-      *p=0;// terminate string at first matching char
-#if DEBUG_LEVEL > 0		  
-      Serial.println(_gResponseBuf);
-#endif	  
-      if (strncmp((_gResponseBuf+4),"1",1)==0)
-      {
-#if DEBUG_LEVEL > 0  
-		Serial.println(F("Network was connected"));
-#endif		
-        return;
-      }
-      else
-      {
-#if DEBUG_LEVEL > 0  
-		Serial.println(F("Waiting for network to be connected"));
-#endif		
-        delay(1000);// wait 1000ms before we re-try
-      }
-  }
+	char command[UARTWIFI_COMMAND_LENGTH];
+
+	if (formatCommand(command,sizeof(command),CMD_SOCKET_CREATE,protocol,clientOrServer,host,portNumber)<0)
+	{
+		return -1;
+	}
+	return queueCommand(command,5000,callback,context);
 }
 
-int UARTWifi::getAutoWorkSocketInfo(char *responseBuf)
+int UARTWifi::queueSocketClose(int socketNum,UARTWifiCallback callback,void *context)
 {
-#if DEBUG_LEVEL > 0
-	Serial.println(F("Sending AT+ATRM"));
-#endif	
-	_serial->print(F("AT+ATRM\r"));  
-	if (waitCommandComplete(responseBuf,5000))
+	char command[16];
+
+	if (formatCommand(command,sizeof(command),CMD_SOCKET_CLOSE,socketNum)<0)
 	{
-		char *p = strstr_P(_gResponseBuf,PSTR("\r\n\r\n"));
-		*p=0;// terminate string at first matching char
-		return 0;
+		return -1;
 	}
-	else
-	{
-		return -200;
-	}  
+	return queueCommand(command,5000,callback,context);
 }
 
-int UARTWifi::sendEmail(char *toAddress,char *fromAddress,char *toFriendlyName,char *subject,char *message,char *loginDomain,char *mailServer)
+int UARTWifi::commandsPending()
+{
+	return _queueCount;
+}
+
+void UARTWifi::poll()
 {
-char dataBuf[256];
-int theSocket;
-int responseCode = socketCreate("0","0",mailServer,"25",&theSocket);// 0=client,0=tcp,mailserver,port 25 for smtp, var into which the socket num is returned
+	if (_readyState!=UARTWIFI_READY_IDLE && _readyState!=UARTWIFI_READY && _readyState!=UARTWIFI_READY_FAILED)
+	{
+		readyStep();
+	}
+	sendQueuedCommands();
+
+	while (_inFlight>0 && _serial->available())
+	{
+		processByte(_serial->read());
+	}
 
-	if (responseCode==0)
+	if (_commandState==COMMAND_STATE_RECEIVING_DATA && (millis()-_lastByteTime) > UARTWIFI_DATA_TIMEOUT)
+	{
+		// The module sent less data than it said it would. Return what was received rather than waiting forever
+		completeCommand(_dataReceived);
+	}
+	else if (_inFlight>0 && (millis()-_commandStartTime) > (unsigned long)_queue[_queueHead].timeoutMillis)
 	{
-#if DEBUG_LEVEL > 2		
-	Serial.print(F("Socket created was "));//Serial.println(theSocket);
+#if DEBUG_LEVEL > 0
+		Serial.print(F("Timeout "));
+		Serial.println(_queue[_queueHead].text);
 #endif
-    delay(250);
-    socketReceive(dataBuf,sizeof(dataBuf),theSocket);
-    //Serial.print(F("socketReceive got "));//Serial.println(dataBuf);
-    if (strncmp(dataBuf,"220",3)==0)
-    {
-      //Serial.println(F("Connection to SMTP server OK"));
-      strcpy(dataBuf,"HELO ");
-	  strcat(dataBuf,loginDomain);
-	  strcat(dataBuf,"\r\n");
-      socketSend(dataBuf,strlen(dataBuf),theSocket);
-      //Serial.println("waiting for 250 message");
-
-      while (socketReceive(dataBuf,sizeof(dataBuf),theSocket)==0)
-      { 
-        //Serial.println(F("No data yet;-)"));
-        delay(SOCKET_RECEIVE_RETRY_TIME);
-      } 
-      //Serial.print("Response was ");//Serial.println(dataBuf);
-  
-      if (strncmp_P(dataBuf,PSTR("250"),3)==0)
-      {
-        //Serial.println("HELO message was OK");
-        strcpy_P(dataBuf,PSTR("MAIL FROM: "));
-		strcat(dataBuf,fromAddress);
-		strcat_P(dataBuf,PSTR("\r\n"));
-        socketSend(dataBuf,strlen(dataBuf),theSocket);
-        while (socketReceive(dataBuf,sizeof(dataBuf),theSocket)==0)
-        { 
-          //Serial.println(F("Wait socketReceive retry"));
-          delay(SOCKET_RECEIVE_RETRY_TIME);
-        } 
-        //Serial.print(F("socketReceive got "));//Serial.println(dataBuf);
-        }
-        if (strncmp_P(dataBuf,PSTR("250"),3)==0)
-        {
-          //Serial.println(F("MAIL FROM message was OK"));
-          
-          strcpy_P(dataBuf,PSTR("RCPT TO: "));
-  		  strcat(dataBuf,toAddress);
-		  strcat_P(dataBuf,PSTR("\r\n"));
-          socketSend(dataBuf,strlen(dataBuf),theSocket);
-          
-          while (socketReceive(dataBuf,sizeof(dataBuf),theSocket)==0)
-          { 
-            //Serial.println(F("Wait socketReceive retry"));
-            delay(SOCKET_RECEIVE_RETRY_TIME);// if there wasn't any data, wait and try again
-          } 
-          //Serial.print(F("socketReceive 1 got "));
-          //Serial.println(dataBuf);       
-          if (strncmp(dataBuf,"250",3)==0)
-          {
-            //Serial.println(F("RCPT TO message was OK"));
-            
-            strcpy_P(dataBuf,PSTR("DATA\r\n"));
-            socketSend(dataBuf,strlen(dataBuf),theSocket);
-            
-            while (socketReceive(dataBuf,sizeof(dataBuf),theSocket)==0)
-            { 
-              //Serial.println(F("Wait socketReceive retry"));
-              delay(SOCKET_RECEIVE_RETRY_TIME);// if there wasn't any data, wait and try again
-            } 
-            //Serial.print(F("socketReceive got "));//Serial.println(dataBuf);     
-           if (strncmp(dataBuf,"354",3)==0)
-           {
-            //Serial.println(F("DATA message was OK"));
-            
-            strcpy_P(dataBuf,PSTR("SUBJECT: "));
-			strcat(dataBuf,subject);
-			strcat_P(dataBuf,PSTR("\r\n"));
-            socketSend(dataBuf,strlen(dataBuf),theSocket);
-
-            strcpy_P(dataBuf,PSTR("FROM: "));
-			strcat(dataBuf,toFriendlyName);
-			strcat_P(dataBuf,PSTR(" <"));
-            strcat(dataBuf,fromAddress);
-            strcat_P(dataBuf,PSTR(">\r\n"));
-            socketSend(dataBuf,strlen(dataBuf),theSocket);
-            
-            strcpy_P(dataBuf,PSTR("To: "));
-            strcat(dataBuf,toAddress);
-            strcat_P(dataBuf,PSTR("\r\n")) ; 
-            socketSend(dataBuf,strlen(dataBuf),theSocket);
-
-            socketSend(message,strlen(message),theSocket);
-
-            strcpy_P(dataBuf,PSTR("\r\n.\r\n"));// termination string
-            socketSend(dataBuf,strlen(dataBuf),theSocket); 
-            
-            while (socketReceive(dataBuf,sizeof(dataBuf),theSocket)==0)
-            { 
-              //Serial.println("Wait socketReceive retry");
-              delay(SOCKET_RECEIVE_RETRY_TIME);// if there wasn't any data, wait and try again
-            } 
-            //Serial.print(F("socketReceive got"));Serial.println(dataBuf);   
-            if (strncmp_P(dataBuf,PSTR("250"),3)==0)
-            {
-              strcpy_P(dataBuf,PSTR("quit\r\n"));
-              socketSend(dataBuf,strlen(dataBuf),theSocket);   
-              while (socketReceive(dataBuf,sizeof(dataBuf),theSocket)==0)
-              { 
-                //Serial.println(F("Wait socketReceive retry"));
-                delay(SOCKET_RECEIVE_RETRY_TIME);// if there wasn't any data, wait 500ms and try again
-              }            
-            }
-			else
-			{
-			    socketClose(theSocket);
-				return -250;
-			}
-          }
-		  else
-		  {
-				socketClose(theSocket);
-				return -354;
-		  }
-        }
-		else
+		// Responses are matched to commands in the order they were sent, so once one response is missing
+		// the responses to any pipelined commands can't be trusted either. Time them all out.
+		unsigned char inFlight=_inFlight;
+		while (inFlight--)
 		{
-		    socketClose(theSocket);
-			return -250;
+			completeCommand(UARTWIFI_TIMEOUT);
 		}
-      }
-	  else
-	  {
-		socketClose(theSocket);
-		return -250;
-	  }
-    }
-
-    socketClose(theSocket);
-    return 0;
-  }
-  else
-  {
-    //Serial.println(responseCode);
-    return responseCode;
-  }  
+	}
+}
+
+/*
+ * Sends queued commands, so that up to _pipelineDepth commands are waiting for their responses.
+ * By default the depth is 1, i.e each command is sent once the previous one has completed and INTER_COMMAND_DELAY has elapsed.
+ * An AT+SKSND must be the last command sent, as the module treats everything after it as data, until it has sent its response.
+ */
+void UARTWifi::sendQueuedCommands()
+{
+	if (_inFlight==0 && (millis()-_lastCommandTime) < INTER_COMMAND_DELAY)
+	{
+		return;
+	}
+	while (_inFlight<_queueCount && _inFlight<_pipelineDepth)
+	{
+		if (_inFlight>0 && _queue[(_queueHead+_inFlight-1)%UARTWIFI_COMMAND_QUEUE_SIZE].dataDirection==UARTWIFI_DATA_SEND)
+		{
+			return;
+		}
+		if (_inFlight==0)
+		{
+			_framer.reset();
+			_dataReceived=0;
+			_commandState=COMMAND_STATE_WAITING_RESPONSE;
+			_commandStartTime=millis();
+		}
+		UARTWifiCommand *entry = &_queue[(_queueHead+_inFlight)%UARTWIFI_COMMAND_QUEUE_SIZE];
+		_serial->write((const uint8_t *)entry->text,entry->length);
+#if UARTWIFI_STATS
+		entry->statsType=statsCommandType(entry->text);
+		entry->sentMicros=micros();
+		_stats[entry->statsType].bytesOut+=entry->length;
+#endif
+		_inFlight++;
+	}
+}
+
+void UARTWifi::setPipelineDepth(unsigned char depth)
+{
+	if (depth<1)
+	{
+		depth=1;
+	}
+	if (depth>UARTWIFI_COMMAND_QUEUE_SIZE)
+	{
+		depth=UARTWIFI_COMMAND_QUEUE_SIZE;
+	}
+	_pipelineDepth=depth;
+}
+
+void UARTWifi::processByte(char c)
+{
+	UARTWifiCommand *command = &_queue[_queueHead];
+
+#if UARTWIFI_STATS
+	_stats[command->statsType].bytesIn++;
+#endif
+	if (_commandState==COMMAND_STATE_RECEIVING_DATA)
+	{
+		_lastByteTime=millis();
+		if (command->ring)
+		{
+			if (command->ring->put(c))
+			{
+				_dataReceived++;
+			}
+		}
+		else if (_dataReceived<command->dataSize)
+		{
+			command->data[_dataReceived++]=c;
+		}
+		if (--_dataRemaining==0)
+		{
+			completeCommand(_dataReceived);
+		}
+		return;
+	}
+
+	if (!_framer.push(c))
+	{
+		return;
+	}
+
+	parseUARTWifiResponse(_framer.frame(),&_response);// the frame is terminated at the start of the \r\n\r\n
+	int status=responseStatus(&_response);
+	if (status!=0 || command->dataDirection==UARTWIFI_DATA_NONE)
+	{
+		completeCommand(status);
+		return;
+	}
+
+	// Response to SKRCV or SKSND is +OK=<size>
+	_response.type=UARTWIFI_RESPONSE_DATA;
+	int size=_response.value;
+	if (command->dataDirection==UARTWIFI_DATA_SEND)
+	{
+		if (size>command->dataSize)
+		{
+			size=command->dataSize;
+		}
+		completeCommand(writePayload(command->data,size));
+	}
+	else if (size>0)
+	{
+		_dataRemaining=size;
+		_lastByteTime=millis();
+		_commandState=COMMAND_STATE_RECEIVING_DATA;
+	}
+	else
+	{
+		completeCommand(0);
+	}
+}
+
+/*
+ * Writes the data following an AT+SKSND response.
+ * If a CTS pin has been set, each byte is only written when the module is ready to receive it (CTS low).
+ * If the module isn't ready within UARTWIFI_DATA_TIMEOUT, writing stops and the module will send what it has received.
+ */
+int UARTWifi::writePayload(const char *data,int length)
+{
+	if (_ctsPin<0)
+	{
+		return _serial->write((const uint8_t *)data,length);
+	}
+
+	for(int i=0;i<length;i++)
+	{
+		unsigned long startTime = millis();
+		while (digitalRead(_ctsPin)!=LOW)
+		{
+			if ((millis()-startTime) > UARTWIFI_DATA_TIMEOUT)
+			{
+				return i;
+			}
+		}
+		_serial->write(data[i]);
+	}
+	return length;
+}
+
+void UARTWifi::completeCommand(int status)
+{
+	// Remove the command from the queue before calling the callback, so that the callback can queue another command
+	UARTWifiCallback callback = _queue[_queueHead].callback;
+	void *context = _queue[_queueHead].context;
+
+#if UARTWIFI_STATS
+	if (status!=UARTWIFI_RESET)
+	{
+		recordStats(&_queue[_queueHead],status);
+	}
+#endif
+
+	_queueHead=(_queueHead+1)%UARTWIFI_COMMAND_QUEUE_SIZE;
+	_queueCount--;
+	_inFlight--;
+	_lastCommandTime=millis();
+
+	// The response to the next pipelined command (if any) follows straight on
+	_dataReceived=0;
+	_commandStartTime=millis();
+	_commandState = _inFlight ? COMMAND_STATE_WAITING_RESPONSE : COMMAND_STATE_IDLE;
+
+	if (status==UARTWIFI_TIMEOUT)
+	{
+		parseUARTWifiResponse(_framer.frame(),&_response);
+		_response.type=UARTWIFI_RESPONSE_TIMEOUT;
+	}
+
+	if (callback)
+	{
+		callback(status,&_response,context);
+	}
+	_framer.reset();
+}
+
+#if UARTWIFI_STATS
+// Called when a command completes, before the response is passed to its callback
+void UARTWifi::recordStats(UARTWifiCommand *command,int status)
+{
+	UARTWifiCommandStats *stats = &_stats[command->statsType];
+	unsigned long elapsed = micros()-command->sentMicros;
+
+	stats->count++;
+	if (status==UARTWIFI_TIMEOUT)
+	{
+		stats->timeouts++;
+	}
+	else if (_response.type==UARTWIFI_RESPONSE_ERROR)
+	{
+		stats->errors++;
+		stats->lastError=_response.value;
+	}
+	if (command->dataDirection==UARTWIFI_DATA_SEND && status>0)
+	{
+		stats->bytesOut+=status;
+	}
+
+	if (elapsed<stats->minMicros)
+	{
+		stats->minMicros=elapsed;
+	}
+	if (elapsed>stats->maxMicros)
+	{
+		stats->maxMicros=elapsed;
+	}
+	stats->totalMicros+=elapsed;
+
+	unsigned char bucket=0;
+	for(unsigned long ms=elapsed/1000;ms && bucket<UARTWIFI_STATS_BUCKETS-1;ms>>=2)
+	{
+		bucket++;
+	}
+	stats->histogram[bucket]++;
+}
+#endif
+
+UARTWifiCommandStats *UARTWifi::commandStats(unsigned char type)
+{
+#if UARTWIFI_STATS
+	return (type<UARTWIFI_CMD_TYPES) ? &_stats[type] : 0;
+#else
+	return 0;
+#endif
+}
+
+void UARTWifi::resetStats()
+{
+#if UARTWIFI_STATS
+	memset(_stats,0,sizeof(_stats));
+	for(int i=0;i<UARTWIFI_CMD_TYPES;i++)
+	{
+		_stats[i].minMicros=0xFFFFFFFF;
+	}
+#endif
+}
+
+/*
+ * Writes the statistics for each type of command which has been sent, one line per type.
+ * CSV has a header line. JSON is a single object, with a member for each type e.g. {"AT+SKRCV":{"count":12,...},...}
+ */
+void UARTWifi::dumpStats(Print *out,boolean json)
+{
+#if UARTWIFI_STATS
+	if (json)
+	{
+		out->print('{');
+	}
+	else
+	{
+		out->println(F("command,count,timeouts,errors,last_error,bytes_out,bytes_in,min_us,avg_us,max_us,histogram"));
+	}
+
+	boolean first=true;
+	for(int type=0;type<UARTWIFI_CMD_TYPES;type++)
+	{
+		UARTWifiCommandStats *stats = &_stats[type];
+		if (stats->count==0)
+		{
+			continue;
+		}
+		const __FlashStringHelper *name = (const __FlashStringHelper *)STATS_COMMAND_NAMES[type];
+		if (json)
+		{
+			if (!first)
+			{
+				out->print(',');
+			}
+			out->print('"');
+			out->print(name);
+			out->print(F("\":{\"count\":"));
+			out->print(stats->count);
+			out->print(F(",\"timeouts\":"));
+			out->print(stats->timeouts);
+			out->print(F(",\"errors\":"));
+			out->print(stats->errors);
+			out->print(F(",\"last_error\":"));
+			out->print(stats->lastError);
+			out->print(F(",\"bytes_out\":"));
+			out->print(stats->bytesOut);
+			out->print(F(",\"bytes_in\":"));
+			out->print(stats->bytesIn);
+			out->print(F(",\"min_us\":"));
+			out->print(stats->minMicros);
+			out->print(F(",\"avg_us\":"));
+			out->print(stats->totalMicros/stats->count);
+			out->print(F(",\"max_us\":"));
+			out->print(stats->maxMicros);
+			out->print(F(",\"histogram\":["));
+		}
+		else
+		{
+			out->print(name);
+			out->print(',');
+			out->print(stats->count);
+			out->print(',');
+			out->print(stats->timeouts);
+			out->print(',');
+			out->print(stats->errors);
+			out->print(',');
+			out->print(stats->lastError);
+			out->print(',');
+			out->print(stats->bytesOut);
+			out->print(',');
+			out->print(stats->bytesIn);
+			out->print(',');
+			out->print(stats->minMicros);
+			out->print(',');
+			out->print(stats->totalMicros/stats->count);
+			out->print(',');
+			out->print(stats->maxMicros);
+			out->print(',');
+		}
+		// Histogram buckets are separated by spaces in CSV, so they stay in one column
+		for(int i=0;i<UARTWIFI_STATS_BUCKETS;i++)
+		{
+			if (i)
+			{
+				out->print(json?',':' ');
+			}
+			out->print(stats->histogram[i]);
+		}
+		if (json)
+		{
+			out->print(F("]}"));
+		}
+		else
+		{
+			out->println();
+		}
+		first=false;
+	}
+
+	if (json)
+	{
+		out->println('}');
+	}
+#endif
+}
+
+// Maps a response to the status returned by the blocking methods
+int UARTWifi::responseStatus(UARTWifiResponse *response)
+{
+	switch(response->type)
+	{
+		case UARTWIFI_RESPONSE_OK:
+		case UARTWIFI_RESPONSE_OK_VALUE:
+			return 0;
+		case UARTWIFI_RESPONSE_ERROR:
+			return response->value;
+		case UARTWIFI_RESPONSE_TIMEOUT:
+			return UARTWIFI_TIMEOUT;
+		default:
+			return UARTWIFI_BAD_RESPONSE;
+	}
+}
+
+UARTWifiResponse *UARTWifi::lastResponse()
+{
+	return &_response;
+}
+
+void UARTWifi::blockingCommandComplete(int status,UARTWifiResponse *response,void *context)
+{
+	BlockingResult *result = (BlockingResult *)context;
+
+	if (result->responseBuf && result->responseBuf!=response->text)
+	{
+		strncpy(result->responseBuf,response->text,result->responseBufSize-1);
+		result->responseBuf[result->responseBufSize-1]=0;
+	}
+	result->status=status;
+	result->done=true;
+}
+
+/*
+ * Queues a command and waits for it to complete.
+ * Any commands already in the queue are completed first.
+ */
+int UARTWifi::runCommand(const char *command,int timeoutMillis,char *responseBuf,int responseBufSize,unsigned char dataDirection,char *data,int dataSize,UARTWifiRingBuffer *ring)
+{
+	BlockingResult result;
+	UARTWifiCommand *entry;
+
+	result.done=false;
+	result.status=UARTWIFI_TIMEOUT;
+	result.responseBuf=responseBuf;
+	result.responseBufSize=responseBufSize;
+
+	while (!(entry = queueEntry(command,timeoutMillis,blockingCommandComplete,&result)))
+	{
+		if (_queueCount==0)
+		{
+			return -1;// Command is too long to be queued
+		}
+		poll();
+	}
+	entry->dataDirection=dataDirection;
+	entry->data=data;
+	entry->dataSize=dataSize;
+	entry->ring=ring;
+
+	while (!result.done)
+	{
+		poll();
+	}
+	return result.status;
+}
+
+int UARTWifi::enterCommandMode(int timeout)
+{
+	return runCommand("+++",timeout)!=UARTWIFI_TIMEOUT;
+}
+
+int UARTWifi::sendAT(int timeout)
+{
+	return runCommand("AT+\r",timeout)!=UARTWIFI_TIMEOUT;
+}
+
+// Returns 0 for +OK, the error code for +ERR=<code>, or UARTWIFI_BAD_RESPONSE
+int UARTWifi::getResponseStatus(char *responseBuf)
+{
+	UARTWifiResponse response;
+
+	parseUARTWifiResponse(responseBuf,&response);
+	return responseStatus(&response);
+}
+
+int UARTWifi::socketCreate(const char *protocol,const char *clientOrServer,const char *host,const char *portNumber,int *socketNumCreated)
+{
+#if DEBUG_LEVEL > 0
+	Serial.println(F("socketCreate "));
+#endif
+	char command[UARTWIFI_COMMAND_LENGTH];
+
+	if (formatCommand(command,sizeof(command),CMD_SOCKET_CREATE,protocol,clientOrServer,host,portNumber)<0)
+	{
+		return -1;// host name is too long to fit in the command
+	}
+	int status = runCommand(command,5000);
+	if (status==0)
+	{
+		// Response is +OK=<socket>
+		*socketNumCreated = _response.value;
+	}
+#if DEBUG_LEVEL > 0
+	else
+	{
+		Serial.println(F("ERROR in getResponseStatus in create socket"));
+	}
+#endif
+	return status;// 0, the error code or UARTWIFI_TIMEOUT
+}
+
+int UARTWifi::socketGetConnectionState(char *buffer,int socketNum,int bufferSize)
+{
+// ---------------WARNING Not fully tested code ---------------------------
+
+char command[16];
+#if DEBUG_LEVEL > 0  
+	Serial.println(F("Sending AT+SKSTT"));
+#endif	
+	if (formatCommand(command,sizeof(command),CMD_SOCKET_STATE,socketNum)<0)
+	{
+		return -1;
+	}
+	return runCommand(command,5000,buffer,bufferSize);
+}
+
+int UARTWifi::socketClose(int socketNum)
+{
+#if DEBUG_LEVEL > 0  
+	Serial.print(F("socketClose "));
+	Serial.println(socketNum,DEC);
+#endif
+	char command[16];
+	if (formatCommand(command,sizeof(command),CMD_SOCKET_CLOSE,socketNum)<0)
+	{
+		return -1;
+	}
+	return runCommand(command,5000);
+}
+
+int UARTWifi::socketReceive(char *buffer,int buffSize,int socketNum)
+{
+  char command[24];
+
+#if DEBUG_LEVEL > 0 
+	Serial.println("socketReceive");
+#endif	
+
+  buffSize--;// Allow space for the null terminator
+  if (formatCommand(command,sizeof(command),CMD_SOCKET_RECEIVE,socketNum,buffSize)<0)
+  {
+    return -1;
+  }
+
+  int received = runCommand(command,10000,0,0,UARTWIFI_DATA_RECEIVE,buffer,buffSize);
+  if (received>=0)
+  {
+    buffer[received]=0;// Terminate buffer for debugging
+  }
+#if DEBUG_LEVEL > 0	
+  else
+  {
+    Serial.println(F("Error. Incorrect buffer size."));
+  }
+#endif	  
+  return received;
+}
+
+/*
+ * Receives as much data as will fit into the ring buffer.
+ * The data can then be parsed in place using ring->spans() and removed with ring->consume()
+ * Returns the number of bytes received, the error code or UARTWIFI_TIMEOUT
+ */
+int UARTWifi::socketReceive(UARTWifiRingBuffer *ring,int socketNum)
+{
+  char command[24];
+
+  if (ring->space()==0)
+  {
+    return 0;
+  }
+  if (formatCommand(command,sizeof(command),CMD_SOCKET_RECEIVE,socketNum,ring->space())<0)
+  {
+    return -1;
+  }
+
+  return runCommand(command,10000,0,0,UARTWIFI_DATA_RECEIVE,0,0,ring);
+}
+
+/*
+ * Adaptive polling for received data.
+ * Repeats AT+SKRCV until some data is received. After each empty receive the retry time is doubled (from minRetryMillis up to maxRetryMillis),
+ * so a quick reply is picked up quickly, without flooding the module with commands when the reply takes a long time.
+ * If a data ready pin has been set, the wait is ended early as soon as the pin goes to its active level.
+ */
+void UARTWifi::setReceivePolling(int minRetryMillis,int maxRetryMillis,long deadlineMillis)
+{
+	_minRetryMillis=minRetryMillis;
+	_maxRetryMillis=maxRetryMillis;
+	_receiveDeadlineMillis=deadlineMillis;
+}
+
+// Set pin to -1 if there isn't a data available signal wired from the module (e.g from a GPIO configured by AT+IOM)
+void UARTWifi::setDataReadyPin(int pin,boolean activeLevel)
+{
+	_dataReadyPin=pin;
+	_dataReadyLevel=activeLevel;
+	if (pin>=0)
+	{
+		pinMode(pin,INPUT);
+	}
+}
+
+// Returns the number of bytes received, the error code, or UARTWIFI_TIMEOUT if nothing was received before the deadline
+int UARTWifi::socketReceiveWait(char *buffer,int buffSize,int socketNum)
+{
+	unsigned long startTime = millis();
+	unsigned long retryMillis = _minRetryMillis;
+
+	while(true)
+	{
+		int received = socketReceive(buffer,buffSize,socketNum);
+		if (received>0)
+		{
+			return received;
+		}
+		if (received<0)
+		{
+			*buffer=0;// don't leave a previous response in the buffer
+			return received;
+		}
+
+		unsigned long retryTime = millis();
+		while ((millis()-retryTime) < retryMillis)
+		{
+			if (_dataReadyPin>=0 && digitalRead(_dataReadyPin)==_dataReadyLevel)
+			{
+				break;
+			}
+			if ((millis()-startTime) >= (unsigned long)_receiveDeadlineMillis)
+			{
+				*buffer=0;
+				return UARTWIFI_TIMEOUT;
+			}
+			poll();// keep any other queued commands moving
+		}
+
+		retryMillis*=2;
+		if (retryMillis>(unsigned long)_maxRetryMillis)
+		{
+			retryMillis=_maxRetryMillis;
+		}
+	}
+}
+
+int UARTWifi::socketSend(char *buffer,int buffSize,int socketNum)
+{
+  char command[24];
+
+#if DEBUG_LEVEL > 0  
+  Serial.println(F("socketSend..."));
+#endif  
+  if (formatCommand(command,sizeof(command),CMD_SOCKET_SEND,socketNum,buffSize)<0)
+  {
+    return -1;
+  }
+
+  return runCommand(command,5000,0,0,UARTWIFI_DATA_SEND,buffer,buffSize);// number of bytes sent, or error
+}
+
+/*
+ * Sends all the data from the source, in as many AT+SKSND commands as needed.
+ * Each command sends no more than the module says it will accept, and anything it doesn't accept is sent by the next command.
+ * Data in RAM is sent directly from the caller's buffer. Other data is copied through a UARTWIFI_SEND_CHUNK_SIZE buffer.
+ * If the module accepts nothing because its buffer is full, the next command is sent after a retry time which doubles each time, or as soon as
+ * the CTS pin (if set) shows the module is ready. Queued commands are polled while waiting.
+ * Returns the total number of bytes sent, or the error code, or UARTWIFI_TIMEOUT if the module accepted nothing for the send stall timeout
+ */
+long UARTWifi::socketSendStream(UARTWifiSource *source,int socketNum)
+{
+	char chunk[UARTWIFI_SEND_CHUNK_SIZE];
+	int staged=0;
+	long total=0;
+	unsigned long lastSentTime = millis();
+	unsigned long retryMillis = SOCKET_SEND_MIN_RETRY_TIME;
+
+	while(true)
+	{
+		int length;
+		char *data = (char *)source->direct(&length);
+		if (data)
+		{
+			if (length>UARTWIFI_MAX_SEND_SIZE)
+			{
+				length=UARTWIFI_MAX_SEND_SIZE;
+			}
+		}
+		else
+		{
+			staged+=source->read(chunk+staged,sizeof(chunk)-staged);
+			data=chunk;
+			length=staged;
+		}
+		if (length==0)
+		{
+			return total;
+		}
+
+		int sent = socketSend(data,length,socketNum);
+		if (sent<0)
+		{
+			return sent;
+		}
+		if (sent==0)
+		{
+			// The module's buffer is full. Give it time to send some of it, rather than asking again straight away
+			unsigned long retryTime = millis();
+			while ((millis()-retryTime) < retryMillis)
+			{
+				if (_ctsPin>=0 && digitalRead(_ctsPin)==LOW)
+				{
+					break;
+				}
+				if ((millis()-lastSentTime) > (unsigned long)_sendStallMillis)
+				{
+					return UARTWIFI_TIMEOUT;
+				}
+				poll();
+			}
+			retryMillis*=2;
+			if (retryMillis>SOCKET_SEND_MAX_RETRY_TIME)
+			{
+				retryMillis=SOCKET_SEND_MAX_RETRY_TIME;
+			}
+			continue;
+		}
+
+		lastSentTime=millis();
+		retryMillis=SOCKET_SEND_MIN_RETRY_TIME;
+		total+=sent;
+		if (data==chunk)
+		{
+			staged-=sent;
+			memmove(chunk,chunk+sent,staged);
+		}
+		else
+		{
+			source->skip(sent);
+		}
+	}
+}
+
+// Set pin to the Arduino pin connected to the module's RTS output, to use hardware flow control when sending data. -1 disables it
+void UARTWifi::setClearToSendPin(int pin)
+{
+	_ctsPin=pin;
+	if (pin>=0)
+	{
+		pinMode(pin,INPUT);
+	}
+}
+
+// How long socketSendStream() keeps trying while the module accepts no data, before returning UARTWIFI_TIMEOUT
+void UARTWifi::setSendStallTimeout(long timeoutMillis)
+{
+	_sendStallMillis=timeoutMillis;
+}
+
+/*
+ * Bulk transfer using transparent mode.
+ * The socket is made the default socket and the module is put into transparent mode, so data is sent and received
+ * at the full serial data rate, without the overhead of AT+SKSND / AT+SKRCV commands.
+ * All the outgoing data is sent, while any incoming data is passed to the incoming callback as it arrives.
+ * Once all the data has been sent and no data has been received for idleTimeoutMillis, the module is returned to command mode
+ * using the +++ escape sequence, with the guard time either side of it, and the socket state is checked.
+ *
+ * outgoing and incoming can be null, for receive or send only transfers.
+ * Returns the number of bytes sent, the error code, UARTWIFI_TIMEOUT if the module doesn't return to command mode or stops
+ * accepting data (CTS stays high for UARTWIFI_DATA_TIMEOUT), or UARTWIFI_NOT_CONNECTED if the socket was closed during the transfer.
+ */
+long UARTWifi::bulkTransfer(int socketNum,UARTWifiSource *outgoing,UARTWifiSinkCallback incoming,void *context,int idleTimeoutMillis)
+{
+	char outBlock[BULK_WRITE_BLOCK_SIZE];
+	char block[BULK_READ_BUFFER_SIZE];
+	int outLength=0;
+	int outOffset=0;// the part of outBlock before this has been written
+	boolean stalled=false;
+	long sent=0;
+	int status;
+
+	// Finish any queued commands, otherwise their responses would be mixed up with the transparent data
+	while (_queueCount>0)
+	{
+		poll();
+	}
+
+	status = setDefaultSocket(socketNum);
+	if (status==0)
+	{
+		status = enterTransparentMode();
+	}
+	if (status!=0)
+	{
+		return status;
+	}
+
+	unsigned long lastActivityTime = millis();
+	while(true)
+	{
+		if (outgoing && outOffset==outLength)
+		{
+			outLength = outgoing->read(outBlock,BULK_WRITE_BLOCK_SIZE);
+			outOffset=0;
+		}
+		int length=outLength-outOffset;
+		if (length>0)
+		{
+			// A short write means CTS timed out. The rest of the block is kept, and written after reading any received data
+			int written=writePayload(outBlock+outOffset,length);
+			if (written==0)
+			{
+				stalled=true;
+				break;
+			}
+			outOffset+=written;
+			sent+=written;
+			lastActivityTime=millis();
+		}
+
+		int received=0;
+		while (received<BULK_READ_BUFFER_SIZE && _serial->available())
+		{
+			block[received++]=_serial->read();
+		}
+		if (received>0)
+		{
+			if (incoming)
+			{
+				incoming(block,received,context);
+			}
+			lastActivityTime=millis();
+		}
+
+		if (length==0 && received==0 && (millis()-lastActivityTime) > (unsigned long)idleTimeoutMillis)
+		{
+			break;
+		}
+	}
+
+	status = leaveTransparentMode(socketNum,incoming,context);
+	if (status==0 && stalled)
+	{
+		status=UARTWIFI_TIMEOUT;
+	}
+	return status==0 ? sent : status;
+}
+
+// Passes c to the incoming callback, via block, which is sent to the callback when it is full
+static void sinkByte(char c,char *block,int *received,UARTWifiSinkCallback incoming,void *context)
+{
+	if (*received==BULK_READ_BUFFER_SIZE)
+	{
+		incoming(block,*received,context);
+		*received=0;
+	}
+	block[(*received)++]=c;
+}
+
+// Sends the +++ escape sequence, passing any data received before the module's +OK to the incoming callback, then checks the socket is still connected
+int UARTWifi::leaveTransparentMode(int socketNum,UARTWifiSinkCallback incoming,void *context)
+{
+	char block[BULK_READ_BUFFER_SIZE];
+	unsigned long startTime;
+
+	startTime = millis();
+	while ((millis()-startTime) < UARTWIFI_ESCAPE_GUARD_TIME)
+	{
+		int received=0;
+		while (received<BULK_READ_BUFFER_SIZE && _serial->available())
+		{
+			block[received++]=_serial->read();
+		}
+		if (received>0 && incoming)
+		{
+			incoming(block,received,context);
+		}
+	}
+
+	// Data can still arrive until the module has replied. Only bytes which might be the start of the reply are held back
+	_serial->print(F("+++"));
+	startTime = millis();
+	int received=0;
+	unsigned char matched=0;// characters of ESCAPE_REPLY matched
+	while (true)
+	{
+		if ((millis()-startTime) > 2*UARTWIFI_ESCAPE_GUARD_TIME)
+		{
+			return UARTWIFI_TIMEOUT;
+		}
+		if (!_serial->available())
+		{
+			if (received>0 && incoming)
+			{
+				incoming(block,received,context);
+			}
+			received=0;
+			continue;
+		}
+
+		char c=_serial->read();
+		if (c==(char)pgm_read_byte(ESCAPE_REPLY+matched))
+		{
+			if (pgm_read_byte(ESCAPE_REPLY+(++matched))==0)
+			{
+				break;
+			}
+			continue;
+		}
+		if (incoming)
+		{
+			// Not the reply after all, so what was held back was data
+			for(unsigned char i=0;i<matched;i++)
+			{
+				sinkByte(pgm_read_byte(ESCAPE_REPLY+i),block,&received,incoming,context);
+			}
+			if (c!=(char)pgm_read_byte(ESCAPE_REPLY))
+			{
+				sinkByte(c,block,&received,incoming,context);
+			}
+		}
+		matched = (c==(char)pgm_read_byte(ESCAPE_REPLY)) ? 1 : 0;
+	}
+	if (received>0 && incoming)
+	{
+		incoming(block,received,context);
+	}
+	_lastCommandTime=millis();
+
+	// Check that the socket is still connected. The response is +OK=<socket>,<status>,... where status 2 is connected
+	int status = socketGetConnectionState(_gResponseBuf,socketNum,sizeof(_gResponseBuf));
+	if (status!=0)
+	{
+		return status;
+	}
+	char *end;
+	if (*_response.fields!=',' || parseUARTWifiNumber(_response.fields+1,&end)!=2)
+	{
+		return UARTWIFI_NOT_CONNECTED;
+	}
+	return 0;
+}
+
+int UARTWifi::setDefaultSocket(int socketNum)
+{
+	char command[16];
+	if (formatCommand(command,sizeof(command),CMD_SET_DEFAULT_SOCKET,socketNum)<0)
+	{
+		return -1;
+	}
+	int responseStatus = runCommand(command,5000);
+#if DEBUG_LEVEL > 0		
+	if (responseStatus==UARTWIFI_TIMEOUT)
+	{
+		Serial.println(F("Timeout trying to set default socket"));
+	}
+#endif		
+	return responseStatus;
+}
+int UARTWifi::getNetworkStatus(char *buffer,int bufferSize)
+{
+#if DEBUG_LEVEL > 0  
+	Serial.println(F("Sending AT+LKSTT"));
+#endif	
+	return runCommand("AT+LKSTT\r",5000,buffer,bufferSize);
+}
+
+int UARTWifi::enterTransparentMode()
+{
+	return runCommand("AT+ENTM\r",5000);
+}
+
+// Returns 0 once the network link is up, or UARTWIFI_TIMEOUT if it isn't within timeoutMillis (0 waits forever)
+int UARTWifi::waitForNetworkToConnect(long timeoutMillis)
+{
+  unsigned long startTime = millis();
+
+  while(true)
+  {
+      getNetworkStatus(_gResponseBuf,sizeof(_gResponseBuf));
+#if DEBUG_LEVEL > 0		  
+      Serial.println(_gResponseBuf);
+#endif	  
+      // Response is +OK=<status>,<ip>,... where status 1 is connected
+      if (_response.type==UARTWIFI_RESPONSE_OK_VALUE && _response.value==1)
+      {
+#if DEBUG_LEVEL > 0  
+		Serial.println(F("Network was connected"));
+#endif		
+        return 0;
+      }
+      else
+      {
+#if DEBUG_LEVEL > 0  
+		Serial.println(F("Waiting for network to be connected"));
+#endif		
+        if (timeoutMillis>0 && (millis()-startTime) >= (unsigned long)timeoutMillis)
+        {
+          return UARTWIFI_TIMEOUT;
+        }
+        delay(1000);// wait 1000ms before we re-try
+      }
+  }
+}
+
+int UARTWifi::getAutoWorkSocketInfo(char *responseBuf,int bufferSize)
+{
+#if DEBUG_LEVEL > 0
+	Serial.println(F("Sending AT+ATRM"));
+#endif	
+	return runCommand("AT+ATRM\r",5000,responseBuf,bufferSize);
+}
+
+/*
+ * Sends a single email. To send several, use a UARTWifiSmtpSession, which keeps the connection open between messages
+ */
+int UARTWifi::sendEmail(char *toAddress,char *fromAddress,char *toFriendlyName,char *subject,char *message,char *loginDomain,char *mailServer)
+{
+	UARTWifiSmtpSession session(this,mailServer,loginDomain);
+
+	int status = session.send(toAddress,fromAddress,toFriendlyName,subject,message);
+	session.close();
+	return status;
 }
\ No newline at end of file
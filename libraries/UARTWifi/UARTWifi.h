@@ -18,7 +18,7 @@
  * <http://www.gnu.org/licenses/>.
  *
  */
-#ifndef WifiUart_h
+#ifndef UARTWifi_h
 #define UARTWifi_h
 
 #if defined(ARDUINO) && ARDUINO >= 100
@@ -26,6 +26,136 @@
 #else
     #include "WProgram.h"
 #endif
+#include "UARTWifiFramer.h"
+#include "UARTWifiRingBuffer.h"
+#include "UARTWifiSource.h"
+#include "UARTWifiResponse.h"
+
+// Set to 1 to collect per command statistics, see dumpStats(). When 0 the statistics take no RAM or time.
+// Change it here, or with a compiler flag, rather than in the sketch, as the library is compiled separately from the sketch
+#ifndef UARTWIFI_STATS
+#define UARTWIFI_STATS 0
+#endif
+
+// Size of the queue of pending AT commands and the maximum length of a single command (including the terminating null)
+#define UARTWIFI_COMMAND_QUEUE_SIZE 3
+#define UARTWIFI_COMMAND_LENGTH 64
+#define UARTWIFI_RESPONSE_BUFFER_SIZE 96
+
+// Whether a command has a block of binary data following its +OK=<n> response
+#define UARTWIFI_DATA_NONE 0
+#define UARTWIFI_DATA_RECEIVE 1
+#define UARTWIFI_DATA_SEND 2
+
+// Maximum gap between the bytes of the data following an SKRCV response, before the read is treated as short
+#define UARTWIFI_DATA_TIMEOUT 1000
+
+// Largest block of data sent with one AT+SKSND, and the size of the RAM buffer used to send data from PROGMEM or a callback
+#define UARTWIFI_MAX_SEND_SIZE 1024
+#define UARTWIFI_SEND_CHUNK_SIZE 64
+
+// Default time socketSendStream() waits for the module to accept more data, when its buffer is full, before giving up
+#define UARTWIFI_SEND_STALL_TIMEOUT 10000
+
+/*
+ * Results returned by the blocking methods and passed to callbacks, other than 0 (+OK), +ERR codes from the module, and byte counts.
+ */
+#define UARTWIFI_TIMEOUT -200			// The module didn't respond in time
+#define UARTWIFI_NOT_CONNECTED -201	// Returned by bulkTransfer() if the socket was closed during the transfer
+#define UARTWIFI_BAD_RESPONSE -202		// The response wasn't +OK or +ERR=
+#define UARTWIFI_MAIL_QUEUE_FULL -203	// UARTWifiMailQueue::enqueue(). All the slots are in use
+#define UARTWIFI_MAIL_TOO_LONG -204	// UARTWifiMailQueue::enqueue(). The message doesn't fit in a slot
+#define UARTWIFI_RESET -205			// Passed to the callbacks of commands which were queued when beginReset() was called
+#define UARTWIFI_SMTP_ERROR -250		// sendEmail(). The SMTP server rejected a command
+#define UARTWIFI_SMTP_DATA_ERROR -354	// sendEmail(). The SMTP server didn't accept the DATA command
+
+// Time without any serial data, either side of the +++ escape sequence, needed for the module to recognise it
+#define UARTWIFI_ESCAPE_GUARD_TIME 1000
+
+// Readiness states, see beginReset()
+#define UARTWIFI_READY_IDLE 0		// beginReset() hasn't been called
+#define UARTWIFI_READY_RESETTING 1	// the reset pin is low
+#define UARTWIFI_READY_BOOTING 2		// waiting to send the next probe
+#define UARTWIFI_READY_PROBING 3		// waiting for the response to +++
+#define UARTWIFI_READY_LINK_WAIT 4	// waiting to send the next AT+LKSTT
+#define UARTWIFI_READY_LINK_QUERY 5	// waiting for the response to AT+LKSTT
+#define UARTWIFI_READY 6				// in command mode, and the network link is up if it was waited for
+#define UARTWIFI_READY_FAILED 7		// not ready before the timeout
+
+// Default time beginReset() allows for the module to become ready
+#define UARTWIFI_READY_TIMEOUT 20000
+
+// Times, in ms from the start of the reset, recorded by beginReset()
+typedef struct
+{
+	unsigned long	resetTime;// millis() when the reset started
+	unsigned long	rtsMillis;// nRTS signalled ready, or 0 if it didn't (or isn't connected)
+	unsigned long	bootMillis;// the module responded to +++
+	unsigned long	linkMillis;// the network link was up, or 0 if it wasn't waited for
+	unsigned long	readyMillis;// ready, or failed
+	unsigned char	probes;// number of +++ sent
+	unsigned char	linkQueries;// number of AT+LKSTT sent
+} UARTWifiReadyStats;
+
+// Command types which statistics are kept for
+#define UARTWIFI_CMD_ESCAPE 0	// +++
+#define UARTWIFI_CMD_AT 1		// AT+
+#define UARTWIFI_CMD_SKCT 2
+#define UARTWIFI_CMD_SKSTT 3
+#define UARTWIFI_CMD_SKCLS 4
+#define UARTWIFI_CMD_SKRCV 5
+#define UARTWIFI_CMD_SKSND 6
+#define UARTWIFI_CMD_SKSDF 7
+#define UARTWIFI_CMD_LKSTT 8
+#define UARTWIFI_CMD_ENTM 9
+#define UARTWIFI_CMD_ATRM 10
+#define UARTWIFI_CMD_OTHER 11
+#define UARTWIFI_CMD_TYPES 12
+
+// Latency histogram. Bucket 0 is under 1ms, bucket n is 4^(n-1) to 4^n ms, and the last bucket is everything longer
+#define UARTWIFI_STATS_BUCKETS 8
+
+typedef struct
+{
+	unsigned long	count;// commands completed, including timeouts and errors
+	unsigned int	timeouts;
+	unsigned int	errors;// +ERR responses
+	int				lastError;// code of the last +ERR
+	unsigned long	bytesOut;// command text and data sent
+	unsigned long	bytesIn;// responses and data received
+	unsigned long	minMicros;// latency, from sending the command to the end of its response or data
+	unsigned long	maxMicros;
+	unsigned long	totalMicros;
+	unsigned int	histogram[UARTWIFI_STATS_BUCKETS];
+} UARTWifiCommandStats;
+
+/*
+ * Completion callback for queued commands.
+ * status is 0 for +OK, the +ERR code if the module returned an error, UARTWIFI_TIMEOUT or UARTWIFI_BAD_RESPONSE
+ * For commands with a data phase, status is the number of data bytes received or sent.
+ * response is the parsed module response, and is only valid until the callback returns.
+ */
+typedef void (*UARTWifiCallback)(int status,UARTWifiResponse *response,void *context);
+
+// Called with data received during a bulk transfer
+typedef void (*UARTWifiSinkCallback)(char *data,int length,void *context);
+
+typedef struct
+{
+	char				text[UARTWIFI_COMMAND_LENGTH];
+	unsigned char		length;
+	int					timeoutMillis;
+	unsigned char		dataDirection;
+	char				*data;
+	int					dataSize;
+	UARTWifiRingBuffer	*ring;// if set, received data is put into the ring buffer rather than data
+	UARTWifiCallback	callback;
+	void				*context;
+#if UARTWIFI_STATS
+	unsigned char		statsType;
+	unsigned long		sentMicros;
+#endif
+} UARTWifiCommand;
 
 class UARTWifi 
 {
@@ -33,34 +163,122 @@ class UARTWifi
     UARTWifi(Stream *serial,int resetPin,int rtsPin);// constructor
 	// Low level commands
 
-	void resetModuleUsingRTS();
+	int resetModuleUsingRTS(long timeoutMillis=UARTWIFI_READY_TIMEOUT);
 	void resetModuleUsingDelay(int delayMS=5000) ;// delay after resetting 5000ms normally seems enough.
-	int waitCommandComplete(char *responseBuf,int timeoutMillis);
-	int waitDataPattern(char *responseBuf,char *pattern,int timeoutMillis);
+	void beginReset(boolean waitForLink=true,long timeoutMillis=UARTWIFI_READY_TIMEOUT);
+	int resetUntilReady(boolean waitForLink=true,long timeoutMillis=UARTWIFI_READY_TIMEOUT);
+	unsigned char readyState();
+	UARTWifiReadyStats *readyStats();
+	void setReadyInterrupt(int interruptNum);// the external interrupt the RTS pin is connected to, e.g. 0 for pin 2 on an UNO
+	int waitCommandComplete(char *responseBuf,int timeoutMillis,int responseBufSize=UARTWIFI_RESPONSE_BUFFER_SIZE);
+	int waitDataPattern(char *responseBuf,char *pattern,int timeoutMillis,int responseBufSize=UARTWIFI_RESPONSE_BUFFER_SIZE);
 	int enterCommandMode(int timeout=100);
 	int sendAT(int timeout=500);
 	int getResponseStatus(char *responseBuf);
-	int socketCreate(char *protocol,char *clientOrServer,char *host,char *portNumber,int *socketNumCreated);
-	int socketGetConnectionState(char *buffer,int socketNum);
+	UARTWifiResponse *lastResponse();// the response to the last command which completed
+	int socketCreate(const char *protocol,const char *clientOrServer,const char *host,const char *portNumber,int *socketNumCreated);
+	// Without bufferSize, buffer must be at least UARTWIFI_RESPONSE_BUFFER_SIZE bytes. Longer responses are truncated to fit
+	int socketGetConnectionState(char *buffer,int socketNum,int bufferSize=UARTWIFI_RESPONSE_BUFFER_SIZE);
 	int socketClose(int socketNum);
 	int socketReceive(char *buffer,int buffSize,int socketNum);
+	int socketReceive(UARTWifiRingBuffer *ring,int socketNum);
+	int socketReceiveWait(char *buffer,int buffSize,int socketNum);
+	void setReceivePolling(int minRetryMillis,int maxRetryMillis,long deadlineMillis);
+	void setDataReadyPin(int pin,boolean activeLevel=LOW);
 	int socketSend(char *buffer,int buffSize,int socketNum);
+	long socketSendStream(UARTWifiSource *source,int socketNum);
+	void setClearToSendPin(int pin);
+	void setSendStallTimeout(long timeoutMillis);
+	long bulkTransfer(int socketNum,UARTWifiSource *outgoing,UARTWifiSinkCallback incoming,void *context=0,int idleTimeoutMillis=1000);
 	int setDefaultSocket(int socketNum);
-	int getNetworkStatus(char *buffer);
+	int getNetworkStatus(char *buffer,int bufferSize=UARTWIFI_RESPONSE_BUFFER_SIZE);// buffer must be at least UARTWIFI_RESPONSE_BUFFER_SIZE bytes without bufferSize
 	int enterTransparentMode();
-	void waitForNetworkToConnect();
-	int getAutoWorkSocketInfo(char *responseBuf);
+	int waitForNetworkToConnect(long timeoutMillis=0);// 0 waits forever
+	int getAutoWorkSocketInfo(char *responseBuf,int bufferSize=UARTWIFI_RESPONSE_BUFFER_SIZE);// as getNetworkStatus()
+
+	// Asynchronous commands. Commands are queued and processed by poll(), which must be called regularly e.g. from loop()
+	int queueCommand(const char *command,int timeoutMillis,UARTWifiCallback callback=0,void *context=0);
+	int queueSocketReceive(char *buffer,int buffSize,int socketNum,UARTWifiCallback callback,void *context=0);
+	int queueSocketReceive(UARTWifiRingBuffer *ring,int socketNum,UARTWifiCallback callback,void *context=0);
+	int queueSocketSend(char *buffer,int buffSize,int socketNum,UARTWifiCallback callback,void *context=0);
+	int queueSocketCreate(const char *protocol,const char *clientOrServer,const char *host,const char *portNumber,UARTWifiCallback callback,void *context=0);
+	int queueSocketClose(int socketNum,UARTWifiCallback callback,void *context=0);
+	void poll();
+	int commandsPending();
+	void setPipelineDepth(unsigned char depth);// maximum number of commands sent before their responses are received
+
+	// Statistics. Only collected if UARTWIFI_STATS is 1
+	UARTWifiCommandStats *commandStats(unsigned char type);// type is UARTWIFI_CMD_..., returns 0 if statistics aren't being collected
+	void resetStats();
+	void dumpStats(Print *out,boolean json=false);// writes CSV, or JSON
 	
 	// High level commands
 	int sendEmail(char *toAddress,char *fromAddress,char *toFriendlyName,char *subject,char *message,char *loginDomain,char *mailServer);
 	
   private:
-	void debounce(int pin,boolean desiredValue,int delayMS);
+	boolean debounce(int pin,boolean desiredValue,int delayMS,long timeoutMillis);
+	void readyStep();
+	void setReadyState(unsigned char state);
+	boolean rtsSignalledReady();
+	static void probeComplete(int status,UARTWifiResponse *response,void *context);
+	static void linkQueryComplete(int status,UARTWifiResponse *response,void *context);
+	static void rtsInterrupt();
+#if UARTWIFI_STATS
+	void recordStats(UARTWifiCommand *command,int status);
+#endif
+	UARTWifiCommand *queueEntry(const char *command,int timeoutMillis,UARTWifiCallback callback,void *context);
+	int runCommand(const char *command,int timeoutMillis,char *responseBuf=0,int responseBufSize=0,unsigned char dataDirection=UARTWIFI_DATA_NONE,char *data=0,int dataSize=0,UARTWifiRingBuffer *ring=0);
+	void sendQueuedCommands();
+	void processByte(char c);
+	void completeCommand(int status);
+	int writePayload(const char *data,int length);
+	int leaveTransparentMode(int socketNum,UARTWifiSinkCallback incoming,void *context);
+	int responseStatus(UARTWifiResponse *response);
+	static void blockingCommandComplete(int status,UARTWifiResponse *response,void *context);
   
 	Stream 	*_serial;
 	int 	_resetPin;
 	int		_rtsPin;
-	char 	_gResponseBuf[96];// Probably not the most efficient way to do this, but it works !
+	char 	_gResponseBuf[UARTWIFI_RESPONSE_BUFFER_SIZE];// Probably not the most efficient way to do this, but it works !
+	UARTWifiFramer	_framer;// frames the responses to queued commands into _gResponseBuf
+	UARTWifiResponse _response;// parsed response to the command at the head of the queue
+
+	// Command queue. The command at the head of the queue is the one currently being processed
+	UARTWifiCommand	_queue[UARTWIFI_COMMAND_QUEUE_SIZE];
+	unsigned char	_queueHead;
+	unsigned char	_queueCount;
+	unsigned char	_commandState;// state of the command at the head of the queue
+	unsigned char	_inFlight;// number of commands at the head of the queue which have been sent
+	unsigned char	_pipelineDepth;
+	unsigned long	_commandStartTime;
+	unsigned long	_lastCommandTime;
+	unsigned long	_lastByteTime;
+
+	// Adaptive receive polling
+	int				_minRetryMillis;
+	int				_maxRetryMillis;
+	long			_receiveDeadlineMillis;
+	int				_dataReadyPin;
+	boolean			_dataReadyLevel;
+	int				_ctsPin;
+	long			_sendStallMillis;
+	int				_dataRemaining;
+	int				_dataReceived;
+
+	// Readiness state machine
+	unsigned char	_readyState;
+	unsigned long	_readyStateTime;// millis() when the current state was entered
+	long			_readyTimeoutMillis;
+	long			_readyDelayMillis;// time to wait in the BOOTING or LINK_WAIT state, doubled after each failure
+	boolean			_waitForLink;
+	boolean			_rtsWasHigh;
+	int				_readyInterrupt;
+	UARTWifiReadyStats _readyStats;
+	static volatile boolean _rtsFell;// set by the RTS interrupt
+
+#if UARTWIFI_STATS
+	UARTWifiCommandStats _stats[UARTWIFI_CMD_TYPES];
+#endif
 	
 };
 #endif //UARTWifi_h
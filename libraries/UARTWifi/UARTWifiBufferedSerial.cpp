@@ -0,0 +1,200 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "UARTWifiBufferedSerial.h"
+
+#if defined(__AVR__) && defined(TIMSK0) && defined(OCIE0A)
+#define TIMER0_SERVICE_SUPPORTED
+
+// Defined by UARTWIFI_TIMER0_SERVICE_ISR(). Weak, so its address is 0 if the sketch doesn't have the interrupt handler
+extern const boolean uartWifiTimer0ServiceIsr __attribute__((weak));
+#endif
+
+UARTWifiBufferedSerial *UARTWifiBufferedSerial::_timerServiceInstance;
+
+UARTWifiBufferedSerial::UARTWifiBufferedSerial(Stream *serial,char *rxStorage,unsigned int rxSize) : _rx(rxStorage,rxSize)
+{
+	_serial=serial;
+	_timerService=false;
+	resetStats();
+}
+
+// Moves received bytes from the serial port into the ring buffer. Called by available(), read() and peek(), so only needs calling
+// directly if a timer interrupt isn't being used and the library isn't being polled often enough
+void UARTWifiBufferedSerial::service()
+{
+	if (_timerService)
+	{
+		noInterrupts();
+		serviceFromInterrupt();
+		interrupts();
+	}
+	else
+	{
+		serviceFromInterrupt();
+	}
+}
+
+void UARTWifiBufferedSerial::serviceFromInterrupt()
+{
+	int waiting=_serial->available();
+
+	if ((unsigned int)waiting>_serialHighWater)
+	{
+		_serialHighWater=waiting;
+	}
+	while (waiting>0)
+	{
+		if (_rx.space()==0)
+		{
+			_rxFullCount++;// the rest stays in the serial port's buffer
+			break;
+		}
+		_rx.put(_serial->read());
+		waiting--;
+	}
+	if (_rx.available()>_rxHighWater)
+	{
+		_rxHighWater=_rx.available();
+	}
+}
+
+// Timer 0 overflows every 1.024ms for millis(). The compare A interrupt fires once in each of those periods, wherever OCR0A is.
+// OCR0A is also the PWM duty for the OC0A pin (pin 6 on an Uno, 13 on a Mega), so it is left alone and analogWrite() on that pin still
+// works, but moves the point in the period at which the interrupt fires. Any other use of TIMER0_COMPA conflicts with this
+boolean UARTWifiBufferedSerial::beginTimerService()
+{
+#ifdef TIMER0_SERVICE_SUPPORTED
+	if (&uartWifiTimer0ServiceIsr==0)
+	{
+		return false;// enabling the interrupt without a handler would reset the board
+	}
+	noInterrupts();
+	_timerServiceInstance=this;
+	_timerService=true;
+	TIMSK0 |= _BV(OCIE0A);
+	interrupts();
+	return true;
+#else
+	return false;
+#endif
+}
+
+void UARTWifiBufferedSerial::endTimerService()
+{
+#ifdef TIMER0_SERVICE_SUPPORTED
+	noInterrupts();
+	TIMSK0 &= ~_BV(OCIE0A);
+	_timerServiceInstance=0;
+	_timerService=false;
+	interrupts();
+#endif
+}
+
+void UARTWifiBufferedSerial::timerInterrupt()
+{
+	if (_timerServiceInstance)
+	{
+		_timerServiceInstance->serviceFromInterrupt();
+	}
+}
+
+unsigned int UARTWifiBufferedSerial::rxHighWater()
+{
+	return _rxHighWater;
+}
+
+unsigned int UARTWifiBufferedSerial::serialHighWater()
+{
+	return _serialHighWater;
+}
+
+unsigned long UARTWifiBufferedSerial::rxFullCount()
+{
+	unsigned long count;
+
+	noInterrupts();
+	count=_rxFullCount;
+	interrupts();
+	return count;
+}
+
+void UARTWifiBufferedSerial::resetStats()
+{
+	noInterrupts();
+	_rxHighWater=0;
+	_serialHighWater=0;
+	_rxFullCount=0;
+	interrupts();
+}
+
+int UARTWifiBufferedSerial::available()
+{
+	service();
+	if (!_timerService)
+	{
+		return _rx.available();
+	}
+	noInterrupts();
+	int count=_rx.available();
+	interrupts();
+	return count;
+}
+
+int UARTWifiBufferedSerial::read()
+{
+	service();
+	if (!_timerService)
+	{
+		return _rx.read();
+	}
+	noInterrupts();
+	int c=_rx.read();
+	interrupts();
+	return c;
+}
+
+int UARTWifiBufferedSerial::peek()
+{
+	service();
+	if (!_timerService)
+	{
+		return _rx.peek();
+	}
+	noInterrupts();
+	int c=_rx.peek();
+	interrupts();
+	return c;
+}
+
+void UARTWifiBufferedSerial::flush()
+{
+	_serial->flush();
+}
+
+size_t UARTWifiBufferedSerial::write(uint8_t c)
+{
+	return _serial->write(c);
+}
+
+size_t UARTWifiBufferedSerial::write(const uint8_t *buffer,size_t size)
+{
+	return _serial->write(buffer,size);
+}
@@ -0,0 +1,95 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UARTWifiBufferedSerial_h
+#define UARTWifiBufferedSerial_h
+
+#include "UARTWifiRingBuffer.h"
+
+/*
+ * The TIMER0_COMPA interrupt handler used by beginTimerService(). It is a macro rather than part of the library so that sketches which
+ * don't use timer servicing (or which use TIMER0_COMPA for something else) don't get the handler linked in. Put it once, outside any
+ * function, in the sketch:
+ *
+ *   UARTWIFI_TIMER0_SERVICE_ISR()
+ */
+#if defined(__AVR__) && defined(TIMSK0) && defined(OCIE0A)
+#define UARTWIFI_TIMER0_SERVICE_ISR() \
+	extern const boolean uartWifiTimer0ServiceIsr=true; \
+	ISR(TIMER0_COMPA_vect) \
+	{ \
+		UARTWifiBufferedSerial::timerInterrupt(); \
+	}
+#else
+#define UARTWIFI_TIMER0_SERVICE_ISR()
+#endif
+
+/*
+ * A Stream which sits between UARTWifi and the serial port, and gives it a large receive buffer, so that it can run at 115200 baud
+ * and above without losing data while loop() is busy with something else.
+ * The serial port's own buffer is only 64 bytes, which fills in 5.5ms at 115200 baud. service() moves whatever is in it into a ring
+ * buffer of any (power of 2) size. On AVR boards, beginTimerService() calls it every 1ms from the TIMER0 compare interrupt, which is
+ * free as millis() only uses the overflow interrupt, if the sketch has UARTWIFI_TIMER0_SERVICE_ISR(). Elsewhere serviceFromInterrupt()
+ * can be called from a timer interrupt.
+ * Writes go straight to the serial port, whose transmit side is already interrupt driven.
+ *
+ *   char rxStorage[512];
+ *   UARTWifiBufferedSerial bufferedSerial(&Serial1,rxStorage,sizeof(rxStorage));
+ *   UARTWifi myWifi = UARTWifi(&bufferedSerial,8,9);
+ *   UARTWIFI_TIMER0_SERVICE_ISR()
+ *   ...
+ *   Serial1.begin(115200);
+ *   bufferedSerial.beginTimerService();
+ *
+ * The high water marks show how close each buffer came to being full, so the buffer size (or baud rate) can be tuned.
+ */
+class UARTWifiBufferedSerial : public Stream
+{
+  public:
+	UARTWifiBufferedSerial(Stream *serial,char *rxStorage,unsigned int rxSize);
+	void service();
+	void serviceFromInterrupt();// for timer interrupt handlers. Use service() elsewhere
+	boolean beginTimerService();// returns false if the board doesn't support it, or the sketch doesn't have UARTWIFI_TIMER0_SERVICE_ISR()
+	void endTimerService();
+	static void timerInterrupt();// called by UARTWIFI_TIMER0_SERVICE_ISR()
+
+	unsigned int rxHighWater();// most bytes there have been in the ring buffer
+	unsigned int serialHighWater();// most bytes there have been in the serial port's buffer. If this reaches its size, data was lost
+	unsigned long rxFullCount();// number of times data was left in the serial port's buffer because the ring buffer was full
+	void resetStats();
+
+	virtual int available();
+	virtual int read();
+	virtual int peek();
+	virtual void flush();
+	virtual size_t write(uint8_t c);
+	virtual size_t write(const uint8_t *buffer,size_t size);
+	using Print::write;
+
+  private:
+	static UARTWifiBufferedSerial *_timerServiceInstance;
+	Stream				*_serial;
+	UARTWifiRingBuffer	_rx;
+	volatile boolean	_timerService;// the ring buffer is also filled by an interrupt, so reads must disable interrupts
+	volatile unsigned int _rxHighWater;
+	volatile unsigned int _serialHighWater;
+	volatile unsigned long _rxFullCount;
+};
+#endif //UARTWifiBufferedSerial_h
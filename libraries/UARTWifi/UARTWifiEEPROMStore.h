@@ -0,0 +1,55 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UARTWifiEEPROMStore_h
+#define UARTWifiEEPROMStore_h
+
+/*
+ * Storage functions which keep a UARTWifiMailQueue in EEPROM e.g.
+ *   UARTWifiMailQueue mailQueue(&smtpSession,readUARTWifiEEPROM,writeUARTWifiEEPROM);
+ * This file includes EEPROM.h itself, but the sketch should #include <EEPROM.h> too, as older Arduino IDEs only build the libraries
+ * which the sketch includes.
+ * context can be used to pass the first EEPROM address to use, cast to void *. It defaults to 0.
+ */
+#include <EEPROM.h>
+
+static void readUARTWifiEEPROM(int address,char *data,int length,void *context)
+{
+	address+=(int)(long)context;
+	while(length--)
+	{
+		*data++=EEPROM.read(address++);
+	}
+}
+
+static void writeUARTWifiEEPROM(int address,const char *data,int length,void *context)
+{
+	address+=(int)(long)context;
+	while(length--)
+	{
+		if (EEPROM.read(address)!=(unsigned char)*data)
+		{
+			EEPROM.write(address,*data);// only write bytes which have changed, as each write wears the EEPROM and takes 3.3ms
+		}
+		address++;
+		data++;
+	}
+}
+#endif //UARTWifiEEPROMStore_h
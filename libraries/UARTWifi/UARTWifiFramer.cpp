@@ -0,0 +1,115 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "UARTWifiFramer.h"
+
+UARTWifiFramer::UARTWifiFramer(const char *pattern)
+{
+	strncpy(_pattern,pattern,UARTWIFI_FRAMER_MAX_PATTERN);
+	_pattern[UARTWIFI_FRAMER_MAX_PATTERN]=0;
+	_patternLength=strlen(_pattern);
+
+	// Build the KMP failure function. _failure[i] is the length of the longest proper prefix of the pattern
+	// which is also a suffix of the first i+1 characters of the pattern.
+	unsigned char k=0;
+	_failure[0]=0;
+	for(unsigned char i=1;i<_patternLength;i++)
+	{
+		while (k>0 && _pattern[i]!=_pattern[k])
+		{
+			k=_failure[k-1];
+		}
+		if (_pattern[i]==_pattern[k])
+		{
+			k++;
+		}
+		_failure[i]=k;
+	}
+
+	_buffer=0;
+	_bufferSize=0;
+	reset();
+}
+
+void UARTWifiFramer::begin(char *buffer,int bufferSize)
+{
+	_buffer=buffer;
+	_bufferSize=bufferSize;
+	reset();
+}
+
+void UARTWifiFramer::reset()
+{
+	_matched=0;
+	_length=0;
+	_received=0;
+	_frameLength=0;
+	_overflowed=false;// Note. The buffer isn't cleared, so the previous frame can still be read until new data is pushed
+}
+
+boolean UARTWifiFramer::push(char c)
+{
+	// Always leave space for the null terminator
+	if (_length<_bufferSize-1)
+	{
+		_buffer[_length++]=c;
+		_buffer[_length]=0;
+	}
+	else
+	{
+		_overflowed=true;
+	}
+	_received++;
+
+	while (_matched>0 && c!=_pattern[_matched])
+	{
+		_matched=_failure[_matched-1];
+	}
+	if (c==_pattern[_matched])
+	{
+		_matched++;
+	}
+	if (_patternLength==0 || _matched<_patternLength)
+	{
+		return false;
+	}
+
+	_matched=_failure[_matched-1];// allow overlapping matches if the caller carries on pushing
+	_frameLength=_received-_patternLength;
+	if (_frameLength>_length)
+	{
+		_frameLength=_length;// the start of the pattern was discarded because the buffer was full
+	}
+	return true;
+}
+
+char *UARTWifiFramer::frame()
+{
+	if (_bufferSize>0)
+	{
+		_buffer[_frameLength]=0;
+	}
+	return _buffer;
+}
+
+int UARTWifiFramer::frameLength()
+{
+	return _frameLength;
+}
@@ -0,0 +1,64 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UARTWifiFramer_h
+#define UARTWifiFramer_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+    #include "Arduino.h"
+#else
+    #include "WProgram.h"
+#endif
+
+#define UARTWIFI_FRAMER_MAX_PATTERN 8
+
+/*
+ * Streaming framer.
+ * Bytes are pushed one at a time into a buffer owned by the caller, until the terminating pattern (normally \r\n\r\n) is seen.
+ * The pattern is matched using the Knuth-Morris-Pratt algorithm, so the match state is kept between calls
+ * and only a constant (amortised) amount of work is done per byte, regardless of the pattern or buffer length.
+ * Bytes which don't fit in the buffer are discarded (but still matched), so the buffer can never overflow.
+ */
+class UARTWifiFramer
+{
+  public:
+	UARTWifiFramer(const char *pattern);// pattern is copied, so it can be a temporary string
+	void begin(char *buffer,int bufferSize);
+	void reset();// start a new frame
+	boolean push(char c);// returns true when the pattern has been matched
+	char *frame();// the data before the pattern, null terminated
+	int frameLength();
+	char *buffer() { return _buffer; }// all the data received, including the pattern, null terminated
+	int length() { return _length; }
+	boolean overflowed() { return _overflowed; }
+
+  private:
+	char			_pattern[UARTWIFI_FRAMER_MAX_PATTERN+1];
+	unsigned char	_patternLength;
+	unsigned char	_failure[UARTWIFI_FRAMER_MAX_PATTERN];// KMP failure function
+	unsigned char	_matched;// number of pattern characters currently matched
+	char			*_buffer;
+	int				_bufferSize;
+	int				_length;// bytes stored in the buffer
+	int				_received;// bytes pushed since the last reset, including any that were discarded
+	int				_frameLength;
+	boolean			_overflowed;
+};
+#endif //UARTWifiFramer_h
@@ -0,0 +1,241 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "UARTWifiMailQueue.h"
+
+// Slot layout. The checksum covers everything from RECORD_ID onwards except the attempt count, which is updated in place
+#define RECORD_STATE 0
+#define RECORD_CHECKSUM 1
+#define RECORD_ID 2
+#define RECORD_ATTEMPTS 4
+#define RECORD_LENGTH 5
+#define RECORD_DATA 6// to, from, friendly name, subject and message, each null terminated
+
+#define SLOT_EMPTY 0x00
+#define SLOT_QUEUED 0x5A
+
+UARTWifiMailQueue::UARTWifiMailQueue(UARTWifiSmtpSession *session,UARTWifiStoreRead read,UARTWifiStoreWrite write,void *context,int slots)
+{
+	_session=session;
+	_read=read;
+	_write=write;
+	_storeContext=context;
+	_slots=slots;
+	_head=0;
+	_count=0;
+	_nextId=0;
+	_callback=0;
+	_callbackContext=0;
+	_retryMillis=0;
+	_failedTime=0;
+	setRetry(UARTWIFI_MAIL_MIN_RETRY_TIME,UARTWIFI_MAIL_MAX_RETRY_TIME,UARTWIFI_MAIL_MAX_ATTEMPTS);
+}
+
+/*
+ * Scans storage for messages queued before a reset. Queued messages have consecutive ids in consecutive slots (wrapping round),
+ * so the queue starts at the oldest valid slot and ends at the first slot which doesn't follow on from it.
+ * Slots which were being written when the reset happened fail the checksum and are ignored.
+ */
+int UARTWifiMailQueue::begin()
+{
+	_head=0;
+	_count=0;
+	for(int slot=0;slot<_slots;slot++)
+	{
+		if (load(slot))
+		{
+			unsigned int id = recordId();
+			if (_count==0 || (short)(id-_nextId)<0)
+			{
+				_head=slot;
+				_nextId=id;
+				_count=1;
+			}
+		}
+	}
+
+	if (_count)
+	{
+		while(_count<_slots && load((_head+_count)%_slots) && recordId()==((_nextId+_count)&0xFFFF))
+		{
+			_count++;
+		}
+		_nextId+=_count;
+	}
+	return _count;
+}
+
+long UARTWifiMailQueue::enqueue(char *toAddress,char *fromAddress,char *toFriendlyName,char *subject,char *message)
+{
+	if (_count==_slots)
+	{
+		return UARTWIFI_MAIL_QUEUE_FULL;
+	}
+
+	char *fields[5] = {toAddress,fromAddress,toFriendlyName,subject,message};
+	int length=RECORD_DATA;
+	for(int i=0;i<5;i++)
+	{
+		int fieldLength=strlen(fields[i])+1;
+		if (length+fieldLength>UARTWIFI_MAIL_SLOT_SIZE)
+		{
+			return UARTWIFI_MAIL_TOO_LONG;
+		}
+		memcpy(_record+length,fields[i],fieldLength);
+		length+=fieldLength;
+	}
+
+	unsigned int id=(_nextId++)&0xFFFF;
+	_record[RECORD_ID]=id;
+	_record[RECORD_ID+1]=id>>8;
+	_record[RECORD_ATTEMPTS]=0;
+	_record[RECORD_LENGTH]=length;
+	_record[RECORD_CHECKSUM]=checksum();
+
+	// Write the state last, so the slot isn't valid until all of it has been written
+	int address=((_head+_count)%_slots)*UARTWIFI_MAIL_SLOT_SIZE;
+	_write(address+RECORD_CHECKSUM,_record+RECORD_CHECKSUM,length-RECORD_CHECKSUM,_storeContext);
+	_record[RECORD_STATE]=SLOT_QUEUED;
+	_write(address+RECORD_STATE,_record+RECORD_STATE,1,_storeContext);
+	_count++;
+	return id;
+}
+
+// Sends the message at the head of the queue, unless the queue is waiting to retry after a failure. Blocks until it has been sent
+void UARTWifiMailQueue::poll()
+{
+	_session->poll();
+	if (_count==0 || (millis()-_failedTime) < (unsigned long)_retryMillis)
+	{
+		return;
+	}
+
+	if (!load(_head))
+	{
+		remove();// the slot has been corrupted
+		return;
+	}
+
+	char *fields[5];
+	char *field=_record+RECORD_DATA;
+	for(int i=0;i<5;i++)
+	{
+		fields[i]=field;
+		field+=strlen(field)+1;
+	}
+
+	int status = _session->send(fields[0],fields[1],fields[2],fields[3],fields[4]);
+	if (status==0)
+	{
+		finish(0);
+		return;
+	}
+
+	unsigned char attempts=_record[RECORD_ATTEMPTS]+1;
+	boolean rejected = (status==UARTWIFI_SMTP_ERROR || status==UARTWIFI_SMTP_DATA_ERROR) && _session->rejectCode()>=500;
+	if (rejected || attempts>=_maxAttempts)
+	{
+		finish(status);// retrying won't help
+		return;
+	}
+
+	_write(_head*UARTWIFI_MAIL_SLOT_SIZE+RECORD_ATTEMPTS,(char *)&attempts,1,_storeContext);
+	_failedTime=millis();
+	_retryMillis = _retryMillis ? _retryMillis*2 : _minRetryMillis;
+	if (_retryMillis>_maxRetryMillis)
+	{
+		_retryMillis=_maxRetryMillis;
+	}
+}
+
+int UARTWifiMailQueue::count()
+{
+	return _count;
+}
+
+void UARTWifiMailQueue::setCallback(UARTWifiMailCallback callback,void *context)
+{
+	_callback=callback;
+	_callbackContext=context;
+}
+
+void UARTWifiMailQueue::setRetry(long minRetryMillis,long maxRetryMillis,unsigned char maxAttempts)
+{
+	_minRetryMillis=minRetryMillis;
+	_maxRetryMillis=maxRetryMillis;
+	_maxAttempts=maxAttempts;
+}
+
+// Reads a slot into _record, and returns true if it holds a queued message
+boolean UARTWifiMailQueue::load(int slot)
+{
+	int address=slot*UARTWIFI_MAIL_SLOT_SIZE;
+
+	_read(address,_record,RECORD_DATA,_storeContext);
+	int length=(unsigned char)_record[RECORD_LENGTH];
+	if (_record[RECORD_STATE]!=SLOT_QUEUED || length<RECORD_DATA+5 || length>UARTWIFI_MAIL_SLOT_SIZE)
+	{
+		return false;
+	}
+	_read(address+RECORD_DATA,_record+RECORD_DATA,length-RECORD_DATA,_storeContext);
+	return (unsigned char)_record[RECORD_CHECKSUM]==checksum() && _record[length-1]==0;
+}
+
+// Frees the slot at the head of the queue
+void UARTWifiMailQueue::remove()
+{
+	char state=SLOT_EMPTY;
+
+	_write(_head*UARTWIFI_MAIL_SLOT_SIZE+RECORD_STATE,&state,1,_storeContext);
+	_head=(_head+1)%_slots;
+	_count--;
+}
+
+// Removes the message at the head of the queue once it has been sent or discarded. The next message doesn't wait for the backoff
+// of the failures of this one
+void UARTWifiMailQueue::finish(int status)
+{
+	unsigned int id = recordId();
+
+	remove();
+	_retryMillis=0;
+	if (_callback)
+	{
+		_callback(id,status,_callbackContext);
+	}
+}
+
+// The 16 bit id of the message in _record, stored low byte first
+unsigned int UARTWifiMailQueue::recordId()
+{
+	return (unsigned char)_record[RECORD_ID] | ((unsigned char)_record[RECORD_ID+1]<<8);
+}
+
+unsigned char UARTWifiMailQueue::checksum()
+{
+	unsigned char sum=_record[RECORD_ID]+_record[RECORD_ID+1];
+	int length=(unsigned char)_record[RECORD_LENGTH];
+
+	for(int i=RECORD_LENGTH;i<length;i++)
+	{
+		sum=(sum<<1|sum>>7)+_record[i];// rotate so that swapped bytes change the checksum
+	}
+	return sum;
+}
@@ -0,0 +1,99 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UARTWifiMailQueue_h
+#define UARTWifiMailQueue_h
+
+#include "UARTWifiSmtpSession.h"
+
+// Size of each queued message in storage, including a 6 byte header. The to and from addresses, friendly name, subject and message
+// must fit in the rest, each with its null terminator, so with 128 byte slots they share about 120 bytes. enqueue() returns
+// UARTWIFI_MAIL_TOO_LONG for anything larger
+#define UARTWIFI_MAIL_SLOT_SIZE 128
+// Number of slots. 8 slots of 128 bytes fill the 1K EEPROM of an ATmega328
+#define UARTWIFI_MAIL_QUEUE_SLOTS 8
+
+// Delay before retrying after a failure, doubling on each failure up to the maximum
+#define UARTWIFI_MAIL_MIN_RETRY_TIME 5000
+#define UARTWIFI_MAIL_MAX_RETRY_TIME 300000
+// Number of times a message is tried before it is discarded
+#define UARTWIFI_MAIL_MAX_ATTEMPTS 10
+
+/*
+ * Storage for the queue e.g. EEPROM (see UARTWifiEEPROMStore.h) or a flash region.
+ * address is relative to the start of storage. Erased storage can contain anything.
+ */
+typedef void (*UARTWifiStoreRead)(int address,char *data,int length,void *context);
+typedef void (*UARTWifiStoreWrite)(int address,const char *data,int length,void *context);
+
+/*
+ * Called when a queued message has been sent (status 0) or has been discarded, either because the server rejected it
+ * permanently (5xx reply) or because it failed UARTWIFI_MAIL_MAX_ATTEMPTS times. id is the value returned by enqueue()
+ */
+typedef void (*UARTWifiMailCallback)(unsigned int id,int status,void *context);
+
+/*
+ * A queue of emails waiting to be sent, kept in non volatile storage so they survive a reset or power failure.
+ * enqueue() just writes the message to the next free slot. poll() sends the oldest message, one per call, using a
+ * UARTWifiSmtpSession, so a burst of messages goes over a single connection. If sending fails, the message stays at the head
+ * of the queue and is retried with exponential backoff.
+ * Messages are sent at least once. A reset between the server accepting a message and its slot being freed sends it again.
+ *
+ * poll() is not a background task. A call which sends a message blocks for the whole SMTP transaction, which can be several
+ * seconds, or for an unreachable server up to the connect timeout plus the 30 second receive deadline for each reply.
+ * Calls with nothing to send, or which are waiting to retry, return straight away. Anything which must not be missed while
+ * a message is being sent (e.g. a button press) should be caught by an interrupt.
+ */
+class UARTWifiMailQueue
+{
+  public:
+	UARTWifiMailQueue(UARTWifiSmtpSession *session,UARTWifiStoreRead read,UARTWifiStoreWrite write,void *context=0,int slots=UARTWIFI_MAIL_QUEUE_SLOTS);
+	int begin();// finds the messages left in storage, and returns how many there are
+	long enqueue(char *toAddress,char *fromAddress,char *toFriendlyName,char *subject,char *message);// returns the id, or UARTWIFI_MAIL_QUEUE_FULL or UARTWIFI_MAIL_TOO_LONG
+	void poll();// blocks while a message is sent
+	int count();
+	void setCallback(UARTWifiMailCallback callback,void *context=0);
+	void setRetry(long minRetryMillis,long maxRetryMillis,unsigned char maxAttempts);
+
+  private:
+	boolean load(int slot);
+	void remove();
+	void finish(int status);
+	unsigned int recordId();
+	unsigned char checksum();
+
+	UARTWifiSmtpSession	*_session;
+	UARTWifiStoreRead	_read;
+	UARTWifiStoreWrite	_write;
+	void				*_storeContext;
+	int					_slots;
+	int					_head;// slot of the oldest message
+	int					_count;
+	unsigned int		_nextId;
+	UARTWifiMailCallback _callback;
+	void				*_callbackContext;
+	long				_minRetryMillis;
+	long				_maxRetryMillis;
+	long				_retryMillis;// time to wait after the last failure, or 0
+	unsigned char		_maxAttempts;
+	unsigned long		_failedTime;
+	char				_record[UARTWIFI_MAIL_SLOT_SIZE];// the message being written or sent
+};
+#endif //UARTWifiMailQueue_h
@@ -0,0 +1,70 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "UARTWifiResponse.h"
+
+int parseUARTWifiNumber(char *text,char **end)
+{
+	boolean negative = (*text=='-');
+	int value=0;
+
+	if (negative)
+	{
+		text++;
+	}
+	while (*text>='0' && *text<='9')
+	{
+		value = value*10 + (*text++ - '0');
+	}
+	*end=text;
+	return negative ? -value : value;
+}
+
+void parseUARTWifiResponse(char *text,UARTWifiResponse *response)
+{
+	char *p = text;
+
+	response->type=UARTWIFI_RESPONSE_UNKNOWN;
+	response->value=0;
+	response->text=text;
+
+	if (p[0]=='+' && p[1]=='O' && p[2]=='K')
+	{
+		p+=3;
+		response->type=UARTWIFI_RESPONSE_OK;
+		if (*p=='=')
+		{
+			p++;
+			char *end;
+			response->value=parseUARTWifiNumber(p,&end);
+			if (end!=p && *(end-1)!='-')
+			{
+				response->type=UARTWIFI_RESPONSE_OK_VALUE;
+				p=end;
+			}
+		}
+	}
+	else if (p[0]=='+' && p[1]=='E' && p[2]=='R' && p[3]=='R' && p[4]=='=')
+	{
+		response->type=UARTWIFI_RESPONSE_ERROR;
+		response->value=parseUARTWifiNumber(p+5,&p);
+	}
+	response->fields=p;
+}
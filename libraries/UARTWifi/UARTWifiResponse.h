@@ -0,0 +1,54 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UARTWifiResponse_h
+#define UARTWifiResponse_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+    #include "Arduino.h"
+#else
+    #include "WProgram.h"
+#endif
+
+// Response types
+#define UARTWIFI_RESPONSE_UNKNOWN 0	// anything which isn't +OK or +ERR=
+#define UARTWIFI_RESPONSE_OK 1		// +OK, or +OK= followed by text which isn't a number
+#define UARTWIFI_RESPONSE_OK_VALUE 2	// +OK=<value>, optionally followed by more comma separated fields
+#define UARTWIFI_RESPONSE_ERROR 3		// +ERR=<value>
+#define UARTWIFI_RESPONSE_DATA 4		// +OK=<value> followed by value bytes of data (AT+SKRCV) or granting value bytes of data (AT+SKSND)
+#define UARTWIFI_RESPONSE_TIMEOUT 5	// no response
+
+typedef struct
+{
+	unsigned char	type;
+	int				value;// the number after +OK= or +ERR=
+	char			*text;// the whole response
+	char			*fields;// the text after +OK= or after the value e.g. ",2,192.168.1.2,80" for AT+SKSTT. Empty if there aren't any
+} UARTWifiResponse;
+
+/*
+ * Tokenises a module response in a single pass, without modifying it.
+ * text must be null terminated and must not include the trailing \r\n\r\n
+ */
+void parseUARTWifiResponse(char *text,UARTWifiResponse *response);
+
+// Parses a decimal number (with optional -) and sets *end to the first character after it. Returns 0 if there isn't a number
+int parseUARTWifiNumber(char *text,char **end);
+#endif //UARTWifiResponse_h
@@ -0,0 +1,90 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "UARTWifiRingBuffer.h"
+
+UARTWifiRingBuffer::UARTWifiRingBuffer(char *storage,unsigned int size)
+{
+	// Round down to a power of 2, in case the caller didn't supply one
+	while (size & (size-1))
+	{
+		size &= size-1;
+	}
+	_storage=storage;
+	_size=size;
+	_mask=size-1;
+	_head=0;
+	_tail=0;
+}
+
+boolean UARTWifiRingBuffer::put(char c)
+{
+	if (space()==0)
+	{
+		return false;
+	}
+	_storage[_head++ & _mask]=c;
+	return true;
+}
+
+int UARTWifiRingBuffer::read()
+{
+	if (available()==0)
+	{
+		return -1;
+	}
+	return (unsigned char)_storage[_tail++ & _mask];
+}
+
+int UARTWifiRingBuffer::peek()
+{
+	if (available()==0)
+	{
+		return -1;
+	}
+	return (unsigned char)_storage[_tail & _mask];
+}
+
+unsigned char UARTWifiRingBuffer::spans(UARTWifiSpan *first,UARTWifiSpan *second)
+{
+	unsigned int count = available();
+	unsigned int start = _tail & _mask;
+	unsigned int toEnd = _size-start;
+
+	first->data=_storage+start;
+	first->length = count<toEnd ? count : toEnd;
+	second->data=_storage;
+	second->length=count-first->length;
+
+	if (count==0)
+	{
+		return 0;
+	}
+	return second->length ? 2 : 1;
+}
+
+void UARTWifiRingBuffer::consume(unsigned int n)
+{
+	if (n>available())
+	{
+		n=available();
+	}
+	_tail+=n;
+}
@@ -0,0 +1,64 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UARTWifiRingBuffer_h
+#define UARTWifiRingBuffer_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+    #include "Arduino.h"
+#else
+    #include "WProgram.h"
+#endif
+
+// A contiguous block of data inside a ring buffer
+typedef struct
+{
+	char			*data;
+	unsigned int	length;
+} UARTWifiSpan;
+
+/*
+ * Fixed size ring buffer, using storage supplied by the caller.
+ * The size must be a power of 2 (e.g. 64, 128, 256) so that wrapping is just a mask.
+ *
+ * The data can be read in place using spans(), which returns one span, or two if the data wraps around the end of the storage,
+ * and then removed using consume(), so that the caller doesn't need to copy the data into another buffer to parse it.
+ */
+class UARTWifiRingBuffer
+{
+  public:
+	UARTWifiRingBuffer(char *storage,unsigned int size);
+	unsigned int available() { return _head-_tail; }
+	unsigned int space() { return _size-(_head-_tail); }
+	boolean put(char c);
+	int read();// returns -1 if empty
+	int peek();// returns -1 if empty
+	unsigned char spans(UARTWifiSpan *first,UARTWifiSpan *second);// returns the number of spans containing data (0,1 or 2)
+	void consume(unsigned int n);
+	void clear() { _head=_tail=0; }
+
+  private:
+	char			*_storage;
+	unsigned int	_size;
+	unsigned int	_mask;
+	unsigned int	_head;// free running write index
+	unsigned int	_tail;// free running read index
+};
+#endif //UARTWifiRingBuffer_h
@@ -0,0 +1,372 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "UARTWifiSmtpSession.h"
+
+// Reply sent by a server which is about to drop the connection
+#define SMTP_SERVICE_CLOSING 421
+
+UARTWifiSmtpSession::UARTWifiSmtpSession(UARTWifi *wifi,char *mailServer,char *loginDomain,long idleTimeoutMillis)
+{
+	_wifi=wifi;
+	_mailServer=mailServer;
+	_loginDomain=loginDomain;
+	_idleTimeoutMillis=idleTimeoutMillis;
+	_socketNum=-1;
+	_pipelining=false;
+	_needsReset=false;
+	_replyCode=0;
+	_rejectCode=0;
+	_repliesPending=0;
+	_lastUsedTime=0;
+	_length=0;
+	_error=0;
+}
+
+int UARTWifiSmtpSession::send(char *toAddress,char *fromAddress,char *toFriendlyName,char *subject,char *message)
+{
+	poll();// don't reuse a connection the server has probably dropped
+
+	boolean reused = _socketNum>=0;
+	int status = reused?0:open();
+	if (status==0)
+	{
+		status=transaction(toAddress,fromAddress,toFriendlyName,subject,message);
+		if (reused && !_bodySent && status!=0 && status!=UARTWIFI_SMTP_ERROR && status!=UARTWIFI_SMTP_DATA_ERROR)
+		{
+			// The server has probably closed the connection. None of the message was sent, so its safe to try again on a new one
+			drop();
+			status=open();
+			if (status==0)
+			{
+				status=transaction(toAddress,fromAddress,toFriendlyName,subject,message);
+			}
+		}
+	}
+	if (status!=0 && status!=UARTWIFI_SMTP_ERROR && status!=UARTWIFI_SMTP_DATA_ERROR)
+	{
+		drop();// the connection can't be used again
+	}
+	_lastUsedTime=millis();
+	return status;
+}
+
+// Closes the session once it has been idle for the idle timeout
+void UARTWifiSmtpSession::poll()
+{
+	if (_socketNum>=0 && (millis()-_lastUsedTime) >= (unsigned long)_idleTimeoutMillis)
+	{
+		close();
+	}
+}
+
+void UARTWifiSmtpSession::close()
+{
+	if (_socketNum<0)
+	{
+		return;
+	}
+	_length=0;
+	append_P(PSTR("QUIT\r\n"));
+	if (flush()==0)
+	{
+		readReply();// 221, but it doesn't matter what the server says
+	}
+	drop();
+}
+
+boolean UARTWifiSmtpSession::isOpen()
+{
+	return _socketNum>=0;
+}
+
+boolean UARTWifiSmtpSession::pipelining()
+{
+	return _pipelining;
+}
+
+int UARTWifiSmtpSession::lastReplyCode()
+{
+	return _replyCode;
+}
+
+int UARTWifiSmtpSession::rejectCode()
+{
+	return _rejectCode;
+}
+
+// Connects, waits for the 220 banner and sends EHLO, or HELO if the server doesn't support EHLO
+int UARTWifiSmtpSession::open()
+{
+	_pipelining=false;
+	_needsReset=false;
+	_rejectCode=0;
+	_repliesPending=0;
+	_length=0;
+	_buf[0]=0;
+
+	int status = _wifi->socketCreate("0","0",_mailServer,"25",&_socketNum);// 0=client,0=tcp,mailserver,port 25 for smtp
+	if (status!=0)
+	{
+		_socketNum=-1;
+		return status;
+	}
+
+	status=endCommand(220,true);// the banner is the reply to connecting
+	if (status==0)
+	{
+		_length=0;// discard anything after the banner, so it isn't sent with the EHLO or read as its reply
+		append_P(PSTR("EHLO "));
+		append(_loginDomain);
+		append_P(PSTR("\r\n"));
+		status=endCommand(250,true);// the EHLO reply lists the extensions, including PIPELINING
+		if (status==UARTWIFI_SMTP_ERROR)
+		{
+			_pipelining=false;
+			append_P(PSTR("HELO "));
+			append(_loginDomain);
+			append_P(PSTR("\r\n"));
+			status=endCommand(250,true);
+		}
+	}
+	if (status!=0)
+	{
+		drop();
+	}
+	return status;
+}
+
+// Sends one message on an open connection
+int UARTWifiSmtpSession::transaction(char *toAddress,char *fromAddress,char *toFriendlyName,char *subject,char *message)
+{
+	int status=0;
+
+	_length=0;// discard anything the server sent unprompted
+	_bodySent=false;
+	_rejectCode=0;
+	if (_needsReset)
+	{
+		append_P(PSTR("RSET\r\n"));
+		status=endCommand(250,false);
+	}
+	_needsReset=true;// until the server accepts the message
+	if (status==0)
+	{
+		append_P(PSTR("MAIL FROM: "));
+		append(fromAddress);
+		append_P(PSTR("\r\n"));
+		status=endCommand(250,false);
+	}
+	if (status==0)
+	{
+		append_P(PSTR("RCPT TO: "));
+		append(toAddress);
+		append_P(PSTR("\r\n"));
+		status=endCommand(250,false);
+	}
+	if (status==0)
+	{
+		append_P(PSTR("DATA\r\n"));
+		status=endCommand(354,true);// with PIPELINING, this is where the replies to all the commands above are read
+	}
+	if (status!=0)
+	{
+		return status;
+	}
+
+	_bodySent=true;
+	_length=0;// the buffer now holds the header, so discard anything the server sent after the 354
+	append_P(PSTR("SUBJECT: "));
+	append(subject);
+	append_P(PSTR("\r\nFROM: "));
+	append(toFriendlyName);
+	append_P(PSTR(" <"));
+	append(fromAddress);
+	append_P(PSTR(">\r\nTo: "));
+	append(toAddress);
+	append_P(PSTR("\r\n"));
+	status=flush();
+	if (status!=0)
+	{
+		return status;
+	}
+
+	UARTWifiSource messageSource(message,strlen(message));
+	long sent = _wifi->socketSendStream(&messageSource,_socketNum);
+	if (sent<0)
+	{
+		return sent;
+	}
+
+	append_P(PSTR("\r\n.\r\n"));// termination string
+	status=endCommand(250,true);
+	if (status==0)
+	{
+		_needsReset=false;
+	}
+	return status;
+}
+
+/*
+ * Called after each command has been appended. Without PIPELINING, or if readNow is true, the commands are sent and
+ * the replies to them are read. Otherwise the command is left in the buffer to be sent with the ones which follow it.
+ * Returns 0 if all the replies had the expected codes, UARTWIFI_SMTP_DATA_ERROR if DATA was rejected, UARTWIFI_SMTP_ERROR
+ * if anything else was, or the module error code.
+ */
+int UARTWifiSmtpSession::endCommand(int expectedCode,boolean readNow)
+{
+	_expectedCodes[_repliesPending++]=expectedCode;
+	if (_pipelining && !readNow)
+	{
+		return 0;
+	}
+
+	int status=flush();
+	int rejected=0;
+	for(int i=0;i<_repliesPending && status==0;i++)
+	{
+		int code=readReply();
+		if (code<0)
+		{
+			status=code;
+		}
+		else if (code==SMTP_SERVICE_CLOSING)
+		{
+			status=UARTWIFI_NOT_CONNECTED;
+		}
+		else if (code!=_expectedCodes[i] && rejected==0)
+		{
+			rejected=_expectedCodes[i];// carry on, so the replies to the other pipelined commands are read
+		}
+		if (code>=500 && _rejectCode==0)
+		{
+			_rejectCode=code;// with PIPELINING, later replies (e.g. 554 to DATA after 550 to RCPT TO) don't hide the first
+		}
+	}
+	_repliesPending=0;
+
+	if (status==0 && rejected!=0)
+	{
+		status = (rejected==354)?UARTWIFI_SMTP_DATA_ERROR:UARTWIFI_SMTP_ERROR;
+	}
+	return status;
+}
+
+/*
+ * Reads a reply, which can be several lines e.g. "250-mail.example.com\r\n250-PIPELINING\r\n250 8BITMIME\r\n", and returns its code,
+ * or the module error code.
+ * The lines of several pipelined replies can arrive in one AT+SKRCV, so anything after the reply is left in the buffer for the next call.
+ */
+int UARTWifiSmtpSession::readReply()
+{
+	while(true)
+	{
+		_buf[_length]=0;
+		char *end = strstr_P(_buf,PSTR("\r\n"));
+		if (end)
+		{
+			*end=0;
+			char separator=_buf[3];// '-' if there are more lines
+			int code=atoi(_buf);
+			if (code==250 && strncasecmp_P(_buf+4,PSTR("PIPELINING"),10)==0)
+			{
+				_pipelining=true;
+			}
+			end+=2;
+			_length-=end-_buf;
+			memmove(_buf,end,_length);
+			if (separator!='-')
+			{
+				_replyCode=code;
+				return code;
+			}
+			continue;
+		}
+
+		if (_length>=(int)sizeof(_buf)-1)
+		{
+			// Line too long. Keep the code and separator, and a \r which might be the start of the \r\n
+			_buf[4]=_buf[_length-1];
+			_length=(_buf[4]=='\r')?5:4;
+		}
+
+		int received = _wifi->socketReceiveWait(_buf+_length,sizeof(_buf)-_length,_socketNum);
+		if (received<0)
+		{
+			return received;
+		}
+		_length+=received;
+	}
+}
+
+void UARTWifiSmtpSession::append(const char *text)
+{
+	while(*text)
+	{
+		if (_length==sizeof(_buf))
+		{
+			flush();
+		}
+		_buf[_length++]=*text++;
+	}
+}
+
+void UARTWifiSmtpSession::append_P(const char *text)
+{
+	char c;
+	while((c=pgm_read_byte(text++)))
+	{
+		if (_length==sizeof(_buf))
+		{
+			flush();
+		}
+		_buf[_length++]=c;
+	}
+}
+
+// Sends the commands in the buffer. Returns 0, or the module error code if this send, or one done by append() since the last flush, failed
+int UARTWifiSmtpSession::flush()
+{
+	if (_length>0 && _error==0)
+	{
+		UARTWifiSource source(_buf,_length);
+		long sent = _wifi->socketSendStream(&source,_socketNum);
+		if (sent<0)
+		{
+			_error=sent;
+		}
+	}
+	_length=0;
+	int error=_error;
+	_error=0;
+	return error;
+}
+
+// Closes the socket without QUIT, e.g. because the connection has failed
+void UARTWifiSmtpSession::drop()
+{
+	if (_socketNum>=0)
+	{
+		_wifi->socketClose(_socketNum);
+	}
+	_socketNum=-1;
+	_length=0;
+	_repliesPending=0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UARTWifiSmtpSession_h
+#define UARTWifiSmtpSession_h
+
+#include "UARTWifi.h"
+
+// Buffer used for SMTP commands and replies. Reply lines longer than this are truncated, which doesn't matter as only the code is used
+#define UARTWIFI_SMTP_BUFFER_SIZE 128
+
+// Time a session can be unused before poll() closes it. Servers normally drop idle clients after 5 minutes (RFC 5321 4.5.3.2.7)
+#define UARTWIFI_SMTP_IDLE_TIMEOUT 60000
+
+/*
+ * Sends any number of emails over a single connection to an SMTP server.
+ * The connection, 220 banner and EHLO are only done for the first message. Later messages just need MAIL FROM, RCPT TO and DATA,
+ * preceded by RSET if the last message failed. If the server advertises PIPELINING, those commands are sent in a single AT+SKSND and
+ * their replies are read together.
+ * If the connection has been dropped by the server, the message is sent again on a new connection.
+ * poll() closes the connection (sending QUIT) once it has been idle for the idle timeout.
+ */
+class UARTWifiSmtpSession
+{
+  public:
+	UARTWifiSmtpSession(UARTWifi *wifi,char *mailServer,char *loginDomain,long idleTimeoutMillis=UARTWIFI_SMTP_IDLE_TIMEOUT);
+	// Returns 0, UARTWIFI_SMTP_ERROR or UARTWIFI_SMTP_DATA_ERROR if the server rejected the message, or the module error code
+	int send(char *toAddress,char *fromAddress,char *toFriendlyName,char *subject,char *message);
+	void poll();
+	void close();
+	boolean isOpen();
+	boolean pipelining();// true if the server advertised PIPELINING
+	int lastReplyCode();// the code of the last reply read
+	int rejectCode();// the first 5xx reply while sending the last message e.g. 550 if a recipient was refused, or 0
+
+  private:
+	int open();
+	int transaction(char *toAddress,char *fromAddress,char *toFriendlyName,char *subject,char *message);
+	int endCommand(int expectedCode,boolean readNow);
+	int readReply();
+	void append(const char *text);
+	void append_P(const char *text);
+	int flush();
+	void drop();
+
+	UARTWifi		*_wifi;
+	char			*_mailServer;
+	char			*_loginDomain;
+	long			_idleTimeoutMillis;
+	int				_socketNum;// -1 when the session is closed
+	boolean			_pipelining;
+	boolean			_needsReset;// the last transaction failed, so RSET must be sent before the next one
+	int				_replyCode;
+	int				_rejectCode;
+	unsigned char	_repliesPending;// pipelined commands whose replies haven't been read
+	int				_expectedCodes[4];// RSET, MAIL FROM, RCPT TO and DATA
+	boolean			_bodySent;
+	unsigned long	_lastUsedTime;
+	char			_buf[UARTWIFI_SMTP_BUFFER_SIZE];// commands being built, or reply data not yet parsed
+	int				_length;
+	int				_error;// module error from append(), reported by flush()
+};
+#endif //UARTWifiSmtpSession_h
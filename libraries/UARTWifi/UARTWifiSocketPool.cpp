@@ -0,0 +1,216 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "UARTWifiSocketPool.h"
+
+UARTWifiSocketPool::UARTWifiSocketPool(UARTWifi *wifi,UARTWifiSocketCallback callback,void *context,unsigned char pipelineDepth)
+{
+	_wifi=wifi;
+	_callback=callback;
+	_context=context;
+	_pipelineDepth=pipelineDepth;
+	for(int i=0;i<UARTWIFI_MAX_SOCKETS;i++)
+	{
+		_slots[i].pool=this;
+		_slots[i].state=UARTWIFI_SOCKET_FREE;
+		_slots[i].socketNum=-1;
+		_slots[i].pending=0;
+	}
+}
+
+// Lets the library send commands for different slots without waiting for each response. Not done by the constructor, as this changes
+// how every command is sent, and a global pool can be constructed before the UARTWifi object is
+void UARTWifiSocketPool::begin()
+{
+	_wifi->setPipelineDepth(_pipelineDepth);
+}
+
+// Uses a free slot, or one which failed before the module gave it a socket. A slot which failed after it was connected still has
+// its socket open in the module, so isn't reused until it has been closed
+int UARTWifiSocketPool::open(const char *protocol,const char *clientOrServer,const char *host,const char *portNumber)
+{
+	for(int i=0;i<UARTWIFI_MAX_SOCKETS;i++)
+	{
+		UARTWifiSocketSlot *slot = &_slots[i];
+		if (slot->state==UARTWIFI_SOCKET_FREE || (slot->state==UARTWIFI_SOCKET_FAILED && slot->pending==0 && slot->socketNum<0))
+		{
+			if (_wifi->queueSocketCreate(protocol,clientOrServer,host,portNumber,connectComplete,slot)<0)
+			{
+				return -1;
+			}
+			slot->state=UARTWIFI_SOCKET_CONNECTING;
+			slot->socketNum=-1;
+			slot->pending=1;
+			slot->bytesSent=0;
+			slot->bytesReceived=0;
+			slot->lastStatus=0;
+			return i;
+		}
+	}
+	return -1;
+}
+
+UARTWifiSocketSlot *UARTWifiSocketPool::connectedSlot(int slot)
+{
+	if (slot<0 || slot>=UARTWIFI_MAX_SOCKETS || _slots[slot].state!=UARTWIFI_SOCKET_CONNECTED)
+	{
+		return 0;
+	}
+	return &_slots[slot];
+}
+
+// Returns the number of commands in the library's queue, or -1 if the slot isn't connected or the queue is full
+int UARTWifiSocketPool::send(int slot,char *buffer,int buffSize)
+{
+	UARTWifiSocketSlot *s = connectedSlot(slot);
+	if (!s)
+	{
+		return -1;
+	}
+	int queued = _wifi->queueSocketSend(buffer,buffSize,s->socketNum,sendComplete,s);
+	if (queued>0)
+	{
+		s->pending++;
+	}
+	return queued;
+}
+
+int UARTWifiSocketPool::receive(int slot,UARTWifiRingBuffer *ring)
+{
+	UARTWifiSocketSlot *s = connectedSlot(slot);
+	if (!s)
+	{
+		return -1;
+	}
+	int queued = _wifi->queueSocketReceive(ring,s->socketNum,receiveComplete,s);
+	if (queued>0)
+	{
+		s->pending++;
+	}
+	return queued;
+}
+
+// Closes a connected socket, or one which failed after it was connected
+int UARTWifiSocketPool::close(int slot)
+{
+	if (slot<0 || slot>=UARTWIFI_MAX_SOCKETS || _slots[slot].socketNum<0
+		|| (_slots[slot].state!=UARTWIFI_SOCKET_CONNECTED && _slots[slot].state!=UARTWIFI_SOCKET_FAILED))
+	{
+		return -1;
+	}
+	UARTWifiSocketSlot *s = &_slots[slot];
+	int queued = _wifi->queueSocketClose(s->socketNum,closeComplete,s);
+	if (queued>0)
+	{
+		s->pending++;
+		s->state=UARTWIFI_SOCKET_CLOSING;
+	}
+	return queued;
+}
+
+void UARTWifiSocketPool::poll()
+{
+	_wifi->poll();
+}
+
+int UARTWifiSocketPool::state(int slot)
+{
+	UARTWifiSocketSlot *s = slotInfo(slot);
+	return s ? s->state : -1;
+}
+
+int UARTWifiSocketPool::socketNumber(int slot)
+{
+	UARTWifiSocketSlot *s = slotInfo(slot);
+	return s ? s->socketNum : -1;
+}
+
+int UARTWifiSocketPool::pending(int slot)
+{
+	UARTWifiSocketSlot *s = slotInfo(slot);
+	return s ? s->pending : -1;
+}
+
+UARTWifiSocketSlot *UARTWifiSocketPool::slotInfo(int slot)
+{
+	if (slot<0 || slot>=UARTWIFI_MAX_SOCKETS)
+	{
+		return 0;
+	}
+	return &_slots[slot];
+}
+
+void UARTWifiSocketPool::commandComplete(UARTWifiSocketSlot *slot,unsigned char event,int status)
+{
+	slot->pending--;
+	slot->lastStatus=status;
+	if (status<0)
+	{
+		// Any error, including a timeout, leaves the socket in an unknown state
+		slot->state=UARTWIFI_SOCKET_FAILED;
+		event=UARTWIFI_EVENT_ERROR;
+	}
+	if (_callback)
+	{
+		_callback(slot-_slots,event,status,_context);
+	}
+}
+
+void UARTWifiSocketPool::connectComplete(int status,UARTWifiResponse *response,void *context)
+{
+	UARTWifiSocketSlot *slot = (UARTWifiSocketSlot *)context;
+	if (status==0)
+	{
+		slot->socketNum=response->value;// response is +OK=<socket>
+		slot->state=UARTWIFI_SOCKET_CONNECTED;
+	}
+	slot->pool->commandComplete(slot,UARTWIFI_EVENT_CONNECTED,status);
+}
+
+void UARTWifiSocketPool::sendComplete(int status,UARTWifiResponse *response,void *context)
+{
+	UARTWifiSocketSlot *slot = (UARTWifiSocketSlot *)context;
+	if (status>0)
+	{
+		slot->bytesSent+=status;
+	}
+	slot->pool->commandComplete(slot,UARTWIFI_EVENT_SENT,status);
+}
+
+void UARTWifiSocketPool::receiveComplete(int status,UARTWifiResponse *response,void *context)
+{
+	UARTWifiSocketSlot *slot = (UARTWifiSocketSlot *)context;
+	if (status>0)
+	{
+		slot->bytesReceived+=status;
+	}
+	slot->pool->commandComplete(slot,UARTWIFI_EVENT_RECEIVED,status);
+}
+
+void UARTWifiSocketPool::closeComplete(int status,UARTWifiResponse *response,void *context)
+{
+	UARTWifiSocketSlot *slot = (UARTWifiSocketSlot *)context;
+	if (status==0)
+	{
+		slot->state=UARTWIFI_SOCKET_FREE;
+		slot->socketNum=-1;
+	}
+	slot->pool->commandComplete(slot,UARTWIFI_EVENT_CLOSED,status);
+}
@@ -0,0 +1,102 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UARTWifiSocketPool_h
+#define UARTWifiSocketPool_h
+
+#include "UARTWifi.h"
+
+// The module "supports 8 TCP client connections at most"
+#define UARTWIFI_MAX_SOCKETS 8
+
+// Slot states
+#define UARTWIFI_SOCKET_FREE 0
+#define UARTWIFI_SOCKET_CONNECTING 1
+#define UARTWIFI_SOCKET_CONNECTED 2
+#define UARTWIFI_SOCKET_CLOSING 3
+#define UARTWIFI_SOCKET_FAILED 4
+
+// Events passed to the socket callback
+#define UARTWIFI_EVENT_CONNECTED 0
+#define UARTWIFI_EVENT_SENT 1
+#define UARTWIFI_EVENT_RECEIVED 2
+#define UARTWIFI_EVENT_CLOSED 3
+#define UARTWIFI_EVENT_ERROR 4
+
+/*
+ * Called when a command for a slot completes.
+ * status is the same as for UARTWifiCallback, i.e the number of bytes sent or received, the +ERR code or UARTWIFI_TIMEOUT
+ */
+typedef void (*UARTWifiSocketCallback)(int slot,unsigned char event,int status,void *context);
+
+class UARTWifiSocketPool;
+
+typedef struct
+{
+	UARTWifiSocketPool	*pool;
+	unsigned char		state;
+	char				socketNum;// socket number assigned by the module, or -1
+	unsigned char		pending;// commands queued for this slot
+	unsigned long		bytesSent;
+	unsigned long		bytesReceived;
+	int					lastStatus;
+} UARTWifiSocketSlot;
+
+/*
+ * Manages several sockets at once.
+ * Commands for different sockets are pipelined, i.e several commands are sent to the module before their responses are received,
+ * (e.g. an AT+SKRCV on one socket while an AT+SKSND on another is waiting for its response) and each response is matched back to
+ * the slot it was for. Everything is asynchronous, so poll() must be called regularly, and the callback is called as each command completes.
+ * A slot which fails after it is connected (state UARTWIFI_SOCKET_FAILED with a socket number) must be close()d, otherwise its socket
+ * stays open in the module and open() won't reuse the slot.
+ * Pipelining starts when begin() sets the library's pipeline depth (until then commands are sent one at a time). The depth applies to
+ * every command the sketch sends, including those sent by the blocking UARTWifi methods.
+ */
+class UARTWifiSocketPool
+{
+  public:
+	UARTWifiSocketPool(UARTWifi *wifi,UARTWifiSocketCallback callback,void *context=0,unsigned char pipelineDepth=UARTWIFI_COMMAND_QUEUE_SIZE);
+	void begin();
+	int open(const char *protocol,const char *clientOrServer,const char *host,const char *portNumber);// returns the slot, or -1 if no slot or queue entry is free
+	int send(int slot,char *buffer,int buffSize);
+	int receive(int slot,UARTWifiRingBuffer *ring);
+	int close(int slot);
+	void poll();
+	// These return -1 (or 0 for slotInfo()) if slot isn't a valid slot number
+	int state(int slot);
+	int socketNumber(int slot);
+	int pending(int slot);
+	UARTWifiSocketSlot *slotInfo(int slot);
+
+  private:
+	static void connectComplete(int status,UARTWifiResponse *response,void *context);
+	static void sendComplete(int status,UARTWifiResponse *response,void *context);
+	static void receiveComplete(int status,UARTWifiResponse *response,void *context);
+	static void closeComplete(int status,UARTWifiResponse *response,void *context);
+	void commandComplete(UARTWifiSocketSlot *slot,unsigned char event,int status);
+	UARTWifiSocketSlot *connectedSlot(int slot);
+
+	UARTWifi				*_wifi;
+	UARTWifiSocketCallback	_callback;
+	void					*_context;
+	unsigned char			_pipelineDepth;
+	UARTWifiSocketSlot		_slots[UARTWIFI_MAX_SOCKETS];
+};
+#endif //UARTWifiSocketPool_h
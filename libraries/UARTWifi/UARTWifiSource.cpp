@@ -0,0 +1,86 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "UARTWifiSource.h"
+
+#define SOURCE_TYPE_RAM 0
+#define SOURCE_TYPE_PROGMEM 1
+#define SOURCE_TYPE_CALLBACK 2
+
+UARTWifiSource::UARTWifiSource(const char *buffer,long length)
+{
+	_type=SOURCE_TYPE_RAM;
+	_data=buffer;
+	_remaining=length;
+	_callback=0;
+}
+
+UARTWifiSource::UARTWifiSource(const __FlashStringHelper *data,long length)
+{
+	_type=SOURCE_TYPE_PROGMEM;
+	_data=(const char *)data;
+	_remaining = length<0 ? strlen_P(_data) : length;
+	_callback=0;
+}
+
+UARTWifiSource::UARTWifiSource(UARTWifiSourceCallback callback,void *context)
+{
+	_type=SOURCE_TYPE_CALLBACK;
+	_data=0;
+	_remaining=0;
+	_callback=callback;
+	_context=context;
+}
+
+int UARTWifiSource::read(char *buffer,int maxLength)
+{
+	if (_type==SOURCE_TYPE_CALLBACK)
+	{
+		return _callback(buffer,maxLength,_context);
+	}
+
+	int length = _remaining<maxLength ? _remaining : maxLength;
+	if (_type==SOURCE_TYPE_PROGMEM)
+	{
+		memcpy_P(buffer,_data,length);
+	}
+	else
+	{
+		memcpy(buffer,_data,length);
+	}
+	skip(length);
+	return length;
+}
+
+const char *UARTWifiSource::direct(int *length)
+{
+	if (_type!=SOURCE_TYPE_RAM)
+	{
+		return 0;
+	}
+	*length = _remaining<0x7FFF ? _remaining : 0x7FFF;
+	return _data;
+}
+
+void UARTWifiSource::skip(int n)
+{
+	_data+=n;
+	_remaining-=n;
+}
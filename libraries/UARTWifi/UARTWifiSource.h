@@ -0,0 +1,55 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef UARTWifiSource_h
+#define UARTWifiSource_h
+
+#if defined(ARDUINO) && ARDUINO >= 100
+    #include "Arduino.h"
+#else
+    #include "WProgram.h"
+#endif
+
+// Callback which supplies data to be sent. Copies up to maxLength bytes into buffer and returns the number copied, or 0 when there is no more data
+typedef int (*UARTWifiSourceCallback)(char *buffer,int maxLength,void *context);
+
+/*
+ * A source of data for UARTWifi::socketSendStream().
+ * The data can be in RAM (and can contain nulls), in PROGMEM e.g. F("Some text"), or be generated by a callback,
+ * so large amounts of data can be sent without having to build them in a RAM buffer first.
+ */
+class UARTWifiSource
+{
+  public:
+	UARTWifiSource(const char *buffer,long length);
+	UARTWifiSource(const __FlashStringHelper *data,long length=-1);// length -1 means the data is a null terminated string
+	UARTWifiSource(UARTWifiSourceCallback callback,void *context=0);
+	int read(char *buffer,int maxLength);// returns 0 at the end of the data
+	const char *direct(int *length);// returns the remaining data if its in RAM, so it can be sent without copying, otherwise 0
+	void skip(int n);// skip data returned by direct() once its been sent
+
+  private:
+	unsigned char			_type;
+	const char				*_data;
+	long					_remaining;
+	UARTWifiSourceCallback	_callback;
+	void					*_context;
+};
+#endif //UARTWifiSource_h
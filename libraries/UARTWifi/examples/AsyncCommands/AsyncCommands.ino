@@ -0,0 +1,82 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <UARTWifi.h>
+#include <SoftwareSerial.h>
+
+/* 
+ * This program demonstrates the asynchronous command interface.
+ * Commands are queued and the library's poll() method is called from loop(), so the LED keeps flashing
+ * (and any other work in loop() keeps running) while the module is processing the commands.
+ *
+ * The program presumes that the module has already been configued using the Web Admin program on port 80
+ * and that the network is connected.
+ */
+
+SoftwareSerial mySerial(10, 11); // RX, TX
+UARTWifi myWifi = UARTWifi(&mySerial,8,9);
+
+int ledPin = 13;
+boolean ledState;
+unsigned long lastFlashTime;
+unsigned long lastStatusTime;
+
+// Called by poll() when the AT+LKSTT command has completed
+void networkStatusReceived(int status,UARTWifiResponse *response,void *context)
+{
+  if (status==UARTWIFI_TIMEOUT)
+  {
+    Serial.println(F("No response from module"));
+  }
+  else
+  {
+    Serial.print(F("Network status "));
+    Serial.println(response->text);
+  }
+}
+
+void setup() 
+{
+  Serial.begin(115200);
+  mySerial.begin(57600);// Software Serial doesn't seem to work above 57600 baud. Hardware serial works at 115200.
+  pinMode(ledPin,OUTPUT);
+
+  myWifi.resetModuleUsingDelay(5000);
+  myWifi.enterCommandMode();
+}
+
+void loop() 
+{
+  myWifi.poll();// process any queued commands and their responses
+
+  // Ask for the network status every 2 seconds, without waiting for the answer
+  if (millis()-lastStatusTime > 2000 && myWifi.commandsPending()==0)
+  {
+    lastStatusTime=millis();
+    myWifi.queueCommand("AT+LKSTT\r",5000,networkStatusReceived);
+  }
+
+  if (millis()-lastFlashTime > 250)
+  {
+    lastFlashTime=millis();
+    ledState=!ledState;
+    digitalWrite(ledPin,ledState);
+  }
+}
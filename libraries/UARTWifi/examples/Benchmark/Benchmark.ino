@@ -0,0 +1,318 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <UARTWifi.h>
+#include <UARTWifiBufferedSerial.h>
+#include <SoftwareSerial.h>
+
+/* 
+ * This program measures how long each of the library's methods takes, and the data rates for sending and receiving,
+ * so that changes to the library (or to its timing constants) can be compared against a baseline.
+ * It can be run against a real module, or against a second Arduino running the ModuleSimulator example.
+ *
+ * For each method it prints the number of calls, calls per second, the min, mean and max time, the 50th and 90th percentiles,
+ * and for methods which transfer data, the data rate. Percentiles are the upper limit of a power of two bucket, so are approximate.
+ *
+ * Receive throughput needs a server which sends continuously (e.g. chargen, port 19), and send throughput needs a server which
+ * accepts data (e.g. echo, port 7). The ModuleSimulator provides both.
+ */
+
+#define BENCHMARK_HOST "192.168.1.10"
+#define BENCHMARK_ECHO_PORT "7"
+#define BENCHMARK_CHARGEN_PORT "19"
+#define BENCHMARK_ITERATIONS 20
+
+SoftwareSerial mySerial(10, 11); // RX, TX
+// A larger receive buffer than the serial port's 64 bytes. The high water marks printed at the end show how much of each was used
+char rxStorage[128];
+UARTWifiBufferedSerial bufferedSerial(&mySerial,rxStorage,sizeof(rxStorage));
+UARTWifi myWifi = UARTWifi(&bufferedSerial,8,9);
+
+// Latency buckets. Bucket 0 is under 1ms, bucket n is 2^(n-1) to 2^n ms, and the last bucket is everything longer
+#define LATENCY_BUCKETS 16
+
+typedef struct
+{
+  unsigned int count;
+  unsigned int failures;
+  unsigned long totalMicros;
+  unsigned long minMicros;
+  unsigned long maxMicros;
+  unsigned long bytes;
+  unsigned int buckets[LATENCY_BUCKETS];
+} MethodStats;
+
+char buffer[256];
+unsigned long startMicros;
+
+void startTiming()
+{
+  startMicros=micros();
+}
+
+// Records the time since startTiming(). ok is whether the method succeeded, bytes the amount of data it transferred
+void stopTiming(MethodStats *stats,boolean ok,long bytes)
+{
+  unsigned long elapsed=micros()-startMicros;
+
+  if (!ok)
+  {
+    stats->failures++;
+    return;
+  }
+  if (stats->count==0 || elapsed<stats->minMicros)
+  {
+    stats->minMicros=elapsed;
+  }
+  if (elapsed>stats->maxMicros)
+  {
+    stats->maxMicros=elapsed;
+  }
+  stats->count++;
+  stats->totalMicros+=elapsed;
+  stats->bytes+=bytes;
+
+  int bucket=0;
+  for(unsigned long ms=elapsed/1000;ms && bucket<LATENCY_BUCKETS-1;ms>>=1)
+  {
+    bucket++;
+  }
+  stats->buckets[bucket]++;
+}
+
+// Upper limit, in ms, of the bucket containing the given percentile
+unsigned long percentile(MethodStats *stats,int percent)
+{
+  unsigned int target=((unsigned long)stats->count*percent+99)/100;
+  unsigned int total=0;
+
+  for(int i=0;i<LATENCY_BUCKETS;i++)
+  {
+    total+=stats->buckets[i];
+    if (total>=target)
+    {
+      return 1UL<<i;
+    }
+  }
+  return 1UL<<(LATENCY_BUCKETS-1);
+}
+
+void printHeader()
+{
+  Serial.println(F("method\tcalls\tfailed\tcalls/s\tmin ms\tmean ms\tmax ms\tp50 ms\tp90 ms\tbytes/s"));
+}
+
+void printStats(const __FlashStringHelper *name,MethodStats *stats)
+{
+  Serial.print(name);
+  Serial.print('\t');
+  Serial.print(stats->count);
+  Serial.print('\t');
+  Serial.print(stats->failures);
+  Serial.print('\t');
+  if (stats->count)
+  {
+    Serial.print(stats->count*1000000.0/stats->totalMicros,1);
+    Serial.print('\t');
+    Serial.print(stats->minMicros/1000.0,1);
+    Serial.print('\t');
+    Serial.print(stats->totalMicros/1000.0/stats->count,1);
+    Serial.print('\t');
+    Serial.print(stats->maxMicros/1000.0,1);
+    Serial.print('\t');
+    Serial.print(percentile(stats,50));
+    Serial.print('\t');
+    Serial.print(percentile(stats,90));
+    Serial.print('\t');
+    if (stats->bytes)
+    {
+      Serial.print(stats->bytes*1000000.0/stats->totalMicros,0);
+    }
+  }
+  Serial.println();
+}
+
+MethodStats resetStats;
+MethodStats resetUntilReadyStats;
+MethodStats commandModeStats;
+MethodStats sendATStats;
+MethodStats networkStatusStats;
+MethodStats socketCreateStats;
+MethodStats socketStateStats;
+MethodStats socketSendStats;
+MethodStats socketSendStreamStats;
+MethodStats socketReceiveStats;
+MethodStats socketReceiveWaitStats;
+MethodStats socketCloseStats;
+
+// Generates the data sent by socketSendStream. context points to the number of bytes still to send
+int generateData(char *data,int maxLength,void *context)
+{
+  long *remaining=(long *)context;
+  int length = (*remaining<maxLength) ? *remaining : maxLength;
+  for(int i=0;i<length;i++)
+  {
+    data[i]='0'+i%10;
+  }
+  *remaining-=length;
+  return length;
+}
+
+void benchmarkCommands()
+{
+  for(int i=0;i<BENCHMARK_ITERATIONS;i++)
+  {
+    startTiming();
+    stopTiming(&sendATStats,myWifi.sendAT(),0);
+
+    startTiming();
+    stopTiming(&networkStatusStats,myWifi.getNetworkStatus(buffer,sizeof(buffer))==0,0);
+  }
+}
+
+void benchmarkSend()
+{
+  int socketNum;
+
+  startTiming();
+  int status=myWifi.socketCreate("0","0",BENCHMARK_HOST,BENCHMARK_ECHO_PORT,&socketNum);
+  stopTiming(&socketCreateStats,status==0,0);
+  if (status!=0)
+  {
+    return;
+  }
+
+  memset(buffer,'x',64);
+  for(int i=0;i<BENCHMARK_ITERATIONS;i++)
+  {
+    startTiming();
+    int sent=myWifi.socketSend(buffer,64,socketNum);
+    stopTiming(&socketSendStats,sent>=0,sent);
+
+    startTiming();
+    stopTiming(&socketStateStats,myWifi.socketGetConnectionState(buffer+64,socketNum,sizeof(buffer)-64)==0,0);
+  }
+
+  for(int i=0;i<BENCHMARK_ITERATIONS/4;i++)
+  {
+    long remaining=1024;
+    UARTWifiSource source(generateData,&remaining);
+    startTiming();
+    long sent=myWifi.socketSendStream(&source,socketNum);
+    stopTiming(&socketSendStreamStats,sent>=0,sent);
+  }
+
+  startTiming();
+  stopTiming(&socketCloseStats,myWifi.socketClose(socketNum)==0,0);
+}
+
+void benchmarkReceive()
+{
+  int socketNum;
+
+  startTiming();
+  int status=myWifi.socketCreate("0","0",BENCHMARK_HOST,BENCHMARK_CHARGEN_PORT,&socketNum);
+  stopTiming(&socketCreateStats,status==0,0);
+  if (status!=0)
+  {
+    return;
+  }
+
+  for(int i=0;i<BENCHMARK_ITERATIONS;i++)
+  {
+    startTiming();
+    int received=myWifi.socketReceive(buffer,129,socketNum);
+    stopTiming(&socketReceiveStats,received>=0,received);
+
+    startTiming();
+    received=myWifi.socketReceiveWait(buffer,sizeof(buffer),socketNum);
+    stopTiming(&socketReceiveWaitStats,received>0,received);
+  }
+
+  startTiming();
+  stopTiming(&socketCloseStats,myWifi.socketClose(socketNum)==0,0);
+}
+
+void setup() 
+{
+  Serial.begin(115200);
+  mySerial.begin(57600);// Software Serial doesn't seem to work above 57600 baud. Hardware serial works at 115200.
+
+  Serial.println(F("Resetting the module"));
+  startTiming();
+  myWifi.resetModuleUsingRTS();
+  stopTiming(&resetStats,true,0);
+
+  startTiming();
+  stopTiming(&resetUntilReadyStats,myWifi.resetUntilReady()==0,0);
+  UARTWifiReadyStats *readyStats=myWifi.readyStats();
+
+  startTiming();
+  stopTiming(&commandModeStats,myWifi.enterCommandMode(),0);
+
+  Serial.println(F("Running"));
+  benchmarkCommands();
+  benchmarkSend();
+  benchmarkReceive();
+
+  printHeader();
+  printStats(F("resetModuleUsingRTS"),&resetStats);
+  printStats(F("resetUntilReady"),&resetUntilReadyStats);
+  printStats(F("enterCommandMode"),&commandModeStats);
+  printStats(F("sendAT"),&sendATStats);
+  printStats(F("getNetworkStatus"),&networkStatusStats);
+  printStats(F("socketCreate"),&socketCreateStats);
+  printStats(F("socketGetConnectionState"),&socketStateStats);
+  printStats(F("socketSend 64"),&socketSendStats);
+  printStats(F("socketSendStream 1024"),&socketSendStreamStats);
+  printStats(F("socketReceive 128"),&socketReceiveStats);
+  printStats(F("socketReceiveWait"),&socketReceiveWaitStats);
+  printStats(F("socketClose"),&socketCloseStats);
+
+  Serial.print(F("Time to ready: RTS "));
+  Serial.print(readyStats->rtsMillis);
+  Serial.print(F("ms, +++ answered "));
+  Serial.print(readyStats->bootMillis);
+  Serial.print(F("ms after "));
+  Serial.print(readyStats->probes);
+  Serial.print(F(" probes, link up "));
+  Serial.print(readyStats->linkMillis);
+  Serial.print(F("ms after "));
+  Serial.print(readyStats->linkQueries);
+  Serial.println(F(" queries"));
+
+  Serial.print(F("Receive buffer high water "));
+  Serial.print(bufferedSerial.rxHighWater());
+  Serial.print(F(" of "));
+  Serial.print(sizeof(rxStorage));
+  Serial.print(F(", serial port high water "));
+  Serial.print(bufferedSerial.serialHighWater());
+  Serial.print(F(", buffer full "));
+  Serial.print(bufferedSerial.rxFullCount());
+  Serial.println(F(" times"));
+
+  // Per command statistics, collected by the library if UARTWIFI_STATS is set to 1 in UARTWifi.h
+  myWifi.dumpStats(&Serial);
+}
+
+void loop() 
+{
+  return;
+}
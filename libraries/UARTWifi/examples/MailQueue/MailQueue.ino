@@ -0,0 +1,106 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <UARTWifi.h>
+#include <UARTWifiMailQueue.h>
+#include <SoftwareSerial.h>
+#include <EEPROM.h>
+#include <UARTWifiEEPROMStore.h>
+
+/* 
+ * This program demonstrates the outbound mail queue.
+ * An alert email is queued each time the button on pin 2 is pressed. The queue is kept in EEPROM, so alerts which haven't
+ * been sent yet survive a reset, and if the mail server can't be reached they are retried later.
+ * Alerts queued close together are sent over one connection to the mail server.
+ * mailQueue.poll() blocks while an alert is being sent, so the button is read by an interrupt and presses aren't missed.
+ *
+ * The program presumes that the module has already been configued using the Web Admin program on port 80
+ * and that the network is connected.
+ */
+
+SoftwareSerial mySerial(10, 11); // RX, TX
+UARTWifi myWifi = UARTWifi(&mySerial,8,9);
+
+UARTWifiSmtpSession smtpSession(&myWifi,"mailserver ip or url","localhost");
+UARTWifiMailQueue mailQueue(&smtpSession,readUARTWifiEEPROM,writeUARTWifiEEPROM);
+
+int buttonPin = 2;// external interrupt 0 on an Uno
+volatile int buttonPresses;
+unsigned long lastPressTime;
+int alertNumber;
+
+void buttonPressed()
+{
+  if (millis()-lastPressTime > 50)// ignore switch bounce
+  {
+    buttonPresses++;
+  }
+  lastPressTime=millis();
+}
+
+// Called by mailQueue.poll() when an alert has been sent, or has been given up on
+void alertDone(unsigned int id,int status,void *context)
+{
+  Serial.print(F("Alert "));
+  Serial.print(id);
+  if (status==0)
+  {
+    Serial.println(F(" sent"));
+  }
+  else
+  {
+    Serial.print(F(" failed. Error "));
+    Serial.println(status);
+  }
+}
+
+void setup() 
+{
+  Serial.begin(115200);
+  mySerial.begin(57600);// Software Serial doesn't seem to work above 57600 baud. Hardware serial works at 115200.
+  pinMode(buttonPin,INPUT_PULLUP);
+  attachInterrupt(0,buttonPressed,FALLING);
+
+  mailQueue.setCallback(alertDone);
+  Serial.print(mailQueue.begin());
+  Serial.println(F(" alerts still to send from before the reset"));
+
+  myWifi.enterCommandMode();
+}
+
+void loop() 
+{
+  noInterrupts();
+  int presses=buttonPresses;
+  buttonPresses=0;
+  interrupts();
+
+  while(presses--)
+  {
+    char message[32];
+    sprintf(message,"Button pressed. Alert %d",alertNumber++);
+    if (mailQueue.enqueue("toAddress@email.com","from@yourEmail.com","Alarm","Alert",message)<0)
+    {
+      Serial.println(F("Mail queue full"));
+    }
+  }
+
+  mailQueue.poll();// sends one queued alert per call, and returns once it has been sent
+}
@@ -0,0 +1,402 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+
+/* 
+ * This program turns a second Arduino into a simulation of the TLN13UA06 module, so the library (and the Benchmark example)
+ * can be run without a module, and with known response times and errors.
+ *
+ * Connect this Arduino's serial port to the serial port the library is using, GND to GND, SIM_RESET_PIN to the library's reset pin
+ * and SIM_RTS_PIN to the library's RTS pin. Because the serial port is used for the module, there is no debug output.
+ *
+ * Commands simulated are AT+, AT+SKCT, AT+SKSND, AT+SKRCV, AT+SKCLS, AT+SKSTT, AT+SKSDF, AT+LKSTT, AT+ATRM, AT+ENTM and +++
+ * Sockets connected to port 19 (chargen) always have data waiting to be received. Sockets connected to any other port receive
+ * as many bytes as were sent to them (test data, as there isn't enough RAM to store what was sent).
+ * In transparent mode, the data sent is echoed back.
+ */
+
+// Link to the library
+#define SIM_SERIAL Serial
+#define SIM_BAUD 57600
+
+// Time taken to respond to each command, i.e SIM_LATENCY plus a random time up to SIM_JITTER (ms)
+#define SIM_LATENCY 2
+#define SIM_JITTER 3
+
+// Error injection. Percentage of commands which get no response at all, and percentage of socket commands which return +ERR=-13
+#define SIM_DROP_RATE 0
+#define SIM_ERROR_RATE 0
+
+// Time from the end of a reset until nRTS goes low to say the module is ready (ms)
+#define SIM_BOOT_TIME 1500
+#define SIM_RESET_PIN 8
+#define SIM_RTS_PIN 9
+
+// Time without data either side of +++ needed to leave transparent mode (ms)
+#define SIM_ESCAPE_GUARD_TIME 1000
+
+#define SIM_MAX_SOCKETS 8
+#define SIM_MAX_SEND_SIZE 1024
+#define SIM_CHARGEN_PORT 19
+#define SIM_DATA_TIMEOUT 1000
+
+typedef struct
+{
+  boolean open;
+  unsigned int port;
+  unsigned long rxPending;// bytes waiting to be received
+} SimSocket;
+
+// Socket 1 is the auto-work socket used in transparent mode, so sockets created by AT+SKCT are numbered from 2
+SimSocket sockets[SIM_MAX_SOCKETS+2];
+int defaultSocket=1;
+boolean transparentMode;
+boolean inReset;
+unsigned long readyTime;
+char command[64];
+int commandLength;
+unsigned long lastByteTime;
+int plusCount;
+char pattern;
+
+void reply(const char *text)
+{
+  SIM_SERIAL.print(text);
+  SIM_SERIAL.print(F("\r\n\r\n"));
+}
+
+void replyValue(long value)
+{
+  char text[16];
+  sprintf(text,"+OK=%ld",value);
+  reply(text);
+}
+
+void replyError(int code)
+{
+  char text[16];
+  sprintf(text,"+ERR=%d",code);
+  reply(text);
+}
+
+// Returns the socket number in the command if the socket is open, otherwise sends +ERR and returns 0
+int commandSocket(char *parameters)
+{
+  int socketNum=atoi(parameters);
+  if (socketNum<1 || socketNum>SIM_MAX_SOCKETS+1 || !sockets[socketNum].open)
+  {
+    replyError(-2);
+    return 0;
+  }
+  if (random(100)<SIM_ERROR_RATE)
+  {
+    replyError(-13);
+    return 0;
+  }
+  return socketNum;
+}
+
+// Sends count bytes of printable test data
+void sendPattern(unsigned long count)
+{
+  while(count--)
+  {
+    SIM_SERIAL.write(' '+pattern);
+    pattern=(pattern+1)%95;
+  }
+}
+
+void socketCreate(char *parameters)
+{
+  // AT+SKCT=<protocol>,<cs mode>,<host>,<port>
+  char *port=strrchr(parameters,',');
+  if (!port || random(100)<SIM_ERROR_RATE)
+  {
+    replyError(-13);// can't connect
+    return;
+  }
+  for(int i=2;i<SIM_MAX_SOCKETS+2;i++)
+  {
+    if (!sockets[i].open)
+    {
+      sockets[i].open=true;
+      sockets[i].port=atoi(port+1);
+      sockets[i].rxPending=0;
+      replyValue(i);
+      return;
+    }
+  }
+  replyError(-13);
+}
+
+void socketSend(char *parameters)
+{
+  // AT+SKSND=<socket>,<size>, followed by the data once the module has said how much it will accept
+  int socketNum=commandSocket(parameters);
+  char *size=strchr(parameters,',');
+  if (!socketNum || !size)
+  {
+    return;
+  }
+  long accepted=atol(size+1);
+  if (accepted>SIM_MAX_SEND_SIZE)
+  {
+    accepted=SIM_MAX_SEND_SIZE;
+  }
+  replyValue(accepted);
+
+  long received=0;
+  unsigned long startTime=millis();
+  while(received<accepted && (millis()-startTime)<SIM_DATA_TIMEOUT)
+  {
+    if (SIM_SERIAL.read()>=0)
+    {
+      received++;
+      startTime=millis();
+    }
+  }
+  if (sockets[socketNum].port!=SIM_CHARGEN_PORT)
+  {
+    sockets[socketNum].rxPending+=received;// the same amount of data comes back
+  }
+}
+
+void socketReceive(char *parameters)
+{
+  // AT+SKRCV=<socket>,<max size>
+  int socketNum=commandSocket(parameters);
+  char *maxSize=strchr(parameters,',');
+  if (!socketNum || !maxSize)
+  {
+    return;
+  }
+  unsigned long size=atol(maxSize+1);
+  if (sockets[socketNum].port!=SIM_CHARGEN_PORT && size>sockets[socketNum].rxPending)
+  {
+    size=sockets[socketNum].rxPending;
+  }
+  if (sockets[socketNum].port!=SIM_CHARGEN_PORT)
+  {
+    sockets[socketNum].rxPending-=size;
+  }
+  replyValue(size);
+  sendPattern(size);
+}
+
+void socketState(char *parameters)
+{
+  int socketNum=commandSocket(parameters);
+  if (socketNum)
+  {
+    char text[48];
+    sprintf(text,"+OK=%d,2,192.168.1.10,%u,%lu",socketNum,sockets[socketNum].port,sockets[socketNum].rxPending);
+    reply(text);
+  }
+}
+
+void runCommand()
+{
+  if (random(100)<SIM_DROP_RATE)
+  {
+    return;// no response, so the library times out
+  }
+  delay(SIM_LATENCY+random(SIM_JITTER+1));
+
+  char *parameters=strchr(command,'=');
+  parameters = parameters ? parameters+1 : command+commandLength;
+
+  if (strcmp_P(command,PSTR("AT+"))==0)
+  {
+    reply("+OK");
+  }
+  else if (strncmp_P(command,PSTR("AT+SKCT="),8)==0)
+  {
+    socketCreate(parameters);
+  }
+  else if (strncmp_P(command,PSTR("AT+SKSND="),9)==0)
+  {
+    socketSend(parameters);
+  }
+  else if (strncmp_P(command,PSTR("AT+SKRCV="),9)==0)
+  {
+    socketReceive(parameters);
+  }
+  else if (strncmp_P(command,PSTR("AT+SKCLS="),9)==0)
+  {
+    int socketNum=commandSocket(parameters);
+    if (socketNum)
+    {
+      sockets[socketNum].open=(socketNum==1);// the auto-work socket can't be closed
+      reply("+OK");
+    }
+  }
+  else if (strncmp_P(command,PSTR("AT+SKSTT="),9)==0)
+  {
+    socketState(parameters);
+  }
+  else if (strncmp_P(command,PSTR("AT+SKSDF="),9)==0)
+  {
+    int socketNum=commandSocket(parameters);
+    if (socketNum)
+    {
+      defaultSocket=socketNum;
+      reply("+OK");
+    }
+  }
+  else if (strcmp_P(command,PSTR("AT+LKSTT"))==0)
+  {
+    reply("+OK=1,192.168.1.99,255.255.255.0,192.168.1.1,192.168.1.1");
+  }
+  else if (strcmp_P(command,PSTR("AT+ATRM"))==0)
+  {
+    reply("+OK=0,0,192.168.1.10,7");
+  }
+  else if (strcmp_P(command,PSTR("AT+ENTM"))==0)
+  {
+    reply("+OK");
+    transparentMode=true;
+    plusCount=0;
+  }
+  else
+  {
+    replyError(-1);
+  }
+}
+
+// Module reset. nRTS is low while the module is in reset and until it has booted, except for a short high pulse after the reset ends
+void checkReset()
+{
+  if (digitalRead(SIM_RESET_PIN)==LOW)
+  {
+    if (!inReset)
+    {
+      inReset=true;
+      digitalWrite(SIM_RTS_PIN,LOW);
+    }
+    return;
+  }
+  if (inReset)
+  {
+    inReset=false;
+    digitalWrite(SIM_RTS_PIN,HIGH);// booting
+    readyTime=millis()+SIM_BOOT_TIME;
+    for(int i=0;i<SIM_MAX_SOCKETS+2;i++)
+    {
+      sockets[i].open=(i==1);
+      sockets[i].rxPending=0;
+    }
+    defaultSocket=1;
+    transparentMode=true;// the module starts in transparent mode
+    commandLength=0;
+    plusCount=0;
+    while(SIM_SERIAL.read()>=0);
+  }
+  if (readyTime && (long)(millis()-readyTime)>=0)
+  {
+    readyTime=0;
+    digitalWrite(SIM_RTS_PIN,LOW);// ready
+  }
+}
+
+void commandModeLoop()
+{
+  int c=SIM_SERIAL.read();
+  if (c<0)
+  {
+    return;
+  }
+  if (c=='\r')
+  {
+    command[commandLength]=0;
+    runCommand();
+    commandLength=0;
+    return;
+  }
+  if (commandLength<(int)sizeof(command)-1)
+  {
+    command[commandLength++]=c;
+  }
+  command[commandLength]=0;
+  if (strcmp_P(command,PSTR("+++"))==0)
+  {
+    reply("+OK");// already in command mode
+    commandLength=0;
+  }
+}
+
+void transparentModeLoop()
+{
+  // +++ is only recognised with a gap of SIM_ESCAPE_GUARD_TIME before and after it
+  if (plusCount==3 && (millis()-lastByteTime)>=SIM_ESCAPE_GUARD_TIME)
+  {
+    transparentMode=false;
+    plusCount=0;
+    commandLength=0;
+    reply("+OK");
+    return;
+  }
+
+  int c=SIM_SERIAL.read();
+  if (c<0)
+  {
+    return;
+  }
+  if (c=='+' && plusCount<3 && (plusCount>0 || (millis()-lastByteTime)>=SIM_ESCAPE_GUARD_TIME))
+  {
+    plusCount++;
+  }
+  else
+  {
+    // Not an escape, so echo the data, including any + held back
+    while(plusCount)
+    {
+      SIM_SERIAL.write('+');
+      plusCount--;
+    }
+    SIM_SERIAL.write(c);
+  }
+  lastByteTime=millis();
+}
+
+void setup() 
+{
+  SIM_SERIAL.begin(SIM_BAUD);
+  pinMode(SIM_RESET_PIN,INPUT_PULLUP);
+  pinMode(SIM_RTS_PIN,OUTPUT);
+  inReset=true;// start as though the module had just been reset
+}
+
+void loop() 
+{
+  checkReset();
+  if (inReset || readyTime)
+  {
+    return;
+  }
+  if (transparentMode)
+  {
+    transparentModeLoop();
+  }
+  else
+  {
+    commandModeLoop();
+  }
+}
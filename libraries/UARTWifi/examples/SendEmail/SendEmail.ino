@@ -57,37 +57,27 @@ void setup()
    */
   mySerial.begin(57600);// Software Serial doesn't seem to work above 57600 baud. Hardware serial works at 115200.
 
-  boolean connected=false;
-
   // Keep trying until connection to the network is achieved.
-  while(!connected)
+  while(true)
   {
         Serial.println(F("Resetting the module"));
-        // There are 2 methods to reset the module resetModuleUsingDelay() and resetModule()
-        // myWifi.resetModuleUsingRTS(); If RTS is connected to the Arduino, it can be used to sense whe the module is ready
-        myWifi.resetModuleUsingDelay(5000);// Alternatively just use this method which has a default delay of 5000 which is normally enough.
- 
-  
-        Serial.println(F("Trying to enter command mode")); 
-        // entrCommandMode()  sends ""+++" to the module which should respnond straight away with "+OK"
-        if (myWifi.enterCommandMode())
-        {
-          // module must have returned "+OK"
-
-          Serial.println(F("Command mode OK"));
-          Serial.println(F("Wait for network to connect"));
-          
-          // Although the module is responding to commands, its possible that its Wifi link has not finished negotiating and logging in with the router / access point
-          // waitForNetworkToConnect sends LKSTT to get the network connection state and waits until its connected. Note, It can wait indefinately retrying.
-          myWifi.waitForNetworkToConnect();// Note, this waits forever at the moment. Need to add a timeout to this. To. Do, put timeout and retries into waitForNetworkToConnect()
-          Serial.println(F("Network connected"));
-          connected=true;
-        }
-        else
+        // resetUntilReady() resets the module, sends "+++" until the module responds with "+OK" (which puts it in command mode),
+        // then sends LKSTT until the module's Wifi link has finished negotiating and logging in with the router / access point.
+        // It returns as soon as that has happened, rather than waiting a fixed time, and gives up after 20 seconds.
+        // If RTS is connected to the Arduino, the module saying it is ready triggers the first "+++" straight away.
+        // There are also 2 simpler methods to reset the module, resetModuleUsingDelay() and resetModuleUsingRTS()
+        if (myWifi.resetUntilReady()==0)
         {
-          // If the module doesnt resond to commands, all we can do is reset and try again. This often resolves the problem, even if 2 or 3 reset loops are required.
-          Serial.println(F("Error. Unable to enter command mode :-("));
+          UARTWifiReadyStats *stats=myWifi.readyStats();
+          Serial.print(F("Module answered after "));
+          Serial.print(stats->bootMillis);
+          Serial.print(F("ms, network connected after "));
+          Serial.print(stats->linkMillis);
+          Serial.println(F("ms"));
+          break;
         }
+        // If the module doesnt resond to commands, all we can do is reset and try again. This often resolves the problem, even if 2 or 3 reset loops are required.
+        Serial.println(F("Error. Module not ready :-("));
    }
 
   // we should be ready to go !
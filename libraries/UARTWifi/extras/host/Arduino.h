@@ -0,0 +1,187 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef Arduino_h
+#define Arduino_h
+
+/*
+ * Just enough of the Arduino core to build the library, and the sketches in this repository, on a PC with -DARDUINO=100, so that they
+ * can be tested and benchmarked without a board. PROGMEM data is ordinary data, and the pins and analog inputs are arrays which the
+ * test programs can set. Time is simulated, see host.h, so a benchmark gives the same result on any PC.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+// The C++ library headers which the test programs use, included before the min() and max() macros, which would break them
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define NUM_DIGITAL_PINS 20
+
+#ifndef min
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#endif
+#define _BV(bit) (1<<(bit))
+#define bitRead(value,bit) (((value)>>(bit))&1)
+
+// Program memory is ordinary memory on the PC
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) ((char *)(s))
+typedef char prog_char;
+typedef unsigned char prog_uchar;
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+// Tables of pointers and ints are read with pgm_read_word(), so it reads whatever type the table has, as they are bigger on the PC
+template<class T> inline T pgmReadHost(const T *p) { return *p; }
+#define pgm_read_word(p) pgmReadHost(p)
+#define pgm_read_dword(p) pgmReadHost(p)
+#define pgm_read_byte_near(p) pgm_read_byte(p)
+#define pgm_read_word_near(p) pgm_read_word(p)
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcat_P strcat
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcasecmp_P strcasecmp
+#define strncasecmp_P strncasecmp
+#define strstr_P strstr
+#define strchr_P strchr
+#define memcpy_P memcpy
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *)(s))
+
+char *itoa(int value,char *s,int radix);
+char *ltoa(long value,char *s,int radix);
+char *utoa(unsigned int value,char *s,int radix);
+char *ultoa(unsigned long value,char *s,int radix);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin,uint8_t mode);
+void digitalWrite(uint8_t pin,uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin,int value);
+void attachInterrupt(uint8_t interruptNum,void (*handler)(),int mode);
+void detachInterrupt(uint8_t interruptNum);
+void noInterrupts();
+void interrupts();
+
+long random(long howBig);
+long random(long howSmall,long howBig);
+void randomSeed(unsigned long seed);
+
+class Print
+{
+  public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c)=0;
+	virtual size_t write(const uint8_t *buffer,size_t size);
+	size_t write(const char *str) { return write((const uint8_t *)str,strlen(str)); }
+	size_t write(const char *buffer,size_t size) { return write((const uint8_t *)buffer,size); }
+	size_t print(const __FlashStringHelper *str);// a byte at a time, as the core's does
+	size_t print(const char *str) { return write(str); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(unsigned char value,int base=DEC) { return print((unsigned long)value,base); }
+	size_t print(int value,int base=DEC) { return print((long)value,base); }
+	size_t print(unsigned int value,int base=DEC) { return print((unsigned long)value,base); }
+	size_t print(long value,int base=DEC);
+	size_t print(unsigned long value,int base=DEC);
+	size_t print(double value,int digits=2);
+	size_t println() { return write("\r\n"); }
+	template<class T> size_t println(T value) { size_t n=print(value); return n+println(); }
+	template<class T> size_t println(T value,int format) { size_t n=print(value,format); return n+println(); }
+};
+
+class Stream : public Print
+{
+  public:
+	virtual int available()=0;
+	virtual int read()=0;
+	virtual int peek()=0;
+	virtual void flush() {}
+	void setTimeout(unsigned long timeout) {}
+	size_t readBytes(char *buffer,size_t length);
+};
+
+/*
+ * A serial port. What the sketch writes is kept in output, and input is what it will read. The test program adds to input and takes
+ * from output, and calls to the port are counted, see host.h
+ */
+class HardwareSerial : public Stream
+{
+  public:
+	HardwareSerial();
+	void begin(unsigned long baud) {}
+	void end() {}
+	virtual int available();
+	virtual int read();
+	virtual int peek();
+	virtual size_t write(uint8_t c);
+	virtual size_t write(const uint8_t *buffer,size_t size);
+	using Print::write;
+	operator bool() { return true; }
+
+	std::string input;
+	size_t inputPos;
+	std::string output;
+	unsigned long availableCalls;
+	unsigned long readCalls;
+	unsigned long writeCalls;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif //Arduino_h
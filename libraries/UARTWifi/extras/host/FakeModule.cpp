@@ -0,0 +1,486 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "FakeModule.h"
+
+#define FAKE_MAX_SEND_SIZE 1024
+#define FAKE_ESCAPE_GUARD_TIME 1000000000ULL// ns
+
+static unsigned long long now()
+{
+	return hostMicros()*1000ULL;
+}
+
+FakeModule::FakeModule(unsigned long baud)
+{
+	_byteNanos=10000000000ULL/baud;// start bit, 8 data bits and a stop bit
+	latencyMicros=2000;
+	networkMicros=20000;
+	smtpPipelining=true;
+	reset();
+}
+
+void FakeModule::reset()
+{
+	availableCalls=readCalls=writeCalls=0;
+	bytesIn=bytesOut=commands=0;
+	maxOutstanding=0;
+	smtpConnections=smtpMessages=0;
+	commandLog.clear();
+	_out.clear();
+	_due=0;
+	_outEnd=_inEnd=_lastByteTime=0;
+	_responseEnds.clear();
+	_readTotal=0;
+	_command.clear();
+	_transparent=false;
+	_plusCount=0;
+	_sendSocket=0;
+	_sendRemaining=0;
+	for(int i=0;i<FAKE_MAX_SOCKETS+2;i++)
+	{
+		_sockets[i].open=(i==1);
+		_sockets[i].port=0;
+		_sockets[i].rx.clear();
+		_sockets[i].chargen=0;
+		_sockets[i].smtpLine.clear();
+		_sockets[i].smtpData=false;
+		_sockets[i].smtpRecipients=0;
+	}
+	_scripts.clear();
+}
+
+void FakeModule::script(const char *prefix,const char *response)
+{
+	_scripts.push_back(std::make_pair(std::string(prefix),std::string(response)));
+}
+
+// Counts the bytes at the front of _out which have arrived by now
+void FakeModule::due()
+{
+	unsigned long long t=now();
+
+	while(_due<_out.size() && _out[_due].first<=t)
+	{
+		_due++;
+	}
+}
+
+// Time moves on when nothing is available, so that code which waits by calling available() in a loop, as the library's first
+// version did, gets its data
+int FakeModule::available()
+{
+	availableCalls++;
+	due();
+	if (!_due)
+	{
+		hostAdvance(hostTimeStep);
+	}
+	return (int)_due;
+}
+
+int FakeModule::read()
+{
+	readCalls++;
+	due();
+	if (_due==0)
+	{
+		return -1;
+	}
+	int c=(unsigned char)_out.front().second;
+	_out.pop_front();
+	_due--;
+	_readTotal++;
+	return c;
+}
+
+int FakeModule::peek()
+{
+	due();
+	return _due ? (unsigned char)_out.front().second : -1;
+}
+
+size_t FakeModule::write(uint8_t c)
+{
+	return write(&c,1);
+}
+
+size_t FakeModule::write(const uint8_t *buffer,size_t size)
+{
+	writeCalls++;
+	bytesIn+=size;
+	for(size_t i=0;i<size;i++)
+	{
+		char c=buffer[i];
+		unsigned long long t=now();
+
+		_inEnd=(_inEnd>t ? _inEnd : t)+_byteNanos;// when the byte has arrived at the module
+		if (_sendRemaining>0)
+		{
+			_sendRemaining--;
+			socketData(_sendSocket,c);
+		}
+		else if (_transparent)
+		{
+			if (c=='+' && (_plusCount>0 || _inEnd-_lastByteTime>=FAKE_ESCAPE_GUARD_TIME))
+			{
+				if (++_plusCount==3)
+				{
+					// The module only answers once there has been no data for the guard time after the +++
+					_inEnd+=FAKE_ESCAPE_GUARD_TIME;
+					_transparent=false;
+					_plusCount=0;
+					respond("+OK");
+				}
+			}
+			else
+			{
+				std::string echo(_plusCount,'+');
+
+				_plusCount=0;
+				echo+=c;
+				unsigned long long start=_inEnd>_outEnd ? _inEnd : _outEnd;
+				for(size_t j=0;j<echo.size();j++)
+				{
+					_out.push_back(std::make_pair(start+(j+1)*_byteNanos,echo[j]));
+				}
+				_outEnd=start+echo.size()*_byteNanos;
+				bytesOut+=echo.size();
+			}
+			_lastByteTime=_inEnd;
+		}
+		else if (c=='\r')
+		{
+			command(_command);
+			_command.clear();
+		}
+		else
+		{
+			_command+=c;
+			if (_command=="+++")
+			{
+				respond("+OK");// already in command mode
+				_command.clear();
+			}
+		}
+	}
+	return size;
+}
+
+// Queues a response, followed by its data if any, to start latencyMicros after the command arrived
+void FakeModule::respond(const std::string &text,const std::string &data)
+{
+	std::string bytes=text+"\r\n\r\n"+data;
+	unsigned long long start=_inEnd+latencyMicros*1000ULL;
+
+	if (start<_outEnd)
+	{
+		start=_outEnd;
+	}
+	for(size_t i=0;i<bytes.size();i++)
+	{
+		_out.push_back(std::make_pair(start+(i+1)*_byteNanos,bytes[i]));
+	}
+	_outEnd=start+bytes.size()*_byteNanos;
+	bytesOut+=bytes.size();
+	_responseEnds.push_back(_readTotal+_out.size());
+}
+
+// Returns the socket number in the command if the socket is open, otherwise responds with +ERR and returns 0
+int FakeModule::socketParameter(const std::string &parameters)
+{
+	int socketNum=atoi(parameters.c_str());
+
+	if (socketNum<1 || socketNum>FAKE_MAX_SOCKETS+1 || !_sockets[socketNum].open)
+	{
+		respond("+ERR=-2");
+		return 0;
+	}
+	return socketNum;
+}
+
+void FakeModule::command(const std::string &text)
+{
+	commands++;
+	commandLog.push_back(text);
+	while(!_responseEnds.empty() && _responseEnds.front()<=_readTotal)
+	{
+		_responseEnds.pop_front();
+	}
+	if (_responseEnds.size()+1>maxOutstanding)
+	{
+		maxOutstanding=_responseEnds.size()+1;
+	}
+
+	for(size_t i=0;i<_scripts.size();i++)
+	{
+		if (text.compare(0,_scripts[i].first.size(),_scripts[i].first)==0)
+		{
+			std::string response=_scripts[i].second;
+
+			_scripts.erase(_scripts.begin()+i);
+			if (!response.empty())
+			{
+				respond(response);
+			}
+			return;
+		}
+	}
+
+	size_t equals=text.find('=');
+	std::string name=text.substr(0,equals);
+	std::string parameters=(equals==std::string::npos) ? std::string() : text.substr(equals+1);
+	char value[64];
+	int socketNum;
+
+	if (name=="AT+")
+	{
+		respond("+OK");
+	}
+	else if (name=="AT+SKCT")
+	{
+		// AT+SKCT=<protocol>,<cs mode>,<host>,<port>
+		size_t comma=parameters.rfind(',');
+		if (comma==std::string::npos)
+		{
+			respond("+ERR=-4");
+			return;
+		}
+		for(socketNum=2;socketNum<FAKE_MAX_SOCKETS+2 && _sockets[socketNum].open;socketNum++)
+		{
+		}
+		if (socketNum==FAKE_MAX_SOCKETS+2)
+		{
+			respond("+ERR=-13");
+			return;
+		}
+		Socket *socket=&_sockets[socketNum];
+		socket->open=true;
+		socket->port=atoi(parameters.c_str()+comma+1);
+		socket->rx.clear();
+		socket->chargen=0;
+		socket->smtpLine.clear();
+		socket->smtpData=false;
+		socket->smtpRecipients=0;
+		if (socket->port==FAKE_SMTP_PORT)
+		{
+			smtpConnections++;
+			networkReply(socket,"220 fake.example.com ESMTP\r\n");
+		}
+		sprintf(value,"+OK=%d",socketNum);
+		respond(value);
+	}
+	else if (name=="AT+SKSND")
+	{
+		// AT+SKSND=<socket>,<size>, followed by the data once the module has said how much it will accept
+		if (!(socketNum=socketParameter(parameters)))
+		{
+			return;
+		}
+		size_t comma=parameters.find(',');
+		long size=(comma==std::string::npos) ? 0 : atol(parameters.c_str()+comma+1);
+		if (size>FAKE_MAX_SEND_SIZE)
+		{
+			size=FAKE_MAX_SEND_SIZE;
+		}
+		sprintf(value,"+OK=%ld",size);
+		respond(value);
+		_sendSocket=socketNum;
+		_sendRemaining=size;
+	}
+	else if (name=="AT+SKRCV")
+	{
+		// AT+SKRCV=<socket>,<max size>
+		if (!(socketNum=socketParameter(parameters)))
+		{
+			return;
+		}
+		Socket *socket=&_sockets[socketNum];
+		size_t comma=parameters.find(',');
+		long size=(comma==std::string::npos) ? 0 : atol(parameters.c_str()+comma+1);
+		std::string data;
+		if (size>FAKE_MAX_SEND_SIZE)
+		{
+			size=FAKE_MAX_SEND_SIZE;
+		}
+		while((long)data.size()<size)
+		{
+			if (socket->port==FAKE_CHARGEN_PORT)
+			{
+				data+=(char)(' '+socket->chargen++%95);
+			}
+			else if (!socket->rx.empty() && socket->rx.front().first<=_inEnd)
+			{
+				data+=socket->rx.front().second;
+				socket->rx.pop_front();
+			}
+			else
+			{
+				break;
+			}
+		}
+		sprintf(value,"+OK=%d",(int)data.size());
+		respond(value,data);
+	}
+	else if (name=="AT+SKCLS")
+	{
+		if ((socketNum=socketParameter(parameters)))
+		{
+			_sockets[socketNum].open=(socketNum==1);// the auto-work socket can't be closed
+			respond("+OK");
+		}
+	}
+	else if (name=="AT+SKSTT")
+	{
+		if ((socketNum=socketParameter(parameters)))
+		{
+			sprintf(value,"+OK=%d,2,192.168.1.10,%u,%u",socketNum,_sockets[socketNum].port,(unsigned int)_sockets[socketNum].rx.size());
+			respond(value);
+		}
+	}
+	else if (name=="AT+SKSDF")
+	{
+		if (socketParameter(parameters))
+		{
+			respond("+OK");
+		}
+	}
+	else if (name=="AT+LKSTT")
+	{
+		respond("+OK=1,192.168.1.99,255.255.255.0,192.168.1.1,192.168.1.1");
+	}
+	else if (name=="AT+ATRM")
+	{
+		respond("+OK=0,0,192.168.1.10,7");
+	}
+	else if (name=="AT+ENTM")
+	{
+		respond("+OK");
+		_transparent=true;
+		_plusCount=0;
+		_lastByteTime=_inEnd;
+	}
+	else
+	{
+		respond("+ERR=-1");
+	}
+}
+
+// A byte of the data of an AT+SKSND, which is sent to the other end of the socket
+void FakeModule::socketData(int socketNum,char c)
+{
+	Socket *socket=&_sockets[socketNum];
+
+	if (socket->port==FAKE_ECHO_PORT)
+	{
+		networkReply(socket,std::string(1,c));
+	}
+	else if (socket->port==FAKE_SMTP_PORT)
+	{
+		socket->smtpLine+=c;
+		if (c=='\n')
+		{
+			std::string line=socket->smtpLine.substr(0,socket->smtpLine.find_last_not_of("\r\n")+1);
+			socket->smtpLine.clear();
+			smtpLine(socket,line);
+		}
+	}
+}
+
+void FakeModule::networkReply(Socket *socket,const std::string &text)
+{
+	unsigned long long arrives=_inEnd+networkMicros*1000ULL;
+
+	for(size_t i=0;i<text.size();i++)
+	{
+		socket->rx.push_back(std::make_pair(arrives,text[i]));
+	}
+}
+
+// The SMTP server. Recipients containing "reject" are refused
+void FakeModule::smtpLine(Socket *socket,const std::string &line)
+{
+	if (socket->smtpData)
+	{
+		if (line==".")
+		{
+			socket->smtpData=false;
+			socket->smtpRecipients=0;
+			smtpMessages++;
+			networkReply(socket,"250 OK queued\r\n");
+		}
+		return;
+	}
+
+	std::string verb=line.substr(0,4);
+	for(size_t i=0;i<verb.size();i++)
+	{
+		verb[i]=toupper(verb[i]);
+	}
+	if (verb=="EHLO")
+	{
+		networkReply(socket,smtpPipelining ? "250-fake.example.com\r\n250-PIPELINING\r\n250 8BITMIME\r\n" : "250-fake.example.com\r\n250 8BITMIME\r\n");
+	}
+	else if (verb=="HELO")
+	{
+		networkReply(socket,"250 fake.example.com\r\n");
+	}
+	else if (verb=="MAIL" || verb=="NOOP")
+	{
+		networkReply(socket,"250 OK\r\n");
+	}
+	else if (verb=="RSET")
+	{
+		socket->smtpRecipients=0;
+		networkReply(socket,"250 OK\r\n");
+	}
+	else if (verb=="RCPT")
+	{
+		if (line.find("reject")!=std::string::npos)
+		{
+			networkReply(socket,"550 No such user\r\n");
+		}
+		else
+		{
+			socket->smtpRecipients++;
+			networkReply(socket,"250 OK\r\n");
+		}
+	}
+	else if (verb=="DATA")
+	{
+		if (socket->smtpRecipients==0)
+		{
+			networkReply(socket,"554 No valid recipients\r\n");
+		}
+		else
+		{
+			socket->smtpData=true;
+			networkReply(socket,"354 End data with <CR><LF>.<CR><LF>\r\n");
+		}
+	}
+	else if (verb=="QUIT")
+	{
+		networkReply(socket,"221 Bye\r\n");
+	}
+	else
+	{
+		networkReply(socket,"500 Command not recognised\r\n");
+	}
+}
@@ -0,0 +1,114 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef FakeModule_h
+#define FakeModule_h
+
+#include "host.h"
+#include <deque>
+#include <vector>
+
+#define FAKE_MAX_SOCKETS 8
+#define FAKE_ECHO_PORT 7
+#define FAKE_CHARGEN_PORT 19
+#define FAKE_SMTP_PORT 25
+
+/*
+ * A simulated TLN13UA06 module, which the library talks to as its Stream. It answers the same commands as the ModuleSimulator
+ * example, in simulated time: each response starts latencyMicros after the command has arrived, and bytes are passed at the baud rate
+ * in each direction, so timeouts, polling and pipelining behave as they would with a module.
+ *
+ * Sockets connected to FAKE_ECHO_PORT receive back what was sent to them, FAKE_CHARGEN_PORT always has data waiting, and
+ * FAKE_SMTP_PORT is a small SMTP server which supports PIPELINING. Data from the network arrives networkMicros after it was sent.
+ * In transparent mode, the data sent is echoed back.
+ *
+ * script() replaces the response to the next command which starts with a given text, to inject errors and timeouts.
+ * The calls the library makes, the bytes each way and the commands received are counted.
+ */
+class FakeModule : public Stream
+{
+  public:
+	FakeModule(unsigned long baud=115200);
+	void reset();// closes the sockets and clears the counters and scripts
+
+	virtual int available();
+	virtual int read();
+	virtual int peek();
+	virtual size_t write(uint8_t c);
+	virtual size_t write(const uint8_t *buffer,size_t size);
+	using Print::write;
+
+	// The response to the next command which starts with prefix. An empty response means no response at all, so the command times out
+	void script(const char *prefix,const char *response);
+
+	unsigned long latencyMicros;// from the end of a command to the start of its response
+	unsigned long networkMicros;// from data being sent on a socket to the reply arriving
+	boolean smtpPipelining;// the SMTP server offers PIPELINING in its EHLO reply
+
+	// Counters
+	unsigned long availableCalls;
+	unsigned long readCalls;
+	unsigned long writeCalls;
+	unsigned long bytesIn;// from the library
+	unsigned long bytesOut;// to the library
+	unsigned long commands;
+	unsigned int maxOutstanding;// most commands received before the responses to earlier ones had been read
+	unsigned long smtpConnections;
+	unsigned long smtpMessages;// messages the SMTP server accepted
+	std::vector<std::string> commandLog;
+
+  private:
+	struct Socket
+	{
+		boolean open;
+		unsigned int port;
+		std::deque<std::pair<unsigned long long,char> > rx;// data from the network, with the time it arrives at the module
+		unsigned long chargen;
+		std::string smtpLine;
+		boolean smtpData;// in the body of a message
+		int smtpRecipients;// accepted in the current transaction
+	};
+
+	void command(const std::string &text);
+	void respond(const std::string &text,const std::string &data="");
+	void socketData(int socketNum,char c);
+	void networkReply(Socket *socket,const std::string &text);
+	void smtpLine(Socket *socket,const std::string &line);
+	int socketParameter(const std::string &parameters);
+	void due();
+
+	unsigned long long _byteNanos;// time for one byte at the baud rate. Times here are in ns
+	std::deque<std::pair<unsigned long long,char> > _out;// bytes to the library, with the time each is available
+	size_t _due;// bytes at the front of _out which are available
+	unsigned long long _outEnd;// time the last byte of _out is available
+	unsigned long long _inEnd;// time the last byte from the library has arrived
+	std::deque<unsigned long> _responseEnds;// value of bytesOut at the end of each response not yet read
+	unsigned long _readTotal;
+	std::string _command;
+	boolean _transparent;
+	unsigned long long _lastByteTime;// when the last byte from the library arrived, for the +++ guard time
+	int _plusCount;
+	int _sendSocket;// socket the data of an AT+SKSND is for
+	long _sendRemaining;
+	Socket _sockets[FAKE_MAX_SOCKETS+2];// socket 1 is the auto-work socket, and AT+SKCT numbers them from 2
+	std::vector<std::pair<std::string,std::string> > _scripts;
+};
+
+#endif //FakeModule_h
@@ -0,0 +1,105 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "FakeModule.h"
+#include "UARTWifi.h"
+
+/*
+ * Counts the calls each blocking command makes to the Stream, and the bytes it sends, so the way commands are written can be
+ * compared between versions of the library, e.g. with the original version, which printed each field of a command separately
+ *   git archive 428d5b1 libraries/UARTWifi | tar -x -C /tmp/old
+ *   make LIB=/tmp/old/libraries/UARTWifi BUILD=build-old build-old/command_count
+ * The counts are for the command only; the data of socketSend() is sent with one write().
+ */
+FakeModule module;
+UARTWifi wifi(&module,8,9);
+
+struct Counts
+{
+	unsigned long writeCalls;
+	unsigned long bytesIn;
+	unsigned long availableCalls;
+	unsigned long readCalls;
+};
+
+Counts counts()
+{
+	Counts c = { module.writeCalls,module.bytesIn,module.availableCalls,module.readCalls };
+	return c;
+}
+
+void report(const char *name,const Counts &before,int status,int payload=0)
+{
+	printf("%-26s status %3d  %2lu write calls  %3lu bytes  %5lu available()  %3lu read()\n",name,status,
+		module.writeCalls-before.writeCalls-(payload ? 1 : 0),module.bytesIn-before.bytesIn-payload,
+		module.availableCalls-before.availableCalls,module.readCalls-before.readCalls);
+}
+
+int main()
+{
+	char protocol[]="0";
+	char clientOrServer[]="0";
+	char host[]="192.168.1.10";
+	char chargenPort[]="19";
+	char echoPort[]="7";
+	char buffer[128];
+	char data[65];// terminated, as the original socketSend() printed it as a string
+	int socketNum=0;
+	int status;
+	Counts before;
+
+	memset(data,'x',64);
+	data[64]=0;
+
+	before=counts();
+	status=wifi.socketCreate(protocol,clientOrServer,host,chargenPort,&socketNum);
+	report("socketCreate",before,status);
+	hostCheck(status==0,"socket created");
+
+	before=counts();
+	status=wifi.setDefaultSocket(socketNum);
+	report("setDefaultSocket",before,status);
+
+	before=counts();
+	status=wifi.socketReceive(buffer,64,socketNum);
+	report("socketReceive (64 bytes)",before,status);
+
+	before=counts();
+	status=wifi.socketGetConnectionState(buffer,socketNum);
+	report("socketGetConnectionState",before,status);
+
+	before=counts();
+	status=wifi.getNetworkStatus(buffer);
+	report("getNetworkStatus",before,status);
+
+	before=counts();
+	status=wifi.socketClose(socketNum);
+	report("socketClose",before,status);
+
+	// To the echo port, so the data has somewhere to go
+	wifi.socketCreate(protocol,clientOrServer,host,echoPort,&socketNum);
+	before=counts();
+	status=wifi.socketSend(data,64,socketNum);
+	boolean sent=module.bytesIn-before.bytesIn>64;
+	report("socketSend (64 bytes)",before,status,sent ? 64 : 0);
+	hostCheck(status==64 && sent,"data sent");
+
+	return hostFailures()!=0;
+}
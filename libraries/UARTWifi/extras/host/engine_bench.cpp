@@ -0,0 +1,153 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "FakeModule.h"
+#include "UARTWifi.h"
+
+/*
+ * Latency and throughput of the command engine, against FakeModule at 115200 baud with a 2ms response time.
+ * Times are simulated, so they are those of a board, apart from the time the library's own code takes.
+ *
+ * The blocking methods are timed one command at a time. The queued commands are run from a loop which does other work between
+ * the calls to poll(), and the longest time any poll() took shows whether the loop was held up.
+ */
+#define COMMANDS 200
+#define TRANSFERS 50
+#define TRANSFER_SIZE 512
+
+FakeModule module;
+UARTWifi wifi(&module,8,9);
+
+int completed;
+int failed;
+
+void commandComplete(int status,UARTWifiResponse *response,void *context)
+{
+	completed++;
+	if (status<0)
+	{
+		failed++;
+	}
+}
+
+double elapsedMs(unsigned long long start)
+{
+	return (hostMicros()-start)/1000.0;
+}
+
+void blockingLatency()
+{
+	unsigned long long start=hostMicros();
+	int ok=0;
+
+	for(int i=0;i<COMMANDS;i++)
+	{
+		ok+=wifi.sendAT();
+	}
+	printf("blocking sendAT          %d/%d ok, %.2f ms per command, %.1f commands/s\n",ok,COMMANDS,elapsedMs(start)/COMMANDS,COMMANDS*1000.0/elapsedMs(start));
+}
+
+void queuedLatency()
+{
+	unsigned long long start=hostMicros();
+	unsigned long long longestPoll=0;
+	unsigned long loopPasses=0;
+	int queued=0;
+
+	completed=failed=0;
+	while(completed<COMMANDS)
+	{
+		if (queued<COMMANDS && wifi.queueCommand("AT+\r",500,commandComplete)>0)
+		{
+			queued++;
+		}
+		unsigned long long before=hostMicros();
+		wifi.poll();
+		if (hostMicros()-before>longestPoll)
+		{
+			longestPoll=hostMicros()-before;
+		}
+		loopPasses++;
+		hostAdvance(100);// the rest of the sketch's loop()
+	}
+	double ms=elapsedMs(start);
+	printf("queued AT+               %d/%d ok, %.2f ms per command, %.1f commands/s, %lu loop passes (%.1f per ms), longest poll() %llu us\n",
+		COMMANDS-failed,COMMANDS,ms/COMMANDS,COMMANDS*1000.0/ms,loopPasses,loopPasses/ms,longestPoll);
+}
+
+void receiveThroughput()
+{
+	char buffer[TRANSFER_SIZE];
+	int socketNum;
+	long bytes=0;
+
+	if (wifi.socketCreate("0","0","192.168.1.10","19",&socketNum)!=0)
+	{
+		hostCheck(false,"chargen socket created");
+		return;
+	}
+	unsigned long long start=hostMicros();
+	for(int i=0;i<TRANSFERS;i++)
+	{
+		int received=wifi.socketReceive(buffer,sizeof(buffer),socketNum);
+		if (received>0)
+		{
+			bytes+=received;
+		}
+	}
+	double ms=elapsedMs(start);
+	printf("socketReceive %d bytes  %ld bytes in %.0f ms, %.0f bytes/s (the line carries %lu bytes/s)\n",TRANSFER_SIZE,bytes,ms,bytes*1000.0/ms,115200UL/10);
+	wifi.socketClose(socketNum);
+}
+
+void sendThroughput()
+{
+	char buffer[TRANSFER_SIZE];
+	int socketNum;
+	long bytes=0;
+
+	memset(buffer,'x',sizeof(buffer));
+	if (wifi.socketCreate("0","0","192.168.1.10","7",&socketNum)!=0)
+	{
+		hostCheck(false,"echo socket created");
+		return;
+	}
+	unsigned long long start=hostMicros();
+	for(int i=0;i<TRANSFERS;i++)
+	{
+		int sent=wifi.socketSend(buffer,sizeof(buffer),socketNum);
+		if (sent>0)
+		{
+			bytes+=sent;
+		}
+	}
+	double ms=elapsedMs(start);
+	printf("socketSend %d bytes     %ld bytes in %.0f ms, %.0f bytes/s\n",TRANSFER_SIZE,bytes,ms,bytes*1000.0/ms);
+	wifi.socketClose(socketNum);
+}
+
+int main()
+{
+	blockingLatency();
+	queuedLatency();
+	receiveThroughput();
+	sendThroughput();
+	return hostFailures()!=0;
+}
@@ -0,0 +1,224 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "host.h"
+#include "UARTWifi.h"
+
+/*
+ * Feeds megabytes of synthetic module output through the response framing used before UARTWifiFramer, and through the framer,
+ * and compares the time per byte on this PC. Both must find the same responses.
+ *
+ * oldWaitCommandComplete() and oldWaitDataPattern() are copies of the library's original methods, which compared the end of the
+ * buffer with the pattern after every byte. The only change is a check that strstr_P() found the pattern, as it searched from the
+ * wrong place, and writing through its null result, harmless on an AVR, crashes a PC.
+ */
+#define OUTPUT_BYTES (8L*1024*1024)
+#define BUFFER_SIZE 256
+
+// A Stream which returns a block of memory, so the PC's time goes on the framing rather than on a simulated serial port
+class MemoryStream : public Stream
+{
+  public:
+	MemoryStream(const std::string &data) : _data(data), _pos(0) {}
+	virtual int available() { return (int)(_data.size()-_pos); }
+	virtual int read() { return _pos<_data.size() ? (unsigned char)_data[_pos++] : -1; }
+	virtual int peek() { return _pos<_data.size() ? (unsigned char)_data[_pos] : -1; }
+	virtual size_t write(uint8_t c) { return 1; }
+	using Print::write;
+	void rewind() { _pos=0; }
+
+  private:
+	const std::string &_data;
+	size_t _pos;
+};
+
+int oldWaitCommandComplete(Stream *serial,char *responseBuf,int timeoutMillis)
+{
+long timeoutTime = millis()+timeoutMillis;
+int status=false;
+int bytesReceived=0;
+
+  while(millis()<(unsigned long)timeoutTime && status==false)
+  {
+    if (serial->available())
+    {
+      *responseBuf++ = serial->read();
+      if (++bytesReceived>4)
+      {
+        if (strncmp_P(responseBuf-4,PSTR("\r\n\r\n"),4)==0)
+        {
+		  char *p = strstr_P(responseBuf,PSTR("\r\n\r\n"));
+		  if (p)
+		  {
+		    *p=0;
+		  }
+          status=true;
+        }
+      }
+    }
+  }
+  return status;
+}
+
+int oldWaitDataPattern(Stream *serial,char *responseBuf,const char *pattern,int timeoutMillis)
+{
+long timeoutTime = millis()+timeoutMillis;
+int status=false;
+int bytesReceived=0;
+int patternLength = strlen(pattern);
+
+  while(millis()<(unsigned long)timeoutTime && status==false)
+  {
+    if (serial->available())
+    {
+      *responseBuf++ = serial->read();
+      if (++bytesReceived>patternLength)
+      {
+        if (strcmp(responseBuf-patternLength,pattern)==0)
+        {
+          status=true;
+        }
+      }
+    }
+  }
+  *responseBuf=0;
+  return status;
+}
+
+std::string makeResponses()
+{
+	static const char *responses[] =
+	{
+		"+OK\r\n\r\n",
+		"+OK=3\r\n\r\n",
+		"+ERR=-13\r\n\r\n",
+		"+OK=2,2,192.168.1.10,7,0\r\n\r\n",
+		"+OK=1,192.168.1.99,255.255.255.0,192.168.1.1,192.168.1.1\r\n\r\n",
+		"+OK=0,0,192.168.1.10,7\r\n\r\n"
+	};
+	std::string data;
+
+	for(int i=0;(long)data.size()<OUTPUT_BYTES;i++)
+	{
+		data+=responses[i%6];
+	}
+	return data;
+}
+
+// Lines of an HTTP reply, for the data pattern methods, which are used to wait for e.g. the end of the headers
+std::string makeLines()
+{
+	std::string data;
+
+	while((long)data.size()<OUTPUT_BYTES)
+	{
+		data+="HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: 1234\r\nConnection: keep-alive\r\n\r\n";
+	}
+	return data;
+}
+
+void report(const char *name,long bytes,int frames,double seconds)
+{
+	printf("%-34s %7d frames  %6.1f MB/s  %6.1f ns/byte\n",name,frames,bytes/seconds/1e6,seconds*1e9/bytes);
+}
+
+int main()
+{
+	std::string responses=makeResponses();
+	std::string lines=makeLines();
+	MemoryStream responseStream(responses);
+	MemoryStream lineStream(lines);
+	UARTWifi responseWifi(&responseStream,8,9);
+	UARTWifi lineWifi(&lineStream,8,9);
+	char buffer[BUFFER_SIZE];
+	int oldFrames=0,newFrames=0;
+	double start;
+
+	printf("%ld bytes of responses, %ld bytes of header lines\n",(long)responses.size(),(long)lines.size());
+
+	start=hostSeconds();
+	memset(buffer,0,sizeof(buffer));
+	while(responseStream.available() && oldWaitCommandComplete(&responseStream,buffer,10000))
+	{
+		oldFrames++;
+	}
+	report("old waitCommandComplete",responses.size(),oldFrames,hostSeconds()-start);
+
+	responseStream.rewind();
+	start=hostSeconds();
+	while(responseStream.available() && responseWifi.waitCommandComplete(buffer,10000,sizeof(buffer)))
+	{
+		newFrames++;
+	}
+	report("new waitCommandComplete",responses.size(),newFrames,hostSeconds()-start);
+	hostCheck(oldFrames==newFrames,"old and new waitCommandComplete found the same responses");
+
+	UARTWifiFramer framer("\r\n\r\n");
+	int frames=0;
+	framer.begin(buffer,sizeof(buffer));
+	start=hostSeconds();
+	for(size_t i=0;i<responses.size();i++)
+	{
+		if (framer.push(responses[i]))
+		{
+			frames++;
+			framer.reset();
+		}
+	}
+	report("UARTWifiFramer::push() alone",responses.size(),frames,hostSeconds()-start);
+	hostCheck(frames==newFrames,"UARTWifiFramer found the same responses");
+
+	oldFrames=newFrames=0;
+	start=hostSeconds();
+	while(lineStream.available())
+	{
+		memset(buffer,0,sizeof(buffer));// the old method relied on the buffer being zeroed after the data
+		if (!oldWaitDataPattern(&lineStream,buffer,"\r\n\r\n",10000))
+		{
+			break;
+		}
+		oldFrames++;
+	}
+	report("old waitDataPattern",lines.size(),oldFrames,hostSeconds()-start);
+
+	lineStream.rewind();
+	start=hostSeconds();
+	while(lineStream.available())
+	{
+		memset(buffer,0,sizeof(buffer));// the same work as for the old method
+		if (!lineWifi.waitDataPattern(buffer,(char *)"\r\n\r\n",10000,sizeof(buffer)))
+		{
+			break;
+		}
+		newFrames++;
+	}
+	report("new waitDataPattern",lines.size(),newFrames,hostSeconds()-start);
+	hostCheck(oldFrames==newFrames,"old and new waitDataPattern found the same replies");
+
+	// The 16 byte buffer socketCreate() used to pass, with a response which doesn't fit. Nothing after the buffer may change
+	std::string longResponse="+OK=1,192.168.1.99,255.255.255.0,192.168.1.1,192.168.1.1\r\n\r\n";
+	MemoryStream longStream(longResponse);
+	UARTWifi longWifi(&longStream,8,9);
+	char guarded[16+16];
+	memset(guarded,'#',sizeof(guarded));
+	hostCheck(longWifi.waitCommandComplete(guarded,1000,16) && strlen(guarded)==15 && guarded[16]=='#' && guarded[31]=='#',
+		"a response longer than the buffer is cut short without overflowing it");
+	return hostFailures()!=0;
+}
@@ -0,0 +1,354 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "host.h"
+#include <time.h>
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+unsigned long hostTimeStep=1;
+static unsigned long long simulatedMicros;
+static boolean realTime;
+static unsigned long long realStart;
+
+uint8_t hostPins[NUM_DIGITAL_PINS];
+int hostAnalog[6];
+void (*hostInterruptsOff)();
+void (*hostInterruptsOn)();
+static int failures;
+
+static unsigned long long realMicros()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (unsigned long long)ts.tv_sec*1000000ULL+ts.tv_nsec/1000;
+}
+
+unsigned long long hostMicros()
+{
+	return realTime ? realMicros()-realStart : simulatedMicros;
+}
+
+void hostAdvance(unsigned long long us)
+{
+	simulatedMicros+=us;
+}
+
+void hostRealTime(boolean real)
+{
+	realTime=real;
+	realStart=realMicros()-simulatedMicros;
+}
+
+double hostSeconds()
+{
+	return realMicros()/1e6;
+}
+
+boolean hostCheck(boolean ok,const char *what)
+{
+	printf("%s %s\n",ok ? "ok  " : "FAIL",what);
+	if (!ok)
+	{
+		failures++;
+	}
+	return ok;
+}
+
+int hostFailures()
+{
+	return failures;
+}
+
+unsigned long micros()
+{
+	if (realTime)
+	{
+		return (unsigned long)hostMicros();
+	}
+	simulatedMicros+=hostTimeStep;
+	return (unsigned long)simulatedMicros;
+}
+
+unsigned long millis()
+{
+	return (unsigned long)(micros()/1000);
+}
+
+void delay(unsigned long ms)
+{
+	if (realTime)
+	{
+		struct timespec ts={(time_t)(ms/1000),(long)(ms%1000)*1000000L};
+		nanosleep(&ts,0);
+		return;
+	}
+	simulatedMicros+=ms*1000ULL;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	if (!realTime)
+	{
+		simulatedMicros+=us;
+	}
+}
+
+void pinMode(uint8_t pin,uint8_t mode)
+{
+	if (mode==INPUT_PULLUP && pin<NUM_DIGITAL_PINS)
+	{
+		hostPins[pin]=HIGH;
+	}
+}
+
+void digitalWrite(uint8_t pin,uint8_t value)
+{
+	if (pin<NUM_DIGITAL_PINS)
+	{
+		hostPins[pin]=value;
+	}
+}
+
+int digitalRead(uint8_t pin)
+{
+	return pin<NUM_DIGITAL_PINS ? hostPins[pin] : LOW;
+}
+
+int analogRead(uint8_t pin)
+{
+	if (pin>=A0)
+	{
+		pin-=A0;
+	}
+	return pin<6 ? hostAnalog[pin] : 0;
+}
+
+void analogWrite(uint8_t pin,int value)
+{
+}
+
+void attachInterrupt(uint8_t interruptNum,void (*handler)(),int mode)
+{
+}
+
+void detachInterrupt(uint8_t interruptNum)
+{
+}
+
+void noInterrupts()
+{
+	if (hostInterruptsOff)
+	{
+		hostInterruptsOff();
+	}
+}
+
+void interrupts()
+{
+	if (hostInterruptsOn)
+	{
+		hostInterruptsOn();
+	}
+}
+
+// The same generator as avr-libc's random(), so a sketch picks the same numbers as it would on a board
+static unsigned long randomState=1;
+
+long random(long howBig)
+{
+	long hi,lo,x;
+
+	if (howBig==0)
+	{
+		return 0;
+	}
+	x=(long)(randomState%0x7ffffffeUL)+1;
+	hi=x/127773;
+	lo=x%127773;
+	x=16807*lo-2836*hi;
+	if (x<0)
+	{
+		x+=0x7fffffff;
+	}
+	randomState=x-1;
+	return (x-1)%howBig;
+}
+
+long random(long howSmall,long howBig)
+{
+	return howSmall>=howBig ? howSmall : random(howBig-howSmall)+howSmall;
+}
+
+void randomSeed(unsigned long seed)
+{
+	if (seed)
+	{
+		randomState=seed;
+	}
+}
+
+static char *convert(unsigned long value,char *s,int radix,boolean negative)
+{
+	char digits[sizeof(long)*8+1];
+	int n=0;
+	char *p=s;
+
+	do
+	{
+		digits[n++]="0123456789abcdefghijklmnopqrstuvwxyz"[value%radix];
+		value/=radix;
+	} while(value);
+	if (negative)
+	{
+		*p++='-';
+	}
+	while(n)
+	{
+		*p++=digits[--n];
+	}
+	*p=0;
+	return s;
+}
+
+char *ltoa(long value,char *s,int radix)
+{
+	return (value<0 && radix==10) ? convert(-(unsigned long)value,s,radix,true) : convert((unsigned long)value,s,radix,false);
+}
+
+char *itoa(int value,char *s,int radix)
+{
+	return (value<0 && radix==10) ? convert(-(unsigned long)value,s,radix,true) : convert((unsigned int)value,s,radix,false);
+}
+
+char *utoa(unsigned int value,char *s,int radix)
+{
+	return convert(value,s,radix,false);
+}
+
+char *ultoa(unsigned long value,char *s,int radix)
+{
+	return convert(value,s,radix,false);
+}
+
+size_t Print::write(const uint8_t *buffer,size_t size)
+{
+	size_t n=0;
+
+	while(size--)
+	{
+		n+=write(*buffer++);
+	}
+	return n;
+}
+
+size_t Print::print(const __FlashStringHelper *str)
+{
+	const char *p=(const char *)str;
+	size_t n=0;
+
+	while(*p)
+	{
+		n+=write((uint8_t)*p++);
+	}
+	return n;
+}
+
+size_t Print::print(long value,int base)
+{
+	char text[sizeof(long)*8+2];
+
+	return write(ltoa(value,text,base));
+}
+
+size_t Print::print(unsigned long value,int base)
+{
+	char text[sizeof(long)*8+1];
+
+	return write(ultoa(value,text,base));
+}
+
+size_t Print::print(double value,int digits)
+{
+	char text[64];
+
+	snprintf(text,sizeof(text),"%.*f",digits,value);
+	return write(text);
+}
+
+size_t Stream::readBytes(char *buffer,size_t length)
+{
+	size_t n=0;
+
+	while(n<length && available())
+	{
+		buffer[n++]=read();
+	}
+	return n;
+}
+
+HardwareSerial::HardwareSerial()
+{
+	inputPos=0;
+	availableCalls=readCalls=writeCalls=0;
+}
+
+int HardwareSerial::available()
+{
+	availableCalls++;
+	return (int)(input.size()-inputPos);
+}
+
+int HardwareSerial::read()
+{
+	readCalls++;
+	if (inputPos>=input.size())
+	{
+		return -1;
+	}
+	int c=(unsigned char)input[inputPos++];
+	if (inputPos==input.size())
+	{
+		input.clear();
+		inputPos=0;
+	}
+	return c;
+}
+
+int HardwareSerial::peek()
+{
+	return inputPos<input.size() ? (unsigned char)input[inputPos] : -1;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	writeCalls++;
+	output+=(char)c;
+	return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer,size_t size)
+{
+	writeCalls++;
+	output.append((const char *)buffer,size);
+	return size;
+}
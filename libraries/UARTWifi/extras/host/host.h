@@ -0,0 +1,54 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef host_h
+#define host_h
+
+#include "Arduino.h"
+
+/*
+ * Control of the simulated board, for the test programs.
+ *
+ * Time is simulated. It only moves on when delay() is called, or by hostTimeStep microseconds each time millis() or micros() is read
+ * (or a FakeModule has nothing available), so that code which waits by reading millis() in a loop still gets to the end of the wait. Benchmarks which measure simulated time
+ * therefore measure the waits in the code, and the time given to the simulated module, rather than the speed of the PC.
+ * hostRealTime() switches to the PC's clock, for tests with real serial ports or threads.
+ */
+extern unsigned long hostTimeStep;
+unsigned long long hostMicros();// simulated time, which doesn't move on when read
+void hostAdvance(unsigned long long us);
+void hostRealTime(boolean real);
+
+// Pins. digitalRead() returns hostPins[pin], and analogRead() hostAnalog[pin-A0]
+extern uint8_t hostPins[NUM_DIGITAL_PINS];
+extern int hostAnalog[6];
+
+// noInterrupts() and interrupts() call these, if set, so a test with a thread as the interrupt can use a mutex
+extern void (*hostInterruptsOff)();
+extern void (*hostInterruptsOn)();
+
+// Wall clock time in seconds, for measuring the speed of code which doesn't wait
+double hostSeconds();
+
+// Prints the result of a check, and counts the failures. Returns ok
+boolean hostCheck(boolean ok,const char *what);
+int hostFailures();
+
+#endif //host_h
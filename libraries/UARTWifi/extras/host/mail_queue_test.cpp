@@ -0,0 +1,270 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "FakeModule.h"
+#include "UARTWifiMailQueue.h"
+#include <set>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+ * UARTWifiMailQueue with its storage in a file, in place of EEPROM, sending to FakeModule's SMTP server.
+ *
+ * The drain rate is the messages per second poll() sends from a full queue, in simulated time, and the bytes written to storage
+ * per message show the EEPROM wear, and the time an enqueue() takes on an AVR at 3.3ms per EEPROM byte.
+ *
+ * Crash recovery is tested by running the queue in a child process which is killed part way through a write to storage, after
+ * every possible number of bytes. The child logs each message enqueue() accepted and each message the callback said was sent.
+ * The parent then recovers the queue from the file with begin(), sends what is left, and checks that no accepted message was lost
+ * and that nothing was sent which hadn't been accepted.
+ */
+#define MESSAGES 6
+#define CRASH_EXIT 3
+
+FakeModule module;
+UARTWifi wifi(&module,8,9);
+char server[]="192.168.1.10";
+char domain[]="example.com";
+char to[]="someone@example.com";
+char from[]="logger@example.com";
+char name[]="Someone";
+char subject[]="Alert";
+
+FILE *store;
+long writeBudget=-1;// bytes which can be written before the simulated crash, or -1
+unsigned long bytesWritten;
+unsigned long writeCalls;
+FILE *ackLog;
+std::set<unsigned int> delivered;
+
+void readFile(int address,char *data,int length,void *context)
+{
+	memset(data,0xFF,length);// erased
+	fseek(store,address,SEEK_SET);
+	size_t n=fread(data,1,length,store);
+	(void)n;
+}
+
+void writeFile(int address,const char *data,int length,void *context)
+{
+	writeCalls++;
+	fseek(store,address,SEEK_SET);
+	if (writeBudget>=0 && length>writeBudget)
+	{
+		// The power fails part way through the write
+		fwrite(data,1,writeBudget,store);
+		fflush(store);
+		_exit(CRASH_EXIT);
+	}
+	fwrite(data,1,length,store);
+	fflush(store);
+	bytesWritten+=length;
+	if (writeBudget>=0)
+	{
+		writeBudget-=length;
+	}
+}
+
+void mailSent(unsigned int id,int status,void *context)
+{
+	if (ackLog)
+	{
+		fprintf(ackLog,"S %u\n",id);
+		fflush(ackLog);
+	}
+	delivered.insert(id);
+}
+
+// A new queue on the file, as after a reset
+int recover(UARTWifiSmtpSession *session,UARTWifiMailQueue **queue)
+{
+	*queue=new UARTWifiMailQueue(session,readFile,writeFile);
+	(*queue)->setCallback(mailSent);
+	(*queue)->setRetry(100,1000,UARTWIFI_MAIL_MAX_ATTEMPTS);
+	return (*queue)->begin();
+}
+
+void drain(UARTWifiMailQueue *queue)
+{
+	unsigned long start=millis();
+
+	while(queue->count() && millis()-start<60000)
+	{
+		queue->poll();
+		hostAdvance(10000);
+	}
+}
+
+void drainRate()
+{
+	UARTWifiSmtpSession session(&wifi,server,domain);
+	UARTWifiMailQueue *queue;
+	char message[32];
+
+	store=tmpfile();
+	recover(&session,&queue);
+	bytesWritten=writeCalls=0;
+	for(int i=0;i<UARTWIFI_MAIL_QUEUE_SLOTS;i++)
+	{
+		sprintf(message,"Reading %d is high",i);
+		queue->enqueue(to,from,name,subject,message);
+	}
+	double enqueueBytes=(double)bytesWritten/UARTWIFI_MAIL_QUEUE_SLOTS;
+	double enqueueCalls=(double)writeCalls/UARTWIFI_MAIL_QUEUE_SLOTS;
+	hostCheck(queue->count()==UARTWIFI_MAIL_QUEUE_SLOTS,"queue filled");
+	hostCheck(queue->enqueue(to,from,name,subject,subject)==UARTWIFI_MAIL_QUEUE_FULL,"a full queue refuses a message");
+
+	module.reset();
+	delivered.clear();
+	bytesWritten=0;
+	unsigned long long start=hostMicros();
+	drain(queue);
+	double seconds=(hostMicros()-start)/1e6;
+	printf("  enqueue() writes %.1f bytes in %.1f calls, %.0f ms with EEPROM. Draining %d messages took %.1f s, %.2f messages/s,"
+		" %lu connection(s), %.1f bytes written per message sent\n",enqueueBytes,enqueueCalls,enqueueBytes*3.3,UARTWIFI_MAIL_QUEUE_SLOTS,
+		seconds,UARTWIFI_MAIL_QUEUE_SLOTS/seconds,module.smtpConnections,(double)bytesWritten/UARTWIFI_MAIL_QUEUE_SLOTS);
+	hostCheck(delivered.size()==UARTWIFI_MAIL_QUEUE_SLOTS && module.smtpMessages==UARTWIFI_MAIL_QUEUE_SLOTS,"every message was sent");
+	delete queue;
+	fclose(store);
+}
+
+// The child: enqueues MESSAGES messages, sending them as it goes, until it crashes after budget bytes have been written
+void runUntilCrash(long budget,const char *storeName,const char *ackName)
+{
+	UARTWifiSmtpSession session(&wifi,server,domain);
+	UARTWifiMailQueue *queue;
+	char message[32];
+
+	store=fopen(storeName,"r+b");
+	ackLog=fopen(ackName,"w");
+	writeBudget=budget;
+	recover(&session,&queue);
+	for(int i=0;i<MESSAGES;i++)
+	{
+		sprintf(message,"Reading %d is high",i);
+		long id=queue->enqueue(to,from,name,subject,message);
+		if (id>=0)
+		{
+			fprintf(ackLog,"E %ld\n",id);
+			fflush(ackLog);
+		}
+		if (i%2)
+		{
+			queue->poll();// send one of them, so the crash can come while a slot is being freed
+		}
+	}
+	drain(queue);
+	_exit(0);
+}
+
+// Returns the number of writes the child got through before the crash, or -1 if the recovered queue lost or invented a message
+int crashAt(long budget,boolean *finished)
+{
+	char storeName[]="/tmp/mailqueueXXXXXX";
+	char ackName[]="/tmp/mailackXXXXXX";
+	close(mkstemp(storeName));
+	close(mkstemp(ackName));
+
+	fflush(stdout);
+	pid_t pid=fork();
+	if (pid==0)
+	{
+		runUntilCrash(budget,storeName,ackName);
+	}
+	int status;
+	waitpid(pid,&status,0);
+	*finished=WIFEXITED(status) && WEXITSTATUS(status)==0;
+
+	std::set<unsigned int> accepted,sent;
+	FILE *log=fopen(ackName,"r");
+	char kind;
+	unsigned int id;
+	while(fscanf(log," %c %u",&kind,&id)==2)
+	{
+		(kind=='E' ? accepted : sent).insert(id);
+	}
+	fclose(log);
+
+	UARTWifiSmtpSession session(&wifi,server,domain);
+	UARTWifiMailQueue *queue;
+	store=fopen(storeName,"r+b");
+	writeBudget=-1;
+	ackLog=0;
+	delivered.clear();
+	module.reset();
+	recover(&session,&queue);
+	drain(queue);
+	delete queue;
+	fclose(store);
+	unlink(storeName);
+	unlink(ackName);
+
+	boolean ok=true;
+	for(std::set<unsigned int>::iterator i=accepted.begin();i!=accepted.end();i++)
+	{
+		if (!sent.count(*i) && !delivered.count(*i))
+		{
+			printf("  crash after %ld bytes: message %u was accepted but never sent\n",budget,*i);
+			ok=false;
+		}
+	}
+	for(std::set<unsigned int>::iterator i=delivered.begin();i!=delivered.end();i++)
+	{
+		// A message being enqueued when the crash came wasn't acknowledged, but may be sent. It must be the next id
+		if (!accepted.count(*i) && *i!=accepted.size())
+		{
+			printf("  crash after %ld bytes: message %u was sent but never accepted\n",budget,*i);
+			ok=false;
+		}
+	}
+	return ok ? (int)delivered.size() : -1;
+}
+
+void crashRecovery()
+{
+	int crashes=0,failures=0,resent=0;
+	boolean finished=false;
+
+	for(long budget=0;!finished;budget++)
+	{
+		int recovered=crashAt(budget,&finished);
+		if (recovered<0)
+		{
+			failures++;
+		}
+		else if (!finished)
+		{
+			crashes++;
+			resent+=recovered;
+		}
+	}
+	printf("  %d crashes, one after each byte written, %d messages sent after recovery\n",crashes,resent);
+	hostCheck(crashes>0 && failures==0,"no accepted message was lost or corrupted by a crash");
+}
+
+int main()
+{
+	printf("drain rate\n");
+	drainRate();
+	printf("crash recovery\n");
+	crashRecovery();
+	return hostFailures()!=0;
+}
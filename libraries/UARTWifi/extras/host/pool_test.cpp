@@ -0,0 +1,232 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "FakeModule.h"
+#include "UARTWifiSocketPool.h"
+
+/*
+ * Tests UARTWifiSocketPool against FakeModule, with commands for several sockets in flight at once.
+ * Each echo socket is sent its own text, and must receive back only that text, whatever order the responses come in.
+ * A send which times out is scripted, to check the slot fails and isn't reused until it has been closed.
+ * Then the aggregate receive throughput of several chargen sockets is compared with the pipeline depth set to 1.
+ */
+#define SLOTS 3
+#define RING_SIZE 128
+#define ROUNDS 20
+#define THROUGHPUT_SECONDS 10
+
+FakeModule module;
+UARTWifi wifi(&module,8,9);
+
+int events[5];
+int lastSlot;
+int lastStatus;
+
+void socketEvent(int slot,unsigned char event,int status,void *context)
+{
+	events[event]++;
+	lastSlot=slot;
+	lastStatus=status;
+}
+
+UARTWifiSocketPool pool(&wifi,socketEvent);
+
+// Calls poll() until nothing is pending on any slot, or the simulated timeout
+boolean settle(unsigned long timeoutMillis)
+{
+	unsigned long start=millis();
+
+	while(millis()-start<timeoutMillis)
+	{
+		int pending=0;
+		for(int i=0;i<UARTWIFI_MAX_SOCKETS;i++)
+		{
+			pending+=pool.pending(i);
+		}
+		if (!pending)
+		{
+			return true;
+		}
+		pool.poll();
+		hostAdvance(100);
+	}
+	return false;
+}
+
+void interleaving()
+{
+	int slots[SLOTS];
+	char text[SLOTS][16];
+	char storage[SLOTS][RING_SIZE];
+	UARTWifiRingBuffer *rings[SLOTS];
+	std::string received[SLOTS];
+
+	pool.begin();
+	for(int i=0;i<SLOTS;i++)
+	{
+		slots[i]=pool.open("0","0","192.168.1.10","7");
+		hostCheck(slots[i]>=0,"echo slot opened");
+		sprintf(text[i],"<slot %d data>",i);
+		rings[i]=new UARTWifiRingBuffer(storage[i],RING_SIZE);
+		pool.poll();
+	}
+	hostCheck(settle(5000),"sockets connected");
+	for(int i=0;i<SLOTS;i++)
+	{
+		hostCheck(pool.state(slots[i])==UARTWIFI_SOCKET_CONNECTED,"slot connected");
+	}
+
+	for(int round=0;round<ROUNDS;round++)
+	{
+		// A send on one socket and a receive on the next, so an AT+SKSND and an AT+SKRCV for different sockets are in flight together
+		for(int i=0;i<SLOTS;i++)
+		{
+			while(pool.send(slots[i],text[i],strlen(text[i]))<0)
+			{
+				pool.poll();
+				hostAdvance(100);
+			}
+			while(pool.receive(slots[(i+1)%SLOTS],rings[(i+1)%SLOTS])<0)
+			{
+				pool.poll();
+				hostAdvance(100);
+			}
+		}
+		settle(5000);
+		hostAdvance(module.networkMicros/1000);
+		for(int i=0;i<SLOTS;i++)
+		{
+			while(rings[i]->available())
+			{
+				received[i]+=(char)rings[i]->read();
+			}
+		}
+	}
+	// The echo of the last round
+	for(int i=0;i<SLOTS;i++)
+	{
+		pool.receive(slots[i],rings[i]);
+		settle(5000);
+		while(rings[i]->available())
+		{
+			received[i]+=(char)rings[i]->read();
+		}
+	}
+
+	hostCheck(module.maxOutstanding>1,"commands for different sockets were in flight together");
+	printf("  %lu commands, up to %u in flight, %d sent and %d received events\n",module.commands,module.maxOutstanding,
+		events[UARTWIFI_EVENT_SENT],events[UARTWIFI_EVENT_RECEIVED]);
+	for(int i=0;i<SLOTS;i++)
+	{
+		std::string expected;
+		for(int round=0;round<ROUNDS;round++)
+		{
+			expected+=text[i];
+		}
+		hostCheck(received[i]==expected,"each socket received only its own data, in order");
+		hostCheck(pool.slotInfo(slots[i])->bytesSent==expected.size() && pool.slotInfo(slots[i])->bytesReceived==expected.size(),
+			"the slot counted its bytes");
+	}
+
+	// A send which gets no response fails the slot, but its socket is still open in the module
+	char socketText[24];
+	sprintf(socketText,"AT+SKSND=%d",pool.socketNumber(slots[0]));
+	module.script(socketText,"");
+	events[UARTWIFI_EVENT_ERROR]=0;
+	pool.send(slots[0],text[0],strlen(text[0]));
+	settle(10000);
+	hostCheck(events[UARTWIFI_EVENT_ERROR]==1 && lastSlot==slots[0] && lastStatus==UARTWIFI_TIMEOUT,"the send timed out");
+	hostCheck(pool.state(slots[0])==UARTWIFI_SOCKET_FAILED && pool.socketNumber(slots[0])>=0,"the slot failed with its socket open");
+
+	int other=pool.open("0","0","192.168.1.10","7");
+	hostCheck(other>=0 && other!=slots[0],"open() didn't reuse the failed slot");
+	settle(5000);
+	hostCheck(pool.close(slots[0])>0 && settle(5000) && pool.state(slots[0])==UARTWIFI_SOCKET_FREE,"the failed slot was closed");
+	int reused=pool.open("0","0","192.168.1.10","7");
+	hostCheck(reused==slots[0],"the closed slot is reused");
+	settle(5000);
+
+	for(int i=0;i<UARTWIFI_MAX_SOCKETS;i++)
+	{
+		if (pool.state(i)==UARTWIFI_SOCKET_CONNECTED)
+		{
+			pool.close(i);
+			settle(5000);
+		}
+	}
+	for(int i=0;i<SLOTS;i++)
+	{
+		delete rings[i];
+	}
+}
+
+// Bytes/s received from SLOTS chargen sockets at once, keeping a receive queued on every socket
+double throughput(unsigned char depth)
+{
+	int slots[SLOTS];
+	char storage[SLOTS][RING_SIZE];
+	UARTWifiRingBuffer *rings[SLOTS];
+	unsigned long bytes=0;
+
+	wifi.setPipelineDepth(depth);
+	for(int i=0;i<SLOTS;i++)
+	{
+		slots[i]=pool.open("0","0","192.168.1.10","19");
+		rings[i]=new UARTWifiRingBuffer(storage[i],RING_SIZE);
+		settle(5000);
+	}
+	unsigned long long start=hostMicros();
+	while(hostMicros()-start<THROUGHPUT_SECONDS*1000000ULL)
+	{
+		for(int i=0;i<SLOTS;i++)
+		{
+			if (!pool.pending(slots[i]))
+			{
+				bytes+=rings[i]->available();
+				rings[i]->clear();
+				pool.receive(slots[i],rings[i]);
+			}
+		}
+		pool.poll();
+		hostAdvance(100);
+	}
+	settle(5000);
+	for(int i=0;i<SLOTS;i++)
+	{
+		bytes+=rings[i]->available();
+		pool.close(slots[i]);
+		settle(5000);
+		delete rings[i];
+	}
+	return bytes/(double)THROUGHPUT_SECONDS;
+}
+
+int main()
+{
+	printf("interleaved echo sockets\n");
+	interleaving();
+
+	double pipelined=throughput(UARTWIFI_COMMAND_QUEUE_SIZE);
+	double sequential=throughput(1);
+	printf("  %d chargen sockets: %.0f bytes/s with up to %d commands in flight, %.0f bytes/s one at a time (x%.2f)\n",
+		SLOTS,pipelined,UARTWIFI_COMMAND_QUEUE_SIZE,sequential,pipelined/sequential);
+	hostCheck(pipelined>sequential,"pipelining raised the aggregate throughput");
+	return hostFailures()!=0;
+}
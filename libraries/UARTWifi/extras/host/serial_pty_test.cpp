@@ -0,0 +1,161 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "host.h"
+#include "UARTWifiBufferedSerial.h"
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+/*
+ * Bytes lost at high baud rates, with and without UARTWifiBufferedSerial, with the data passing through a Linux pty.
+ *
+ * A known sequence is written into one end of the pty at the baud rate. PtySerial is the board's serial port: its receive interrupt
+ * reads the other end into a 64 byte buffer, as HardwareSerial does, and drops bytes when it is full. The main loop reads what has
+ * arrived, then does 10ms of other work, which is longer than the 64 bytes last at 115200 baud. With UARTWifiBufferedSerial, the
+ * timer interrupt calls serviceFromInterrupt() every 1ms.
+ *
+ * The interrupts are run each simulated millisecond rather than from threads, as a PC's scheduler can hold a thread up for several
+ * milliseconds (10ms was seen), which no AVR timer interrupt would, and the result would then depend on the load on the PC.
+ */
+#define SERIAL_BUFFER_SIZE 64
+#define RX_SIZE 1024
+#define RUN_MILLIS 2000
+#define BUSY_MILLIS 10
+
+// The board's serial port, with its 64 byte receive buffer filled from one end of a pty
+class PtySerial : public Stream
+{
+  public:
+	PtySerial(int fd) : lost(0), _fd(fd), _head(0), _tail(0) {}
+
+	virtual int available() { return _head-_tail; }
+	virtual int read() { return _head==_tail ? -1 : (unsigned char)_buffer[_tail++%SERIAL_BUFFER_SIZE]; }
+	virtual int peek() { return _head==_tail ? -1 : (unsigned char)_buffer[_tail%SERIAL_BUFFER_SIZE]; }
+	virtual size_t write(uint8_t c) { return ::write(_fd,&c,1)==1; }
+	using Print::write;
+
+	// The receive interrupt, for the bytes which have arrived
+	void receiveInterrupt()
+	{
+		char c;
+
+		while(::read(_fd,&c,1)==1)
+		{
+			if (_head-_tail<SERIAL_BUFFER_SIZE)
+			{
+				_buffer[_head++%SERIAL_BUFFER_SIZE]=c;
+			}
+			else
+			{
+				lost++;
+			}
+		}
+	}
+
+	unsigned long lost;
+
+  private:
+	int _fd;
+	char _buffer[SERIAL_BUFFER_SIZE];
+	unsigned int _head;
+	unsigned int _tail;
+};
+
+void measure(unsigned long baud,boolean buffer)
+{
+	int masterFd=posix_openpt(O_RDWR|O_NOCTTY);
+	grantpt(masterFd);
+	unlockpt(masterFd);
+	int slaveFd=open(ptsname(masterFd),O_RDWR|O_NOCTTY|O_NONBLOCK);
+	struct termios tio;
+	tcgetattr(slaveFd,&tio);
+	cfmakeraw(&tio);
+	tcsetattr(slaveFd,TCSANOW,&tio);
+
+	static char rxStorage[RX_SIZE];
+	PtySerial serial(slaveFd);
+	UARTWifiBufferedSerial buffered(&serial,rxStorage,sizeof(rxStorage));
+	Stream *stream = buffer ? (Stream *)&buffered : (Stream *)&serial;
+	unsigned long sent=0,received=0,outOfOrder=0;
+	double owed=0;
+	char chunk[256];
+
+	for(int ms=0;ms<RUN_MILLIS;ms++)
+	{
+		// A millisecond's worth of bytes arrives, one interrupt per byte
+		owed+=baud/10/1000.0;
+		int n=(int)owed;
+		owed-=n;
+		for(int i=0;i<n;i++)
+		{
+			chunk[i]=(char)((sent+i)%251);
+		}
+		if (::write(masterFd,chunk,n)==n)
+		{
+			sent+=n;
+		}
+		tcdrain(masterFd);
+		serial.receiveInterrupt();
+		if (buffer)
+		{
+			buffered.serviceFromInterrupt();
+		}
+
+		if (ms%BUSY_MILLIS==0)
+		{
+			while(stream->available())
+			{
+				if (stream->read()!=(int)(received%251))
+				{
+					outOfOrder++;
+				}
+				received++;
+			}
+		}
+	}
+	close(masterFd);
+	close(slaveFd);
+
+	printf("%6lu baud %-22s sent %6lu  received %6lu  lost %5lu (%4.1f%%)",baud,buffer ? "UARTWifiBufferedSerial" : "serial port only",
+		sent,received,serial.lost,serial.lost*100.0/sent);
+	if (buffer)
+	{
+		printf("  ring high water %u/%d, serial high water %u/%d",buffered.rxHighWater(),RX_SIZE,buffered.serialHighWater(),SERIAL_BUFFER_SIZE);
+		printf("\n");
+		hostCheck(serial.lost==0 && outOfOrder==0 && buffered.rxFullCount()==0,"no bytes lost with UARTWifiBufferedSerial");
+	}
+	else
+	{
+		printf("\n");
+	}
+}
+
+int main()
+{
+	static const unsigned long bauds[] = { 57600, 115200, 230400, 460800 };
+
+	for(unsigned int i=0;i<sizeof(bauds)/sizeof(bauds[0]);i++)
+	{
+		measure(bauds[i],false);
+		measure(bauds[i],true);
+	}
+	return hostFailures()!=0;
+}
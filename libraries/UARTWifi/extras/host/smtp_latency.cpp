@@ -0,0 +1,61 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "FakeModule.h"
+#include "UARTWifi.h"
+
+/*
+ * End to end time of sendEmail() against FakeModule's SMTP server, from creating the socket to closing it, in simulated time.
+ * Only sendEmail() is used, so this also builds against versions of the library from before its receive polling changed, e.g.
+ *   git archive 12396db libraries/UARTWifi | tar -x -C /tmp/old
+ *   make LIB=/tmp/old/libraries/UARTWifi BUILD=build-old build-old/smtp_latency
+ */
+#define TRANSACTIONS 10
+
+int main()
+{
+	static const unsigned long networkMillis[] = { 5, 20, 100 };
+	FakeModule module;
+	UARTWifi wifi(&module,8,9);
+	char to[]="someone@example.com";
+	char from[]="logger@example.com";
+	char name[]="Someone";
+	char subject[]="Test";
+	char message[]="A test message";
+	char domain[]="example.com";
+	char server[]="192.168.1.10";
+
+	for(unsigned int n=0;n<sizeof(networkMillis)/sizeof(networkMillis[0]);n++)
+	{
+		module.reset();
+		module.networkMicros=networkMillis[n]*1000;
+		unsigned long long start=hostMicros();
+		int ok=0;
+		for(int i=0;i<TRANSACTIONS;i++)
+		{
+			ok+=(wifi.sendEmail(to,from,name,subject,message,domain,server)==0);
+		}
+		double ms=(hostMicros()-start)/1000.0/TRANSACTIONS;
+		printf("server reply time %3lu ms  %d/%d sent, %.0f ms per transaction, %.1f module commands per transaction\n",
+			networkMillis[n],ok,TRANSACTIONS,ms,(double)module.commands/TRANSACTIONS);
+		hostCheck(ok==TRANSACTIONS && module.smtpMessages==TRANSACTIONS,"the server accepted every message");
+	}
+	return hostFailures()!=0;
+}
@@ -0,0 +1,111 @@
+/*
+ * Author: Roger Clark www.rogerclark.net
+ *
+ * Copyright (c) 2014 Roger Clark
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "FakeModule.h"
+#include "UARTWifiSmtpSession.h"
+
+/*
+ * Messages per second sent to FakeModule's SMTP server, in simulated time, by sendEmail() (a connection per message) and by
+ * UARTWifiSmtpSession, with and without PIPELINING offered by the server.
+ * Also checks that the session reconnects when its socket has gone, and closes once idle.
+ */
+#define MESSAGES 20
+
+FakeModule module;
+UARTWifi wifi(&module,8,9);
+char to[]="someone@example.com";
+char from[]="logger@example.com";
+char name[]="Someone";
+char subject[]="Alert";
+char message[]="Temperature above limit";
+char domain[]="example.com";
+char server[]="192.168.1.10";
+
+void report(const char *name,unsigned long long start,int ok)
+{
+	double seconds=(hostMicros()-start)/1e6;
+	printf("  %-24s %d/%d sent, %.2f messages/s, %4.0f ms per message, %4.1f module commands per message, %lu connections\n",name,ok,
+		MESSAGES,MESSAGES/seconds,seconds*1000/MESSAGES,(double)module.commands/MESSAGES,module.smtpConnections);
+	hostCheck(ok==MESSAGES && module.smtpMessages==MESSAGES,"the server accepted every message");
+}
+
+void sendEmailThroughput(unsigned long networkMillis)
+{
+	module.reset();
+	module.networkMicros=networkMillis*1000;
+	unsigned long long start=hostMicros();
+	int ok=0;
+	for(int i=0;i<MESSAGES;i++)
+	{
+		ok+=(wifi.sendEmail(to,from,name,subject,message,domain,server)==0);
+	}
+	report("sendEmail()",start,ok);
+}
+
+void sessionThroughput(unsigned long networkMillis,boolean pipelining)
+{
+	module.reset();
+	module.networkMicros=networkMillis*1000;
+	module.smtpPipelining=pipelining;
+	UARTWifiSmtpSession session(&wifi,server,domain);
+	unsigned long long start=hostMicros();
+	int ok=0;
+	for(int i=0;i<MESSAGES;i++)
+	{
+		ok+=(session.send(to,from,name,subject,message)==0);
+	}
+	session.close();
+	report(pipelining ? "session, PIPELINING" : "session, no PIPELINING",start,ok);
+	hostCheck(session.pipelining()==pipelining,"the session saw whether the server offered PIPELINING");
+	hostCheck(module.smtpConnections==1,"one connection for every message");
+}
+
+void reconnect()
+{
+	module.reset();
+	module.smtpPipelining=true;
+	UARTWifiSmtpSession session(&wifi,server,domain,5000);
+
+	hostCheck(session.send(to,from,name,subject,message)==0 && session.isOpen(),"first message sent");
+	// The socket has gone, e.g. the server dropped the connection, so the module doesn't know the socket number any more
+	module.script("AT+SKSND","+ERR=-2");
+	hostCheck(session.send(to,from,name,subject,message)==0,"message sent after the socket had gone");
+	hostCheck(module.smtpConnections==2 && module.smtpMessages==2,"the session reconnected and sent the message once");
+
+	hostAdvance(6000000);
+	session.poll();
+	hostCheck(!session.isOpen(),"poll() closed the idle session");
+}
+
+int main()
+{
+	static const unsigned long networkMillis[] = { 20, 100 };
+
+	for(unsigned int n=0;n<sizeof(networkMillis)/sizeof(networkMillis[0]);n++)
+	{
+		printf("server reply time %lu ms\n",networkMillis[n]);
+		sendEmailThroughput(networkMillis[n]);
+		sessionThroughput(networkMillis[n],false);
+		sessionThroughput(networkMillis[n],true);
+	}
+	module.networkMicros=20000;
+	reconnect();
+	return hostFailures()!=0;
+}